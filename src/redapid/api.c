@@ -20,10 +20,15 @@
  */
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <daemonlib/array.h>
 #include <daemonlib/base58.h>
+#include <daemonlib/config.h>
 #include <daemonlib/log.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
 #include "api.h"
@@ -38,6 +43,7 @@
 #include "program.h"
 #include "string.h"
 #include "version.h"
+#include "worker.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
@@ -116,7 +122,17 @@ typedef enum {
 	FUNCTION_GET_CUSTOM_PROGRAM_OPTION_VALUE,
 	FUNCTION_REMOVE_CUSTOM_PROGRAM_OPTION,
 	CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED,
-	CALLBACK_PROGRAM_PROCESS_SPAWNED
+	CALLBACK_PROGRAM_PROCESS_SPAWNED,
+
+	FUNCTION_RELEASE_OBJECTS,
+	FUNCTION_RELEASE_SESSION_OBJECTS,
+	FUNCTION_READ_FILE_ASYNC_WINDOWED,
+	FUNCTION_GRANT_ASYNC_FILE_READ_CREDITS,
+	FUNCTION_READ_FILE_LARGE,
+	FUNCTION_WRITE_FILE_LARGE,
+	FUNCTION_SUBSCRIBE_OBJECT_CALLBACKS,
+	FUNCTION_UNSUBSCRIBE_OBJECT_CALLBACKS,
+	FUNCTION_EXECUTE_COMPOUND
 } APIFunctionID;
 
 static uint32_t _uid = 0; // always little endian
@@ -126,6 +142,42 @@ static FileEventsOccurredCallback _file_events_occurred_callback;
 static ProcessStateChangedCallback _process_state_changed_callback;
 static ProgramSchedulerStateChangedCallback _program_scheduler_state_changed_callback;
 static ProgramProcessSpawnedCallback _program_process_spawned_callback;
+static ReadFileLargeResponse _read_file_large_response; // too big for the stack
+static ExecuteCompoundResponse _execute_compound_response; // too big for the stack
+static Packet *_compound_step_response = NULL; // set while a compound step is executed
+
+// callbacks triggered while a request is handled are sent after its response.
+// a single request can trigger many callbacks, for example an async write
+// that flushes the write-behind buffer, so the queue grows as needed
+typedef struct {
+	ObjectID object_id;
+	Object *object; // NULL if the callback is only sent to the requester
+	uint32_t requester;
+	Packet callback;
+} DeferredCallback;
+
+static bool _handling_request = false;
+static Array _deferred_callbacks; // of DeferredCallback
+
+static void api_dispatch_request(Packet *request);
+
+// state callbacks for the same object can be coalesced within a short window.
+// only the latest state is sent, file events are OR'ed together
+#define API_MAX_COALESCED_CALLBACKS 64
+
+typedef struct {
+	ObjectID object_id;
+	Object *object;
+	Packet callback;
+} CoalescedCallback;
+
+static uint64_t _coalescing_window = 0; // in microseconds, 0 disables coalescing
+static Timer _coalescing_timer;
+static CoalescedCallback _coalesced_callbacks[API_MAX_COALESCED_CALLBACKS];
+static int _coalesced_callback_count = 0;
+static uint32_t _coalesced_callbacks_sent = 0;
+static uint32_t _coalesced_callbacks_merged = 0;
+static uint32_t _coalesced_callbacks_dropped = 0;
 
 static void api_prepare_response(Packet *request, Packet *response, uint8_t length) {
 	// memset'ing the whole response to zero first ensures that all members
@@ -143,6 +195,20 @@ static void api_prepare_response(Packet *request, Packet *response, uint8_t leng
 	packet_header_set_response_expected(&response->header, true);
 }
 
+// the length field of the packet header is only one byte. large responses
+// set it to zero, their actual length is given by the local client frame
+static void api_prepare_large_response(Packet *request, Packet *response, int length) {
+	memset(response, 0, length);
+
+	response->header.uid = request->header.uid;
+	response->header.length = 0;
+	response->header.function_id = request->header.function_id;
+
+	packet_header_set_sequence_number(&response->header,
+	                                  packet_header_get_sequence_number(&request->header));
+	packet_header_set_response_expected(&response->header, true);
+}
+
 void api_prepare_callback(Packet *callback, uint8_t length, uint8_t function_id) {
 	// memset'ing the whole callback to zero first ensures that all members
 	// have a known initial value, that no random heap/stack data can leak to
@@ -158,6 +224,133 @@ void api_prepare_callback(Packet *callback, uint8_t length, uint8_t function_id)
 	packet_header_set_response_expected(&callback->header, true);
 }
 
+// while a step of a compound request is executed its response is captured
+// instead of being sent
+static void api_dispatch_response(Packet *response) {
+	if (_compound_step_response != NULL) {
+		memcpy(_compound_step_response, response, response->header.length);
+
+		return;
+	}
+
+	network_dispatch_response(response);
+}
+
+static ObjectCallback api_get_callback_type(Packet *callback) {
+	switch (callback->header.function_id) {
+	case CALLBACK_ASYNC_FILE_READ:                 return OBJECT_CALLBACK_ASYNC_FILE_READ;
+	case CALLBACK_ASYNC_FILE_WRITE:                return OBJECT_CALLBACK_ASYNC_FILE_WRITE;
+	case CALLBACK_FILE_EVENTS_OCCURRED:            return OBJECT_CALLBACK_FILE_EVENTS_OCCURRED;
+	case CALLBACK_PROCESS_STATE_CHANGED:           return OBJECT_CALLBACK_PROCESS_STATE_CHANGED;
+	case CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED: return OBJECT_CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED;
+	default:                                       return OBJECT_CALLBACK_PROGRAM_PROCESS_SPAWNED;
+	}
+}
+
+// a callback for an object is sent to all connections whose sessions are
+// subscribed to it. a callback without an object reports a failed request
+// and is only sent to the requester
+static void api_send_callback(Object *object, uint32_t requester, Packet *callback) {
+	if (object == NULL) {
+		network_dispatch_deferred_response(requester, callback);
+	} else {
+		network_dispatch_callback(callback, object, api_get_callback_type(callback));
+	}
+}
+
+static void api_dispatch_callback(Object *object, Packet *callback) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	DeferredCallback *deferred_callback;
+
+	if (!_handling_request) {
+		api_send_callback(object, network_get_requester(), callback);
+
+		return;
+	}
+
+	deferred_callback = array_append(&_deferred_callbacks);
+
+	if (deferred_callback == NULL) {
+		// sending it now would overtake the response and the queued callbacks
+		log_error("Could not append to deferred callback array, dropping %s (%s): %s (%d)",
+		          packet_get_response_type(callback),
+		          packet_get_response_signature(packet_signature, callback),
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	deferred_callback->object_id = object != NULL ? object->id : OBJECT_ID_ZERO;
+	deferred_callback->object = object;
+	deferred_callback->requester = network_get_requester();
+
+	memcpy(&deferred_callback->callback, callback, callback->header.length);
+}
+
+static void api_prepare_async_file_read_callback(ObjectID file_id, APIE error_code,
+                                                uint8_t *buffer, uint8_t length_read) {
+	_async_file_read_callback.file_id = file_id;
+	_async_file_read_callback.error_code = error_code;
+	_async_file_read_callback.length_read = length_read;
+
+	// buffer can be NULL if length_read is zero
+	if (length_read > 0) {
+		memcpy(_async_file_read_callback.buffer, buffer, length_read);
+	}
+
+	// memset'ing the rest of the buffer to zero ensures that no random
+	// heap/stack data can leak to the client
+	memset(_async_file_read_callback.buffer + length_read, 0,
+	       sizeof(_async_file_read_callback.buffer) - length_read);
+}
+
+// reports a failed read-file-async request for an unknown file object
+static void api_send_async_file_read_error_callback(ObjectID file_id, APIE error_code) {
+	api_prepare_async_file_read_callback(file_id, error_code, NULL, 0);
+	api_dispatch_callback(NULL, (Packet *)&_async_file_read_callback);
+}
+
+// reports a failed write-file-async request for an unknown file object
+static void api_send_async_file_write_error_callback(ObjectID file_id, APIE error_code) {
+	_async_file_write_callback.file_id = file_id;
+	_async_file_write_callback.error_code = error_code;
+	_async_file_write_callback.length_written = 0;
+
+	api_dispatch_callback(NULL, (Packet *)&_async_file_write_callback);
+}
+
+// some requests block on the SD card or on other processes. outside of compound
+// requests they are done on a worker thread and the response is sent once the
+// worker thread is done. the sequence number of the prepared response matches
+// the request
+typedef struct {
+	uint32_t requester;
+	Packet response;
+} DeferredResponse;
+
+static DeferredResponse *api_defer_response(Packet *response) {
+	DeferredResponse *deferred = calloc(1, sizeof(DeferredResponse));
+
+	if (deferred == NULL) {
+		log_error("Could not allocate deferred %s: %s (%d)",
+		          packet_get_response_type(response), get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	deferred->requester = network_get_requester();
+
+	memcpy(&deferred->response, response, response->header.length);
+
+	return deferred;
+}
+
+static void api_dispatch_deferred_response(DeferredResponse *deferred) {
+	network_dispatch_deferred_response(deferred->requester, &deferred->response);
+
+	free(deferred);
+}
+
 static void api_send_response_if_expected(Packet *request, PacketE error_code) {
 	EmptyResponse response;
 
@@ -169,7 +362,24 @@ static void api_send_response_if_expected(Packet *request, PacketE error_code) {
 
 	packet_header_set_error_code(&response.header, error_code);
 
-	network_dispatch_response((Packet *)&response);
+	api_dispatch_response((Packet *)&response);
+}
+
+// callbacks are only sent to the connections that used a session subscribed to
+// them. every request that refers to a session records its connection
+static APIE api_get_session(SessionID id, Session **session) {
+	APIE error_code = inventory_get_session(id, session);
+	uint32_t requester;
+
+	if (error_code == API_E_SUCCESS) {
+		requester = network_get_requester();
+
+		if (requester != 0) {
+			(*session)->connection_id = requester;
+		}
+	}
+
+	return error_code;
 }
 
 static PacketE api_get_packet_error_code(APIE error_code) {
@@ -194,7 +404,7 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 		packet_prefix##Response response; \
 		api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response)); \
 		body \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 #define CALL_TYPE_FUNCTION(packet_prefix, function_suffix, body, object_type, type, variable) \
@@ -207,7 +417,7 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 		if (response.error_code == API_E_SUCCESS) { \
 			body \
 		} \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 #define CALL_TYPE_FUNCTION_WITH_SESSION(packet_prefix, function_suffix, body, object_type, type, variable) \
@@ -219,12 +429,12 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 		response.error_code = inventory_get_object(object_type, request->variable##_id, \
 		                                           (Object **)&variable); \
 		if (response.error_code == API_E_SUCCESS) { \
-			response.error_code = inventory_get_session(request->session_id, &session); \
+			response.error_code = api_get_session(request->session_id, &session); \
 			if (response.error_code == API_E_SUCCESS) { \
 				body \
 			} \
 		} \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 #define CALL_FUNCTION_WITH_STRING(packet_prefix, function_suffix, variable, body) \
@@ -236,7 +446,7 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 		if (response.error_code == API_E_SUCCESS) { \
 			body \
 		} \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 #define CALL_FUNCTION_WITH_SESSION(packet_prefix, function_suffix, body) \
@@ -244,11 +454,11 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 		packet_prefix##Response response; \
 		Session *session; \
 		api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response)); \
-		response.error_code = inventory_get_session(request->session_id, &session); \
+		response.error_code = api_get_session(request->session_id, &session); \
 		if (response.error_code == API_E_SUCCESS) { \
 			body \
 		} \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 //
@@ -260,17 +470,17 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 		packet_prefix##Response response; \
 		Session *session; \
 		api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response)); \
-		response.error_code = inventory_get_session(request->session_id, &session); \
+		response.error_code = api_get_session(request->session_id, &session); \
 		if (response.error_code == API_E_SUCCESS) { \
 			body \
 		} \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 #define CALL_SESSION_PROCEDURE(packet_prefix, function_suffix, error_handler, body) \
 	static void api_##function_suffix(packet_prefix##Request *request) { \
 		Session *session; \
-		APIE api_error_code = inventory_get_session(request->session_id, &session); \
+		APIE api_error_code = api_get_session(request->session_id, &session); \
 		PacketE packet_error_code; \
 		if (api_error_code != API_E_SUCCESS) { \
 			APIE error_code = api_error_code; \
@@ -286,7 +496,13 @@ static PacketE api_get_packet_error_code(APIE error_code) {
 	}
 
 CALL_FUNCTION(CreateSession, create_session, {
+	Session *session;
+
 	response.error_code = session_create(request->lifetime, &response.session_id);
+
+	if (response.error_code == API_E_SUCCESS) {
+		api_get_session(response.session_id, &session);
+	}
 })
 
 CALL_SESSION_FUNCTION(ExpireSession, expire_session, {
@@ -301,6 +517,21 @@ CALL_SESSION_FUNCTION(KeepSessionAlive, keep_session_alive, {
 	response.error_code = session_keep_alive(session, request->lifetime);
 })
 
+CALL_SESSION_FUNCTION(ReleaseSessionObjects, release_session_objects, {
+	response.error_code = session_release_objects(session);
+})
+
+CALL_SESSION_FUNCTION(ReleaseObjects, release_objects, {
+	uint16_t object_ids[OBJECT_MAX_RELEASE_OBJECTS_LENGTH];
+
+	// requests are dispatched from the receive buffer in place and might not
+	// be aligned, copy the object IDs before accessing them as an array
+	memcpy(object_ids, request->object_ids, sizeof(object_ids));
+
+	response.error_code = object_release_multiple(object_ids, request->object_id_count,
+	                                              session, &response.objects_released);
+})
+
 //
 // object
 //
@@ -313,12 +544,12 @@ CALL_SESSION_FUNCTION(KeepSessionAlive, keep_session_alive, {
 		api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response)); \
 		response.error_code = inventory_get_object(OBJECT_TYPE_ANY, request->object_id, &object); \
 		if (response.error_code == API_E_SUCCESS) { \
-			response.error_code = inventory_get_session(request->session_id, &session); \
+			response.error_code = api_get_session(request->session_id, &session); \
 			if (response.error_code == API_E_SUCCESS) { \
 				body \
 			} \
 		} \
-		network_dispatch_response((Packet *)&response); \
+		api_dispatch_response((Packet *)&response); \
 	}
 
 #define CALL_OBJECT_PROCEDURE_WITH_SESSION(packet_prefix, function_suffix, error_handler, body) \
@@ -333,7 +564,7 @@ CALL_SESSION_FUNCTION(KeepSessionAlive, keep_session_alive, {
 			error_handler \
 			packet_error_code = api_get_packet_error_code(api_error_code); \
 		} else { \
-			api_error_code = inventory_get_session(request->session_id, &session); \
+			api_error_code = api_get_session(request->session_id, &session); \
 			if (api_error_code != API_E_SUCCESS) { \
 				APIE error_code = api_error_code; \
 				(void)error_code; \
@@ -356,6 +587,14 @@ CALL_OBJECT_PROCEDURE_WITH_SESSION(ReleaseObjectUnchecked, release_object_unchec
 	error_code = object_release_unchecked(object, session);
 })
 
+CALL_OBJECT_FUNCTION_WITH_SESSION(SubscribeObjectCallbacks, subscribe_object_callbacks, {
+	response.error_code = object_subscribe_callbacks(object, session, request->callbacks);
+})
+
+CALL_OBJECT_FUNCTION_WITH_SESSION(UnsubscribeObjectCallbacks, unsubscribe_object_callbacks, {
+	response.error_code = object_unsubscribe_callbacks(object, session, request->callbacks);
+})
+
 #undef CALL_OBJECT_PROCEDURE_WITH_SESSION
 #undef CALL_OBJECT_FUNCTION_WITH_SESSION
 
@@ -461,13 +700,66 @@ CALL_LIST_FUNCTION(RemoveFromList, remove_from_list, {
 		api_send_response_if_expected((Packet *)request, packet_error_code); \
 	}
 
-CALL_FUNCTION_WITH_SESSION(OpenFile, open_file, {
-	response.error_code = file_open(request->name_string_id, request->flags,
-	                                request->permissions, request->uid,
-	                                request->gid, session,
-	                                OBJECT_CREATE_FLAG_EXTERNAL,
-	                                &response.file_id, NULL);
-})
+static void api_handle_file_opened(APIE error_code, ObjectID file_id, void *opaque) {
+	DeferredResponse *deferred = opaque;
+	OpenFileResponse *response = (OpenFileResponse *)&deferred->response;
+
+	response->error_code = error_code;
+	response->file_id = file_id;
+
+	api_dispatch_deferred_response(deferred);
+}
+
+static void api_open_file(OpenFileRequest *request) {
+	OpenFileResponse response;
+	Session *session;
+	DeferredResponse *deferred;
+
+	api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = api_get_session(request->session_id, &session);
+
+	if (response.error_code != API_E_SUCCESS) {
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the response of a compound step is needed before the next step
+	if (_compound_step_response != NULL) {
+		response.error_code = file_open(request->name_string_id, request->flags,
+		                                request->permissions, request->uid,
+		                                request->gid, session,
+		                                OBJECT_CREATE_FLAG_EXTERNAL,
+		                                &response.file_id, NULL);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred = api_defer_response((Packet *)&response);
+
+	if (deferred == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	response.error_code = file_open_deferred(request->name_string_id, request->flags,
+	                                         request->permissions, request->uid,
+	                                         request->gid, session,
+	                                         OBJECT_CREATE_FLAG_EXTERNAL,
+	                                         api_handle_file_opened, deferred);
+
+	if (response.error_code != API_E_SUCCESS) {
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+	}
+}
 
 CALL_FUNCTION_WITH_SESSION(CreatePipe, create_pipe, {
 	response.error_code = pipe_create_(request->flags, request->length, session,
@@ -475,15 +767,86 @@ CALL_FUNCTION_WITH_SESSION(CreatePipe, create_pipe, {
 	                                   &response.file_id, NULL);
 })
 
-CALL_FILE_FUNCTION_WITH_SESSION(GetFileInfo, get_file_info, {
-	response.error_code = file_get_info(file, session, &response.type,
-	                                    &response.name_string_id, &response.flags,
-	                                    &response.permissions, &response.uid,
-	                                    &response.gid, &response.length,
-	                                    &response.access_timestamp,
-	                                    &response.modification_timestamp,
-	                                    &response.status_change_timestamp);
-})
+static void api_set_file_info(GetFileInfoResponse *response, FileInfo *info) {
+	response->type = info->type;
+	response->name_string_id = info->name_id;
+	response->flags = info->flags;
+	response->permissions = info->permissions;
+	response->uid = info->uid;
+	response->gid = info->gid;
+	response->length = info->length;
+	response->access_timestamp = info->access_timestamp;
+	response->modification_timestamp = info->modification_timestamp;
+	response->status_change_timestamp = info->status_change_timestamp;
+}
+
+static void api_handle_file_info(APIE error_code, FileInfo *info, void *opaque) {
+	DeferredResponse *deferred = opaque;
+	GetFileInfoResponse *response = (GetFileInfoResponse *)&deferred->response;
+
+	response->error_code = error_code;
+
+	if (error_code == API_E_SUCCESS) {
+		api_set_file_info(response, info);
+	}
+
+	api_dispatch_deferred_response(deferred);
+}
+
+static void api_get_file_info(GetFileInfoRequest *request) {
+	GetFileInfoResponse response;
+	File *file;
+	Session *session;
+	FileInfo info;
+	DeferredResponse *deferred;
+
+	api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = inventory_get_object(OBJECT_TYPE_FILE, request->file_id,
+	                                           (Object **)&file);
+
+	if (response.error_code == API_E_SUCCESS) {
+		response.error_code = api_get_session(request->session_id, &session);
+	}
+
+	if (response.error_code != API_E_SUCCESS) {
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the response of a compound step is needed before the next step
+	if (_compound_step_response != NULL) {
+		response.error_code = file_get_info(file, session, &info);
+
+		if (response.error_code == API_E_SUCCESS) {
+			api_set_file_info(&response, &info);
+		}
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred = api_defer_response((Packet *)&response);
+
+	if (deferred == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	response.error_code = file_get_info_deferred(file, session,
+	                                             api_handle_file_info, deferred);
+
+	if (response.error_code != API_E_SUCCESS) {
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+	}
+}
 
 CALL_FILE_FUNCTION(ReadFile, read_file, {
 	response.error_code = file_read(file, response.buffer, request->length_to_read,
@@ -491,12 +854,21 @@ CALL_FILE_FUNCTION(ReadFile, read_file, {
 })
 
 CALL_FILE_PROCEDURE(ReadFileAsync, read_file_async, {
-	// FIXME: this callback should be delivered after the response of this function
-	api_send_async_file_read_callback(request->file_id, error_code, NULL, 0);
+	api_send_async_file_read_error_callback(request->file_id, error_code);
 }, {
 	error_code = file_read_async(file, request->length_to_read);
 })
 
+CALL_FILE_PROCEDURE(ReadFileAsyncWindowed, read_file_async_windowed, {
+	api_send_async_file_read_error_callback(request->file_id, error_code);
+}, {
+	error_code = file_read_async_windowed(file, request->length_to_read, request->window);
+})
+
+CALL_FILE_FUNCTION(GrantAsyncFileReadCredits, grant_async_file_read_credits, {
+	response.error_code = file_grant_async_read_credits(file, request->credits);
+})
+
 CALL_FILE_FUNCTION(AbortAsyncFileRead, abort_async_file_read, {
 	response.error_code = file_abort_async_read(file);
 })
@@ -512,8 +884,7 @@ CALL_FILE_PROCEDURE(WriteFileUnchecked, write_file_unchecked, {}, {
 })
 
 CALL_FILE_PROCEDURE(WriteFileAsync, write_file_async, {
-	// FIXME: this callback should be delivered after the response of this function
-	api_send_async_file_write_callback(request->file_id, error_code, 0);
+	api_send_async_file_write_error_callback(request->file_id, error_code);
 }, {
 	error_code = file_write_async(file, request->buffer, request->length_to_write);
 })
@@ -527,6 +898,48 @@ CALL_FILE_FUNCTION(GetFilePosition, get_file_position, {
 	response.error_code = file_get_position(file, &response.position);
 })
 
+// large functions are only available to local clients. they are not handled
+// by the CALL_* macros because their packets don't fit into a TFP packet
+
+static void api_read_file_large(ReadFileLargeRequest *request) {
+	ReadFileLargeResponse *response = &_read_file_large_response;
+	File *file;
+
+	api_prepare_large_response((Packet *)request, (Packet *)response,
+	                           offsetof(ReadFileLargeResponse, buffer));
+
+	response->error_code = inventory_get_object(OBJECT_TYPE_FILE, request->file_id,
+	                                            (Object **)&file);
+
+	if (response->error_code == API_E_SUCCESS) {
+		response->error_code = file_read_large(file, response->buffer,
+		                                       request->length_to_read,
+		                                       &response->length_read);
+	}
+
+	network_dispatch_large_response((Packet *)response,
+	                                offsetof(ReadFileLargeResponse, buffer) +
+	                                response->length_read);
+}
+
+static void api_write_file_large(WriteFileLargeRequest *request) {
+	WriteFileLargeResponse response;
+	File *file;
+
+	api_prepare_large_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = inventory_get_object(OBJECT_TYPE_FILE, request->file_id,
+	                                           (Object **)&file);
+
+	if (response.error_code == API_E_SUCCESS) {
+		response.error_code = file_write_large(file, request->buffer,
+		                                       request->length_to_write,
+		                                       &response.length_written);
+	}
+
+	network_dispatch_large_response((Packet *)&response, sizeof(response));
+}
+
 CALL_FILE_FUNCTION(SetFileEvents, set_file_events, {
 	response.error_code = file_set_events(file, request->events);
 })
@@ -551,31 +964,240 @@ CALL_FILE_FUNCTION(GetFileEvents, get_file_events, {
 	CALL_TYPE_FUNCTION_WITH_SESSION(packet_prefix, function_suffix, body, \
 	                                OBJECT_TYPE_DIRECTORY, Directory, directory)
 
-CALL_FUNCTION_WITH_SESSION(OpenDirectory, open_directory, {
-	response.error_code = directory_open(request->name_string_id, session,
-	                                     &response.directory_id);
-})
+static void api_handle_directory_opened(APIE error_code, ObjectID directory_id,
+                                        void *opaque) {
+	DeferredResponse *deferred = opaque;
+	OpenDirectoryResponse *response = (OpenDirectoryResponse *)&deferred->response;
+
+	response->error_code = error_code;
+	response->directory_id = directory_id;
+
+	api_dispatch_deferred_response(deferred);
+}
+
+static void api_open_directory(OpenDirectoryRequest *request) {
+	OpenDirectoryResponse response;
+	Session *session;
+	DeferredResponse *deferred;
+
+	api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = api_get_session(request->session_id, &session);
+
+	if (response.error_code != API_E_SUCCESS) {
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the response of a compound step is needed before the next step
+	if (_compound_step_response != NULL) {
+		response.error_code = directory_open(request->name_string_id, session,
+		                                     &response.directory_id);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred = api_defer_response((Packet *)&response);
+
+	if (deferred == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	response.error_code = directory_open_deferred(request->name_string_id, session,
+	                                              api_handle_directory_opened,
+	                                              deferred);
+
+	if (response.error_code != API_E_SUCCESS) {
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+	}
+}
 
 CALL_DIRECTORY_FUNCTION_WITH_SESSION(GetDirectoryName, get_directory_name, {
 	response.error_code = directory_get_name(directory, session,
 	                                         &response.name_string_id);
 })
 
-CALL_DIRECTORY_FUNCTION_WITH_SESSION(GetNextDirectoryEntry, get_next_directory_entry, {
-	response.error_code = directory_get_next_entry(directory, session,
-	                                               &response.name_string_id,
-	                                               &response.type);
-})
+static void api_handle_directory_entry(APIE error_code, ObjectID name_id,
+                                       uint8_t type, void *opaque) {
+	DeferredResponse *deferred = opaque;
+	GetNextDirectoryEntryResponse *response = (GetNextDirectoryEntryResponse *)&deferred->response;
+
+	response->error_code = error_code;
+	response->name_string_id = name_id;
+	response->type = type;
+
+	api_dispatch_deferred_response(deferred);
+}
+
+static void api_get_next_directory_entry(GetNextDirectoryEntryRequest *request) {
+	GetNextDirectoryEntryResponse response;
+	Directory *directory;
+	Session *session;
+	DeferredResponse *deferred;
+
+	api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = inventory_get_object(OBJECT_TYPE_DIRECTORY, request->directory_id,
+	                                           (Object **)&directory);
+
+	if (response.error_code == API_E_SUCCESS) {
+		response.error_code = api_get_session(request->session_id, &session);
+	}
+
+	if (response.error_code != API_E_SUCCESS) {
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the response of a compound step is needed before the next step
+	if (_compound_step_response != NULL) {
+		response.error_code = directory_get_next_entry(directory, session,
+		                                               &response.name_string_id,
+		                                               &response.type);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred = api_defer_response((Packet *)&response);
+
+	if (deferred == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	response.error_code = directory_get_next_entry_deferred(directory, session,
+	                                                        api_handle_directory_entry,
+	                                                        deferred);
+
+	if (response.error_code != API_E_SUCCESS) {
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+	}
+}
 
 CALL_DIRECTORY_FUNCTION(RewindDirectory, rewind_directory, {
 	response.error_code = directory_rewind(directory);
 })
 
-CALL_FUNCTION_WITH_STRING(CreateDirectory, create_directory, name, {
-	response.error_code = directory_create(name->buffer, request->flags,
-	                                       request->permissions,
-	                                       request->uid, request->gid);
-})
+// creating a directory blocks for mkdir calls on the SD card, and for a fork
+// and waitpid if the directory is created as a different user. this is done
+// on a worker thread and the response is sent once the directory is created
+typedef struct {
+	uint32_t requester;
+	CreateDirectoryResponse response;
+	char *name;
+	uint32_t flags;
+	uint16_t permissions;
+	uint32_t uid;
+	uint32_t gid;
+} DeferredCreateDirectory;
+
+static void api_work_create_directory(void *opaque) {
+	DeferredCreateDirectory *deferred = opaque;
+
+	deferred->response.error_code = directory_create(deferred->name, deferred->flags,
+	                                                 deferred->permissions,
+	                                                 deferred->uid, deferred->gid);
+}
+
+static void api_complete_create_directory(void *opaque) {
+	DeferredCreateDirectory *deferred = opaque;
+
+	network_dispatch_deferred_response(deferred->requester, (Packet *)&deferred->response);
+
+	free(deferred->name);
+	free(deferred);
+}
+
+static void api_create_directory(CreateDirectoryRequest *request) {
+	CreateDirectoryResponse response;
+	String *name;
+	DeferredCreateDirectory *deferred;
+
+	api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = string_get(request->name_string_id, &name);
+
+	if (response.error_code != API_E_SUCCESS) {
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the response of a compound step is needed before the next step
+	if (_compound_step_response != NULL) {
+		response.error_code = directory_create(name->buffer, request->flags,
+		                                       request->permissions,
+		                                       request->uid, request->gid);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred = calloc(1, sizeof(DeferredCreateDirectory));
+
+	if (deferred == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		log_error("Could not allocate deferred create-directory response: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the string object might be modified while the directory is created
+	deferred->name = strdup(name->buffer);
+
+	if (deferred->name == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		log_error("Could not duplicate directory name: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred->requester = network_get_requester();
+	deferred->flags = request->flags;
+	deferred->permissions = request->permissions;
+	deferred->uid = request->uid;
+	deferred->gid = request->gid;
+
+	memcpy(&deferred->response, &response, sizeof(response));
+
+	response.error_code = worker_submit(api_work_create_directory,
+	                                    api_complete_create_directory, deferred);
+
+	if (response.error_code != API_E_SUCCESS) {
+		free(deferred->name);
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+	}
+}
 
 #undef CALL_DIRECTORY_FUNCTION_WITH_SESSION
 #undef CALL_DIRECTORY_FUNCTION
@@ -669,9 +1291,59 @@ CALL_FUNCTION_WITH_SESSION(DefineProgram, define_program, {
 	                                     &response.program_id);
 })
 
-CALL_PROGRAM_FUNCTION(PurgeProgram, purge_program, {
-	response.error_code = program_purge(program, request->cookie);
-})
+static void api_handle_program_purged(APIE error_code, void *opaque) {
+	DeferredResponse *deferred = opaque;
+	PurgeProgramResponse *response = (PurgeProgramResponse *)&deferred->response;
+
+	response->error_code = error_code;
+
+	api_dispatch_deferred_response(deferred);
+}
+
+static void api_purge_program(PurgeProgramRequest *request) {
+	PurgeProgramResponse response;
+	Program *program;
+	DeferredResponse *deferred;
+
+	api_prepare_response((Packet *)request, (Packet *)&response, sizeof(response));
+
+	response.error_code = inventory_get_object(OBJECT_TYPE_PROGRAM, request->program_id,
+	                                           (Object **)&program);
+
+	if (response.error_code != API_E_SUCCESS) {
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	// the response of a compound step is needed before the next step
+	if (_compound_step_response != NULL) {
+		response.error_code = program_purge(program, request->cookie);
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	deferred = api_defer_response((Packet *)&response);
+
+	if (deferred == NULL) {
+		response.error_code = API_E_NO_FREE_MEMORY;
+
+		api_dispatch_response((Packet *)&response);
+
+		return;
+	}
+
+	response.error_code = program_purge_deferred(program, request->cookie,
+	                                             api_handle_program_purged, deferred);
+
+	if (response.error_code != API_E_SUCCESS) {
+		free(deferred);
+
+		api_dispatch_response((Packet *)&response);
+	}
+}
 
 CALL_PROGRAM_FUNCTION_WITH_SESSION(GetProgramIdentifier, get_program_identifier, {
 	response.error_code = program_get_identifier(program, session,
@@ -806,10 +1478,289 @@ CALL_FUNCTION(GetIdentity, get_identity, {
 #undef CALL_FUNCTION
 #undef CALL_PROCEDURE
 
+//
+// compound
+//
+
+// splits the next step of a compound request into its references and its
+// request packet. returns NULL if the step is malformed
+static uint8_t *api_parse_compound_step(uint8_t *step, uint8_t *end, int index,
+                                        CompoundReference **references,
+                                        int *reference_count, Packet **request) {
+	PacketHeader *header;
+	int i;
+
+	if (step >= end) {
+		return NULL;
+	}
+
+	*reference_count = *step;
+	*references = (CompoundReference *)(step + 1);
+	header = (PacketHeader *)(step + 1 + *reference_count * sizeof(CompoundReference));
+
+	if ((uint8_t *)header + sizeof(PacketHeader) > end ||
+	    header->length < sizeof(PacketHeader) || header->length > sizeof(Packet) ||
+	    (uint8_t *)header + header->length > end) {
+		return NULL;
+	}
+
+	// a step is validated like a top-level request, except for the response
+	// expected flag. every step sends a response, so it is set explicitly
+	if (header->uid != _uid || header->function_id == 0 ||
+	    packet_header_get_sequence_number(header) == 0) {
+		return NULL;
+	}
+
+	packet_header_set_response_expected(header, true);
+
+	for (i = 0; i < *reference_count; ++i) {
+		if ((*references)[i].step >= index ||
+		    (*references)[i].request_offset < sizeof(PacketHeader) ||
+		    (*references)[i].request_offset + sizeof(ObjectID) > header->length) {
+			return NULL;
+		}
+	}
+
+	*request = (Packet *)header;
+
+	return (uint8_t *)header + header->length;
+}
+
+// all functions, except for get-identity, have an error code as the first
+// member of their response
+static APIE api_get_compound_step_error_code(Packet *request, Packet *response) {
+	switch (packet_header_get_error_code(&response->header)) {
+	case PACKET_E_SUCCESS:
+		break;
+
+	case PACKET_E_INVALID_PARAMETER:
+		return API_E_INVALID_PARAMETER;
+
+	case PACKET_E_FUNCTION_NOT_SUPPORTED:
+		return API_E_NOT_SUPPORTED;
+
+	default:
+		return API_E_UNKNOWN_ERROR;
+	}
+
+	if (request->header.function_id == FUNCTION_GET_IDENTITY ||
+	    response->header.length <= sizeof(PacketHeader)) {
+		return API_E_SUCCESS;
+	}
+
+	return response->payload[0];
+}
+
+// executes the steps of a compound request in order and stops at the first
+// step that fails. the responses of all executed steps are returned together.
+// objects created by earlier steps are not released if a later step fails,
+// the client still owns them through the session it passed to those steps
+static void api_execute_compound(ExecuteCompoundRequest *request, int length) {
+	ExecuteCompoundResponse *response = &_execute_compound_response;
+	uint8_t *end = (uint8_t *)request + length;
+	uint8_t *step;
+	uint16_t response_offsets[256]; // of the step responses in the responses buffer
+	int responses_used = 0;
+	CompoundReference *references;
+	int reference_count;
+	Packet *step_request;
+	Packet step_response;
+	Packet *earlier_response;
+	int i;
+	int k;
+
+	api_prepare_large_response((Packet *)request, (Packet *)response,
+	                           offsetof(ExecuteCompoundResponse, responses));
+
+	// validate all steps before executing the first one, so that a malformed
+	// request has no side effects
+	step = request->steps;
+
+	for (i = 0; i < request->step_count && step != NULL; ++i) {
+		step = api_parse_compound_step(step, end, i, &references,
+		                               &reference_count, &step_request);
+	}
+
+	if (step != end) {
+		log_warn("Received malformed %s request",
+		         api_get_function_name(request->header.function_id));
+
+		response->error_code = API_E_INVALID_PARAMETER;
+
+		network_dispatch_large_response((Packet *)response,
+		                                offsetof(ExecuteCompoundResponse, responses));
+
+		return;
+	}
+
+	step = request->steps;
+
+	for (i = 0; i < request->step_count; ++i) {
+		step = api_parse_compound_step(step, end, i, &references,
+		                               &reference_count, &step_request);
+
+		for (k = 0; k < reference_count; ++k) {
+			earlier_response = (Packet *)(response->responses +
+			                              response_offsets[references[k].step]);
+
+			if (references[k].response_offset < sizeof(PacketHeader) ||
+			    references[k].response_offset + sizeof(ObjectID) > earlier_response->header.length) {
+				break;
+			}
+
+			memcpy((uint8_t *)step_request + references[k].request_offset,
+			       (uint8_t *)earlier_response + references[k].response_offset,
+			       sizeof(ObjectID));
+		}
+
+		if (k < reference_count) {
+			response->error_code = API_E_INVALID_PARAMETER;
+
+			break;
+		}
+
+		// every step has to respond to tell its outcome, even a procedure
+		packet_header_set_response_expected(&step_request->header, true);
+
+		step_response.header.length = 0;
+		_compound_step_response = &step_response;
+
+		api_dispatch_request(step_request);
+
+		_compound_step_response = NULL;
+
+		if (step_response.header.length == 0) {
+			response->error_code = API_E_INTERNAL_ERROR;
+
+			break;
+		}
+
+		response_offsets[i] = responses_used;
+
+		memcpy(response->responses + responses_used, &step_response,
+		       step_response.header.length);
+
+		responses_used += step_response.header.length;
+		++response->steps_executed;
+
+		response->error_code = api_get_compound_step_error_code(step_request, &step_response);
+
+		if (response->error_code != API_E_SUCCESS) {
+			break;
+		}
+	}
+
+	network_dispatch_large_response((Packet *)response,
+	                                offsetof(ExecuteCompoundResponse, responses) +
+	                                responses_used);
+}
+
 //
 // api
 //
 
+static void api_flush_coalesced_callbacks(void) {
+	int i;
+
+	for (i = 0; i < _coalesced_callback_count; ++i) {
+		api_dispatch_callback(_coalesced_callbacks[i].object, &_coalesced_callbacks[i].callback);
+	}
+
+	_coalesced_callbacks_sent += _coalesced_callback_count;
+	_coalesced_callback_count = 0;
+}
+
+// removes the pending callbacks of the object and either sends or drops them.
+// the order of the remaining pending callbacks is kept
+static void api_remove_coalesced_callbacks(ObjectID object_id, bool send) {
+	int i;
+	int k = 0;
+
+	for (i = 0; i < _coalesced_callback_count; ++i) {
+		if (_coalesced_callbacks[i].object_id != object_id) {
+			if (k != i) {
+				memcpy(&_coalesced_callbacks[k], &_coalesced_callbacks[i],
+				       sizeof(CoalescedCallback));
+			}
+
+			++k;
+
+			continue;
+		}
+
+		if (send) {
+			api_dispatch_callback(_coalesced_callbacks[i].object, &_coalesced_callbacks[i].callback);
+
+			++_coalesced_callbacks_sent;
+		} else {
+			++_coalesced_callbacks_dropped;
+		}
+	}
+
+	_coalesced_callback_count = k;
+}
+
+static void api_handle_coalescing_timer(void *opaque) {
+	(void)opaque;
+
+	api_flush_coalesced_callbacks();
+}
+
+// sends the callback right away if coalescing is disabled. otherwise it is
+// merged into a pending callback of the same type for the same object or
+// becomes pending itself, to be sent when the coalescing window ends
+static void api_dispatch_state_callback(Object *object, Packet *callback) {
+	CoalescedCallback *coalesced;
+	FileEventsOccurredCallback *file_events_occurred;
+	int i;
+
+	if (_coalescing_window == 0) {
+		api_dispatch_callback(object, callback);
+
+		return;
+	}
+
+	for (i = 0; i < _coalesced_callback_count; ++i) {
+		coalesced = &_coalesced_callbacks[i];
+
+		if (coalesced->object_id != object->id ||
+		    coalesced->callback.header.function_id != callback->header.function_id) {
+			continue;
+		}
+
+		if (callback->header.function_id == CALLBACK_FILE_EVENTS_OCCURRED) {
+			file_events_occurred = (FileEventsOccurredCallback *)&coalesced->callback;
+			file_events_occurred->events |= ((FileEventsOccurredCallback *)callback)->events;
+		} else {
+			memcpy(&coalesced->callback, callback, callback->header.length);
+		}
+
+		++_coalesced_callbacks_merged;
+
+		return;
+	}
+
+	if (_coalesced_callback_count == API_MAX_COALESCED_CALLBACKS) {
+		api_flush_coalesced_callbacks();
+	}
+
+	if (_coalesced_callback_count == 0 &&
+	    timer_configure(&_coalescing_timer, _coalescing_window, 0) < 0) {
+		log_error("Could not start callback coalescing timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		api_dispatch_callback(object, callback);
+
+		return;
+	}
+
+	coalesced = &_coalesced_callbacks[_coalesced_callback_count++];
+	coalesced->object_id = object->id;
+	coalesced->object = object;
+
+	memcpy(&coalesced->callback, callback, callback->header.length);
+}
+
 int api_init(void) {
 	char base58[BASE58_MAX_LENGTH];
 
@@ -851,18 +1802,101 @@ int api_init(void) {
 	                     sizeof(_program_process_spawned_callback),
 	                     CALLBACK_PROGRAM_PROCESS_SPAWNED);
 
+	if (array_create(&_deferred_callbacks, 8, sizeof(DeferredCallback), true) < 0) {
+		log_error("Could not create deferred callback array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	_coalescing_window = (uint64_t)config_get_option_value("api.callback_coalescing_window")->integer * 1000;
+
+	if (_coalescing_window > 0) {
+		log_debug("Coalescing state callbacks within %u msec",
+		          (uint32_t)(_coalescing_window / 1000));
+
+		if (timer_create_(&_coalescing_timer, api_handle_coalescing_timer, NULL) < 0) {
+			log_error("Could not create callback coalescing timer: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			array_destroy(&_deferred_callbacks, NULL);
+
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
 void api_exit(void) {
 	log_debug("Shutting down API subsystem");
+
+	if (_coalescing_window > 0) {
+		api_log_statistics();
+
+		// the network subsystem is already shut down at this point, so there
+		// is no one left to send pending callbacks to
+		if (_coalesced_callback_count > 0) {
+			log_debug("Dropping %d pending coalesced callback(s)", _coalesced_callback_count);
+		}
+
+		timer_destroy(&_coalescing_timer);
+
+		_coalesced_callback_count = 0;
+		_coalescing_window = 0;
+	}
+
+	array_destroy(&_deferred_callbacks, NULL);
+}
+
+void api_log_statistics(void) {
+	if (_coalescing_window > 0) {
+		log_info("Callback coalescing: %u callback(s) sent, %u callback(s) merged into them, %u callback(s) of destroyed objects dropped",
+		         _coalesced_callbacks_sent, _coalesced_callbacks_merged,
+		         _coalesced_callbacks_dropped);
+	}
+}
+
+// pending callbacks of a destroyed object are not sent anymore, its ID might
+// be reused by a new object and its subscribers are gone
+void api_drop_pending_callbacks(ObjectID object_id) {
+	int i;
+
+	api_remove_coalesced_callbacks(object_id, false);
+
+	// iterate backwards for simpler index handling
+	for (i = _deferred_callbacks.count - 1; i >= 0; --i) {
+		if (((DeferredCallback *)array_get(&_deferred_callbacks, i))->object_id == object_id) {
+			array_remove(&_deferred_callbacks, i, NULL);
+		}
+	}
 }
 
 uint32_t api_get_uid(void) {
 	return _uid;
 }
 
-void api_handle_request(Packet *request) {
+static void api_begin_request(void) {
+	_handling_request = true;
+}
+
+static void api_end_request(void) {
+	int i;
+	DeferredCallback *deferred_callback;
+
+	_handling_request = false;
+
+	for (i = 0; i < _deferred_callbacks.count; ++i) {
+		deferred_callback = array_get(&_deferred_callbacks, i);
+
+		api_send_callback(deferred_callback->object, deferred_callback->requester,
+		                  &deferred_callback->callback);
+	}
+
+	array_resize(&_deferred_callbacks, 0, NULL);
+}
+
+static void api_dispatch_request(Packet *request) {
 	#define DISPATCH_FUNCTION(function_id_suffix, packet_prefix, function_suffix) \
 		case FUNCTION_##function_id_suffix: \
 			if (request->header.length != sizeof(packet_prefix##Request)) { \
@@ -881,10 +1915,14 @@ void api_handle_request(Packet *request) {
 	DISPATCH_FUNCTION(EXPIRE_SESSION,                   ExpireSession,                expire_session)
 	DISPATCH_FUNCTION(EXPIRE_SESSION_UNCHECKED,         ExpireSessionUnchecked,       expire_session_unchecked)
 	DISPATCH_FUNCTION(KEEP_SESSION_ALIVE,               KeepSessionAlive,             keep_session_alive)
+	DISPATCH_FUNCTION(RELEASE_SESSION_OBJECTS,          ReleaseSessionObjects,        release_session_objects)
 
 	// object
 	DISPATCH_FUNCTION(RELEASE_OBJECT,                   ReleaseObject,                release_object)
 	DISPATCH_FUNCTION(RELEASE_OBJECT_UNCHECKED,         ReleaseObjectUnchecked,       release_object_unchecked)
+	DISPATCH_FUNCTION(RELEASE_OBJECTS,                  ReleaseObjects,               release_objects)
+	DISPATCH_FUNCTION(SUBSCRIBE_OBJECT_CALLBACKS,       SubscribeObjectCallbacks,     subscribe_object_callbacks)
+	DISPATCH_FUNCTION(UNSUBSCRIBE_OBJECT_CALLBACKS,     UnsubscribeObjectCallbacks,   unsubscribe_object_callbacks)
 
 	// string
 	DISPATCH_FUNCTION(ALLOCATE_STRING,                  AllocateString,               allocate_string)
@@ -907,6 +1945,8 @@ void api_handle_request(Packet *request) {
 	DISPATCH_FUNCTION(READ_FILE,                        ReadFile,                     read_file)
 	DISPATCH_FUNCTION(READ_FILE_ASYNC,                  ReadFileAsync,                read_file_async)
 	DISPATCH_FUNCTION(ABORT_ASYNC_FILE_READ,            AbortAsyncFileRead,           abort_async_file_read)
+	DISPATCH_FUNCTION(READ_FILE_ASYNC_WINDOWED,         ReadFileAsyncWindowed,        read_file_async_windowed)
+	DISPATCH_FUNCTION(GRANT_ASYNC_FILE_READ_CREDITS,    GrantAsyncFileReadCredits,    grant_async_file_read_credits)
 	DISPATCH_FUNCTION(WRITE_FILE,                       WriteFile,                    write_file)
 	DISPATCH_FUNCTION(WRITE_FILE_UNCHECKED,             WriteFileUnchecked,           write_file_unchecked)
 	DISPATCH_FUNCTION(WRITE_FILE_ASYNC,                 WriteFileAsync,               write_file_async)
@@ -966,6 +2006,75 @@ void api_handle_request(Packet *request) {
 	#undef DISPATCH_FUNCTION
 }
 
+void api_handle_request(Packet *request) {
+	api_begin_request();
+	api_dispatch_request(request);
+	api_end_request();
+}
+
+// local clients can call all functions, plus the large functions whose
+// packets don't fit into a TFP packet. the length of a local request is
+// given by its frame, the length field of a large request is ignored
+void api_handle_local_request(Packet *request, int length) {
+	api_begin_request();
+
+	switch (request->header.function_id) {
+	case FUNCTION_READ_FILE_LARGE:
+		if (length != sizeof(ReadFileLargeRequest)) {
+			log_warn("Received %s request with length mismatch (actual: %d != expected: %d)",
+			         api_get_function_name(request->header.function_id),
+			         length, (int)sizeof(ReadFileLargeRequest));
+
+			api_send_response_if_expected(request, PACKET_E_INVALID_PARAMETER);
+		} else {
+			api_read_file_large((ReadFileLargeRequest *)request);
+		}
+
+		break;
+
+	case FUNCTION_WRITE_FILE_LARGE:
+		if (length < (int)offsetof(WriteFileLargeRequest, buffer) ||
+		    length != (int)offsetof(WriteFileLargeRequest, buffer) +
+		              (int)((WriteFileLargeRequest *)request)->length_to_write) {
+			log_warn("Received %s request with length mismatch (actual: %d)",
+			         api_get_function_name(request->header.function_id), length);
+
+			api_send_response_if_expected(request, PACKET_E_INVALID_PARAMETER);
+		} else {
+			api_write_file_large((WriteFileLargeRequest *)request);
+		}
+
+		break;
+
+	case FUNCTION_EXECUTE_COMPOUND:
+		if (length < (int)offsetof(ExecuteCompoundRequest, steps)) {
+			log_warn("Received %s request with length mismatch (actual: %d)",
+			         api_get_function_name(request->header.function_id), length);
+
+			api_send_response_if_expected(request, PACKET_E_INVALID_PARAMETER);
+		} else {
+			api_execute_compound((ExecuteCompoundRequest *)request, length);
+		}
+
+		break;
+
+	default:
+		if (length != request->header.length) {
+			log_warn("Received %s request with length mismatch (frame: %d != packet: %u)",
+			         api_get_function_name(request->header.function_id),
+			         length, request->header.length);
+
+			api_send_response_if_expected(request, PACKET_E_INVALID_PARAMETER);
+		} else {
+			api_dispatch_request(request);
+		}
+
+		break;
+	}
+
+	api_end_request();
+}
+
 const char *api_get_function_name(int function_id) {
 	switch (function_id) {
 	// string
@@ -973,10 +2082,14 @@ const char *api_get_function_name(int function_id) {
 	case FUNCTION_EXPIRE_SESSION:                   return "expire-session";
 	case FUNCTION_EXPIRE_SESSION_UNCHECKED:         return "expire-session-unchecked";
 	case FUNCTION_KEEP_SESSION_ALIVE:               return "keep-session-alive";
+	case FUNCTION_RELEASE_SESSION_OBJECTS:          return "release-session-objects";
 
 	// object
 	case FUNCTION_RELEASE_OBJECT:                   return "release-object";
 	case FUNCTION_RELEASE_OBJECT_UNCHECKED:         return "release-object-unchecked";
+	case FUNCTION_RELEASE_OBJECTS:                  return "release-objects";
+	case FUNCTION_SUBSCRIBE_OBJECT_CALLBACKS:       return "subscribe-object-callbacks";
+	case FUNCTION_UNSUBSCRIBE_OBJECT_CALLBACKS:     return "unsubscribe-object-callbacks";
 
 	// string
 	case FUNCTION_ALLOCATE_STRING:                  return "allocate-string";
@@ -999,6 +2112,10 @@ const char *api_get_function_name(int function_id) {
 	case FUNCTION_READ_FILE:                        return "read-file";
 	case FUNCTION_READ_FILE_ASYNC:                  return "read-file-async";
 	case FUNCTION_ABORT_ASYNC_FILE_READ:            return "abort-async-file-read";
+	case FUNCTION_READ_FILE_ASYNC_WINDOWED:         return "read-file-async-windowed";
+	case FUNCTION_GRANT_ASYNC_FILE_READ_CREDITS:    return "grant-async-file-read-credits";
+	case FUNCTION_READ_FILE_LARGE:                  return "read-file-large";
+	case FUNCTION_WRITE_FILE_LARGE:                 return "write-file-large";
 	case FUNCTION_WRITE_FILE:                       return "write-file";
 	case FUNCTION_WRITE_FILE_UNCHECKED:             return "write-file-unchecked";
 	case FUNCTION_WRITE_FILE_ASYNC:                 return "write-file-async";
@@ -1050,6 +2167,9 @@ const char *api_get_function_name(int function_id) {
 	case CALLBACK_PROGRAM_PROCESS_SPAWNED:          return "program-process-spawned";
 	case CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED:  return "program-scheduler-state-changed";
 
+	// compound
+	case FUNCTION_EXECUTE_COMPOUND:                 return "execute-compound";
+
 	// misc
 	case FUNCTION_GET_IDENTITY:                     return "get-identity";
 
@@ -1057,59 +2177,56 @@ const char *api_get_function_name(int function_id) {
 	}
 }
 
-void api_send_async_file_read_callback(ObjectID file_id, APIE error_code,
+void api_send_async_file_read_callback(Object *file, APIE error_code,
                                        uint8_t *buffer, uint8_t length_read) {
-	_async_file_read_callback.file_id = file_id;
-	_async_file_read_callback.error_code = error_code;
-	_async_file_read_callback.length_read = length_read;
-
-	// buffer can be NULL if length_read is zero
-	if (length_read > 0) {
-		memcpy(_async_file_read_callback.buffer, buffer, length_read);
-	}
+	api_prepare_async_file_read_callback(file->id, error_code, buffer, length_read);
 
-	// memset'ing the rest of the buffer to zero ensures that no random
-	// heap/stack data can leak to the client
-	memset(_async_file_read_callback.buffer + length_read, 0,
-	       sizeof(_async_file_read_callback.buffer) - length_read);
+	// a pending state callback of the file has to be sent first
+	api_remove_coalesced_callbacks(file->id, true);
 
-	network_dispatch_response((Packet *)&_async_file_read_callback);
+	api_dispatch_callback(file, (Packet *)&_async_file_read_callback);
 }
 
-void api_send_async_file_write_callback(ObjectID file_id, APIE error_code,
+void api_send_async_file_write_callback(Object *file, APIE error_code,
                                         uint8_t length_written) {
-	_async_file_write_callback.file_id = file_id;
+	_async_file_write_callback.file_id = file->id;
 	_async_file_write_callback.error_code = error_code;
 	_async_file_write_callback.length_written = length_written;
 
-	network_dispatch_response((Packet *)&_async_file_write_callback);
+	// a pending state callback of the file has to be sent first
+	api_remove_coalesced_callbacks(file->id, true);
+
+	api_dispatch_callback(file, (Packet *)&_async_file_write_callback);
 }
 
-void api_send_file_events_occurred_callback(ObjectID file_id, uint16_t events) {
-	_file_events_occurred_callback.file_id = file_id;
+void api_send_file_events_occurred_callback(Object *file, uint16_t events) {
+	_file_events_occurred_callback.file_id = file->id;
 	_file_events_occurred_callback.events = events;
 
-	network_dispatch_response((Packet *)&_file_events_occurred_callback);
+	api_dispatch_state_callback(file, (Packet *)&_file_events_occurred_callback);
 }
 
-void api_send_process_state_changed_callback(ObjectID process_id, uint8_t state,
+void api_send_process_state_changed_callback(Object *process, uint8_t state,
                                              uint64_t timestamp, uint8_t exit_code) {
-	_process_state_changed_callback.process_id = process_id;
+	_process_state_changed_callback.process_id = process->id;
 	_process_state_changed_callback.state = state;
 	_process_state_changed_callback.timestamp = timestamp;
 	_process_state_changed_callback.exit_code = exit_code;
 
-	network_dispatch_response((Packet *)&_process_state_changed_callback);
+	api_dispatch_state_callback(process, (Packet *)&_process_state_changed_callback);
 }
 
-void api_send_program_scheduler_state_changed_callback(ObjectID program_id) {
-	_program_scheduler_state_changed_callback.program_id = program_id;
+void api_send_program_scheduler_state_changed_callback(Object *program) {
+	_program_scheduler_state_changed_callback.program_id = program->id;
 
-	network_dispatch_response((Packet *)&_program_scheduler_state_changed_callback);
+	api_dispatch_state_callback(program, (Packet *)&_program_scheduler_state_changed_callback);
 }
 
-void api_send_program_process_spawned_callback(ObjectID program_id) {
-	_program_process_spawned_callback.program_id = program_id;
+void api_send_program_process_spawned_callback(Object *program) {
+	_program_process_spawned_callback.program_id = program->id;
+
+	// a pending state callback of the program has to be sent first
+	api_remove_coalesced_callbacks(program->id, true);
 
-	network_dispatch_response((Packet *)&_program_process_spawned_callback);
+	api_dispatch_callback(program, (Packet *)&_program_process_spawned_callback);
 }
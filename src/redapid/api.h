@@ -31,25 +31,34 @@
 // of a bool (1 byte) and don't rely on stdbool.h to fulfill this
 typedef uint8_t tfpbool;
 
+// the steps of a compound request and the responses of a compound response
+// fill a maximum size local client packet
+#define API_MAX_COMPOUND_BUFFER_LENGTH (65536 - (int)sizeof(PacketHeader) - 2)
+
 int api_init(void);
 void api_exit(void);
 
+void api_log_statistics(void);
+
+void api_drop_pending_callbacks(ObjectID object_id);
+
 uint32_t api_get_uid(void);
 
 void api_handle_request(Packet *request);
+void api_handle_local_request(Packet *request, int length);
 
 const char *api_get_function_name(int function_id);
 
-void api_send_async_file_read_callback(ObjectID file_id, APIE error_code,
+void api_send_async_file_read_callback(Object *file, APIE error_code,
                                        uint8_t *buffer, uint8_t length_read);
-void api_send_async_file_write_callback(ObjectID file_id, APIE error_code,
+void api_send_async_file_write_callback(Object *file, APIE error_code,
                                         uint8_t length_written);
-void api_send_file_events_occurred_callback(ObjectID file_id, uint16_t events);
+void api_send_file_events_occurred_callback(Object *file, uint16_t events);
 
-void api_send_process_state_changed_callback(ObjectID process_id, uint8_t state,
+void api_send_process_state_changed_callback(Object *process, uint8_t state,
                                              uint64_t timestamp, uint8_t exit_code);
 
-void api_send_program_scheduler_state_changed_callback(ObjectID process_id);
-void api_send_program_process_spawned_callback(ObjectID process_id);
+void api_send_program_scheduler_state_changed_callback(Object *program);
+void api_send_program_process_spawned_callback(Object *program);
 
 #endif // REDAPID_API_H
@@ -86,12 +86,59 @@ typedef struct {
 	uint8_t error_code;
 } ATTRIBUTE_PACKED ReleaseObjectResponse;
 
+typedef struct {
+	PacketHeader header;
+	uint16_t object_id;
+	uint16_t callbacks;
+	uint16_t session_id;
+} ATTRIBUTE_PACKED SubscribeObjectCallbacksRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+} ATTRIBUTE_PACKED SubscribeObjectCallbacksResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t object_id;
+	uint16_t callbacks;
+	uint16_t session_id;
+} ATTRIBUTE_PACKED UnsubscribeObjectCallbacksRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+} ATTRIBUTE_PACKED UnsubscribeObjectCallbacksResponse;
+
 typedef struct {
 	PacketHeader header;
 	uint16_t object_id;
 	uint16_t session_id;
 } ATTRIBUTE_PACKED ReleaseObjectUncheckedRequest;
 
+typedef struct {
+	PacketHeader header;
+	uint16_t object_ids[OBJECT_MAX_RELEASE_OBJECTS_LENGTH];
+	uint8_t object_id_count;
+	uint16_t session_id;
+} ATTRIBUTE_PACKED ReleaseObjectsRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+	uint8_t objects_released;
+} ATTRIBUTE_PACKED ReleaseObjectsResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t session_id;
+} ATTRIBUTE_PACKED ReleaseSessionObjectsRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+} ATTRIBUTE_PACKED ReleaseSessionObjectsResponse;
+
 //
 // string
 //
@@ -301,6 +348,74 @@ typedef struct {
 	uint8_t error_code;
 } ATTRIBUTE_PACKED AbortAsyncFileReadResponse;
 
+typedef struct {
+	PacketHeader header;
+	uint16_t file_id;
+	uint64_t length_to_read;
+	uint16_t window;
+} ATTRIBUTE_PACKED ReadFileAsyncWindowedRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t file_id;
+	uint16_t credits;
+} ATTRIBUTE_PACKED GrantAsyncFileReadCreditsRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+} ATTRIBUTE_PACKED GrantAsyncFileReadCreditsResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t file_id;
+	uint32_t length_to_read;
+} ATTRIBUTE_PACKED ReadFileLargeRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+	uint32_t length_read;
+	uint8_t buffer[FILE_MAX_LARGE_BUFFER_LENGTH]; // only length_read bytes are sent
+} ATTRIBUTE_PACKED ReadFileLargeResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t file_id;
+	uint32_t length_to_write;
+	uint8_t buffer[FILE_MAX_LARGE_BUFFER_LENGTH]; // only length_to_write bytes are received
+} ATTRIBUTE_PACKED WriteFileLargeRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+	uint32_t length_written;
+} ATTRIBUTE_PACKED WriteFileLargeResponse;
+
+// each step in the steps buffer of an execute-compound request consists of a
+// uint8_t reference count, followed by that many references, followed by a
+// complete request packet. before a step is executed its references are
+// resolved by copying the object ID at the given offset in the response of
+// an earlier step to the given offset in the request packet of this step
+typedef struct {
+	uint8_t step; // index of an earlier step
+	uint8_t response_offset; // of the object ID in the response of that step
+	uint8_t request_offset; // of the object ID in the request of this step
+} ATTRIBUTE_PACKED CompoundReference;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t step_count;
+	uint8_t steps[API_MAX_COMPOUND_BUFFER_LENGTH]; // only the used part is received
+} ATTRIBUTE_PACKED ExecuteCompoundRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t error_code;
+	uint8_t steps_executed;
+	uint8_t responses[API_MAX_COMPOUND_BUFFER_LENGTH]; // only the used part is sent
+} ATTRIBUTE_PACKED ExecuteCompoundResponse;
+
 typedef struct {
 	PacketHeader header;
 	uint16_t file_id;
@@ -31,122 +31,285 @@
 #include "brickd.h"
 
 #include "api.h"
+#include "network.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-static void brickd_handle_read(void *opaque) {
-	BrickDaemon *brickd = opaque;
+// limit the number of receive calls per wakeup, so a Brick Daemon that sends
+// requests faster than they can be handled cannot starve other event sources
+#define BRICKD_MAX_RECEIVES_PER_WAKEUP 16
+
+// dispatches all complete requests in the receive buffer in place and returns
+// the number of bytes they occupied. returns -1 on an invalid request
+static int brickd_dispatch_requests(BrickDaemon *brickd, int *request_count) {
+	int offset = 0;
+	Packet *request;
 	int length;
 	const char *message = NULL;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	length = socket_receive(brickd->socket, (uint8_t *)&brickd->request + brickd->request_used,
-	                        sizeof(Packet) - brickd->request_used);
+	while (!brickd->disconnected &&
+	       brickd->receive_buffer_used - offset >= (int)sizeof(PacketHeader)) {
+		request = (Packet *)(brickd->receive_buffer + offset);
+
+		if (!brickd->request_header_checked) {
+			if (!packet_header_is_valid_request(&request->header, &message)) {
+				// FIXME: include packet_get_content_dump output in the error message
+				log_error("Received invalid request (%s) from Brick Daemon, disconnecting brickd: %s",
+				          packet_get_request_signature(packet_signature, request),
+				          message);
+
+				brickd->disconnected = true;
 
-	if (length == 0) {
-		log_info("Brick Daemon disconnected by peer");
+				return -1;
+			}
 
-		brickd->disconnected = true;
+			brickd->request_header_checked = true;
+		}
 
-		return;
-	}
+		length = request->header.length;
 
-	if (length < 0) {
-		if (length == IO_CONTINUE) {
-			// no actual data received
-		} else if (errno_interrupted()) {
-			log_debug("Receiving from Brick Daemon was interrupted, retrying");
-		} else if (errno_would_block()) {
-			log_debug("Receiving from Brick Daemon would block, retrying");
+		if (brickd->receive_buffer_used - offset < length) {
+			// wait for complete packet
+			break;
+		}
+
+		if (request->header.uid != api_get_uid()) {
+			log_debug("Received unknown request (%s) from Brick Daemon with mismatching UID, dropping request",
+			          packet_get_request_signature(packet_signature, request));
 		} else {
-			log_error("Could not receive from Brick Daemon, disconnecting brickd: %s (%d)",
-			          get_errno_name(errno), errno);
+			log_packet_debug("Received %s request (%s) from Brick Daemon",
+			                 api_get_function_name(request->header.function_id),
+			                 packet_get_request_signature(packet_signature, request));
 
-			brickd->disconnected = true;
+			network_handle_brickd_request(brickd, request);
 		}
 
-		return;
+		offset += length;
+		brickd->request_header_checked = false;
+
+		++*request_count;
 	}
 
-	brickd->request_used += length;
+	return offset;
+}
+
+// receives as much as fits into the receive buffer, instead of one request at
+// a time. all complete requests are dispatched directly from the receive
+// buffer and the remaining partial request is moved to the front once. if the
+// receive call filled the buffer then there might be more data available, so
+// receive again
+static void brickd_handle_read(void *opaque) {
+	BrickDaemon *brickd = opaque;
+	int available;
+	int length;
+	int receives;
+	int request_count = 0;
+	int consumed;
+
+	++brickd->receive_wakeups;
+
+	for (receives = 0; receives < BRICKD_MAX_RECEIVES_PER_WAKEUP; ++receives) {
+		available = BRICKD_RECEIVE_BUFFER_LENGTH - brickd->receive_buffer_used;
+		length = socket_receive(brickd->socket, brickd->receive_buffer + brickd->receive_buffer_used,
+		                        available);
+
+		if (length == 0) {
+			log_info("Brick Daemon disconnected by peer");
+
+			brickd->disconnected = true;
 
-	while (!brickd->disconnected && brickd->request_used > 0) {
-		if (brickd->request_used < (int)sizeof(PacketHeader)) {
-			// wait for complete header
 			break;
 		}
 
-		if (!brickd->request_header_checked) {
-			if (!packet_header_is_valid_request(&brickd->request.header, &message)) {
-				// FIXME: include packet_get_content_dump output in the error message
-				log_error("Received invalid request (%s) from Brick Daemon, disconnecting brickd: %s",
-				          packet_get_request_signature(packet_signature, &brickd->request),
-				          message);
+		if (length < 0) {
+			if (length == IO_CONTINUE) {
+				// no actual data received
+			} else if (errno_interrupted()) {
+				log_debug("Receiving from Brick Daemon was interrupted, retrying");
+			} else if (errno_would_block()) {
+				log_debug("Receiving from Brick Daemon would block, retrying");
+			} else {
+				log_error("Could not receive from Brick Daemon, disconnecting brickd: %s (%d)",
+				          get_errno_name(errno), errno);
 
 				brickd->disconnected = true;
-
-				return;
 			}
 
-			brickd->request_header_checked = true;
+			break;
 		}
 
-		length = brickd->request.header.length;
+		brickd->receive_buffer_used += length;
 
-		if (brickd->request_used < length) {
-			// wait for complete packet
+		consumed = brickd_dispatch_requests(brickd, &request_count);
+
+		if (consumed < 0) {
 			break;
 		}
 
-		if (brickd->request.header.uid != api_get_uid()) {
-			log_debug("Received unknown request (%s) from Brick Daemon with mismatching UID, dropping request",
-			          packet_get_request_signature(packet_signature, &brickd->request));
+		if (consumed > 0) {
+			memmove(brickd->receive_buffer, brickd->receive_buffer + consumed,
+			        brickd->receive_buffer_used - consumed);
+
+			brickd->receive_buffer_used -= consumed;
+		}
+
+		if (length < available || brickd->disconnected) {
+			break;
+		}
+	}
+
+	brickd->received_requests += request_count;
+
+	if (request_count > brickd->max_requests_per_wakeup) {
+		brickd->max_requests_per_wakeup = request_count;
+	}
+}
+
+static void brickd_handle_write(void *opaque);
+
+static void brickd_set_write_pending(BrickDaemon *brickd, bool pending) {
+	if (brickd->write_pending == pending) {
+		return;
+	}
+
+	if (pending) {
+		if (event_modify_source(brickd->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                        0, EVENT_WRITE, brickd_handle_write, brickd) < 0) {
+			log_error("Could not wait for Brick Daemon to become writable, disconnecting brickd");
+
+			brickd->disconnected = true;
+
+			return;
+		}
+	} else {
+		event_modify_source(brickd->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                    EVENT_WRITE, 0, NULL, NULL);
+	}
+
+	brickd->write_pending = pending;
+}
+
+// number of bytes in the send buffer that are not sent yet
+static int brickd_get_send_buffer_pending(BrickDaemon *brickd) {
+	return brickd->send_buffer_used - brickd->send_buffer_offset;
+}
+
+// sends the whole send buffer with a single send call. if the socket cannot
+// take all of it then the offset is advanced past the sent part and the rest
+// is sent as soon as the socket becomes writable again
+static void brickd_flush(BrickDaemon *brickd) {
+	int length;
+
+	if (brickd->disconnected || brickd_get_send_buffer_pending(brickd) == 0) {
+		return;
+	}
+
+	length = socket_send(brickd->socket, brickd->send_buffer + brickd->send_buffer_offset,
+	                     brickd_get_send_buffer_pending(brickd));
+
+	if (length < 0) {
+		if (length == IO_CONTINUE || errno_interrupted() || errno_would_block()) {
+			brickd_set_write_pending(brickd, true);
 		} else {
-			log_packet_debug("Received %s request (%s) from Brick Daemon",
-			                 api_get_function_name(brickd->request.header.function_id),
-			                 packet_get_request_signature(packet_signature, &brickd->request));
+			log_error("Could not send to Brick Daemon, disconnecting brickd: %s (%d)",
+			          get_errno_name(errno), errno);
 
-			api_handle_request(&brickd->request);
+			brickd->disconnected = true;
 		}
 
-		memmove(&brickd->request, (uint8_t *)&brickd->request + length,
-		        brickd->request_used - length);
+		return;
+	}
 
-		brickd->request_used -= length;
-		brickd->request_header_checked = false;
+	brickd->send_buffer_offset += length;
+
+	// a batch is flushed once all of it is sent, a partial send only continues
+	// it. responses queued in the meantime become part of the same batch
+	if (brickd->send_buffer_offset == brickd->send_buffer_used) {
+		brickd->send_buffer_offset = 0;
+		brickd->send_buffer_used = 0;
+
+		++brickd->flushes;
+		brickd->flushed_responses += brickd->batch_depth;
+
+		if (brickd->batch_depth > brickd->max_batch_depth) {
+			brickd->max_batch_depth = brickd->batch_depth;
+		}
+
+		brickd->batch_depth = 0;
+	}
+
+	if (brickd->congested && brickd_get_send_buffer_pending(brickd) <= BRICKD_SEND_LOW_WATER_MARK) {
+		log_debug("Send buffer for Brick Daemon drained to %d byte(s), no longer congested",
+		          brickd_get_send_buffer_pending(brickd));
+
+		brickd->congested = false;
 	}
+
+	brickd_set_write_pending(brickd, brickd_get_send_buffer_pending(brickd) > 0);
 }
 
-static char *brickd_get_recipient_signature(char *signature, bool upper, void *opaque) {
-	(void)upper;
-	(void)opaque;
+// moves the part not sent yet to the front of the send buffer. this is only
+// done if a response would not fit otherwise, instead of after every partial
+// send
+static void brickd_compact_send_buffer(BrickDaemon *brickd) {
+	int pending = brickd_get_send_buffer_pending(brickd);
+
+	if (brickd->send_buffer_offset == 0) {
+		return;
+	}
 
-	snprintf(signature, WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH, "Brick Daemon");
+	memmove(brickd->send_buffer, brickd->send_buffer + brickd->send_buffer_offset, pending);
 
-	return signature;
+	brickd->send_buffer_offset = 0;
+	brickd->send_buffer_used = pending;
 }
 
-static void brickd_recipient_disconnect(void *opaque) {
+static void brickd_handle_write(void *opaque) {
 	BrickDaemon *brickd = opaque;
 
-	brickd->disconnected = true;
+	brickd_flush(brickd);
 }
 
 int brickd_create(BrickDaemon *brickd, Socket *socket) {
 	log_debug("Creating Brick Daemon from UNIX domain socket (handle: %d)", socket->base.handle);
 
 	brickd->socket = socket;
+	brickd->connection_id = 0;
 	brickd->disconnected = false;
-	brickd->request_used = 0;
+	brickd->receive_buffer_used = 0;
 	brickd->request_header_checked = false;
+	brickd->send_buffer_offset = 0;
+	brickd->send_buffer_used = 0;
+	brickd->write_pending = false;
+	brickd->congested = false;
+	brickd->receive_wakeups = 0;
+	brickd->received_requests = 0;
+	brickd->max_requests_per_wakeup = 0;
+	brickd->batch_depth = 0;
+	brickd->flushes = 0;
+	brickd->flushed_responses = 0;
+	brickd->max_batch_depth = 0;
+	brickd->dropped_responses = 0;
+	brickd->congestions = 0;
+
+	// allocate receive and send buffer
+	brickd->receive_buffer = malloc(BRICKD_RECEIVE_BUFFER_LENGTH);
+
+	if (brickd->receive_buffer == NULL) {
+		log_error("Could not allocate receive buffer: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+
+	brickd->send_buffer = malloc(BRICKD_SEND_BUFFER_LENGTH);
 
-	// create response writer
-	if (writer_create(&brickd->response_writer, &brickd->socket->base,
-	                  "response", packet_get_response_signature,
-	                  "brickd", brickd_get_recipient_signature,
-	                  brickd_recipient_disconnect, brickd) < 0) {
-		log_error("Could not create response writer: %s (%d)",
-		          get_errno_name(errno), errno);
+	if (brickd->send_buffer == NULL) {
+		log_error("Could not allocate send buffer: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		free(brickd->receive_buffer);
 
 		return -1;
 	}
@@ -154,7 +317,8 @@ int brickd_create(BrickDaemon *brickd, Socket *socket) {
 	// add I/O object as event source
 	if (event_add_source(brickd->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
 	                     EVENT_READ, brickd_handle_read, brickd) < 0) {
-		writer_destroy(&brickd->response_writer);
+		free(brickd->send_buffer);
+		free(brickd->receive_buffer);
 
 		return -1;
 	}
@@ -163,15 +327,29 @@ int brickd_create(BrickDaemon *brickd, Socket *socket) {
 }
 
 void brickd_destroy(BrickDaemon *brickd) {
-	writer_destroy(&brickd->response_writer);
+	// try to send out the last responses
+	brickd_flush(brickd);
+
+	if (brickd_get_send_buffer_pending(brickd) > 0) {
+		log_warn("Dropping %d byte(s) of responses not yet sent to Brick Daemon",
+		         brickd_get_send_buffer_pending(brickd));
+	}
+
+	brickd_log_statistics(brickd);
+
+	free(brickd->send_buffer);
+	free(brickd->receive_buffer);
 
 	event_remove_source(brickd->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC);
 	socket_destroy(brickd->socket);
 	free(brickd->socket);
 }
 
+// responses are collected in the send buffer and sent out in one go at the
+// end of the current event loop iteration, see brickd_flush_responses. if the
+// send buffer already holds a full batch then it is sent out right away
 void brickd_dispatch_response(BrickDaemon *brickd, Packet *response) {
-	int enqueued = 0;
+	int length = response->header.length;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
 	if (brickd->disconnected) {
@@ -180,15 +358,61 @@ void brickd_dispatch_response(BrickDaemon *brickd, Packet *response) {
 		return;
 	}
 
-	enqueued = writer_write(&brickd->response_writer, response);
+	if (brickd->send_buffer_used + length > BRICKD_SEND_BUFFER_LENGTH) {
+		brickd_flush(brickd);
 
-	if (enqueued < 0) {
-		return;
+		if (brickd->send_buffer_used + length > BRICKD_SEND_BUFFER_LENGTH) {
+			brickd_compact_send_buffer(brickd);
+		}
+
+		if (brickd->send_buffer_used + length > BRICKD_SEND_BUFFER_LENGTH) {
+			++brickd->dropped_responses;
+
+			log_warn("Send buffer for Brick Daemon is full, dropping %s (%s), %u response(s) dropped so far",
+			         packet_get_response_type(response),
+			         packet_get_response_signature(packet_signature, response),
+			         brickd->dropped_responses);
+
+			return;
+		}
+	}
+
+	memcpy(brickd->send_buffer + brickd->send_buffer_used, response, length);
+
+	brickd->send_buffer_used += length;
+	++brickd->batch_depth;
+
+	if (!brickd->congested && brickd_get_send_buffer_pending(brickd) > BRICKD_SEND_HIGH_WATER_MARK) {
+		log_debug("Send buffer for Brick Daemon filled up to %d byte(s), congested",
+		          brickd_get_send_buffer_pending(brickd));
+
+		brickd->congested = true;
+		++brickd->congestions;
 	}
 
-	log_packet_debug("%s %s %s (%s) to Brick Daemon",
-	                 enqueued ? "Enqueued" : "Sent",
+	log_packet_debug("Enqueued %s %s (%s) to Brick Daemon",
 	                 api_get_function_name(response->header.function_id),
 	                 packet_get_response_type(response),
 	                 packet_get_response_signature(packet_signature, response));
+
+	if (brickd_get_send_buffer_pending(brickd) >= BRICKD_SEND_BATCH_LENGTH && !brickd->write_pending) {
+		brickd_flush(brickd);
+	}
+}
+
+void brickd_flush_responses(BrickDaemon *brickd) {
+	// if a write is pending then the socket is not writable at the moment.
+	// the send buffer will be flushed as soon as it becomes writable again
+	if (!brickd->write_pending) {
+		brickd_flush(brickd);
+	}
+}
+
+void brickd_log_statistics(BrickDaemon *brickd) {
+	log_info("Brick Daemon: received %u request(s) in %u wakeup(s), at most %d request(s) per wakeup",
+	         brickd->received_requests, brickd->receive_wakeups,
+	         brickd->max_requests_per_wakeup);
+	log_info("Brick Daemon: sent %u response(s) in %u flush(es), at most %d response(s) per flush, %u response(s) dropped, congested %u time(s)",
+	         brickd->flushed_responses, brickd->flushes, brickd->max_batch_depth,
+	         brickd->dropped_responses, brickd->congestions);
 }
@@ -23,23 +23,46 @@
 #define REDAPID_BRICKD_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <daemonlib/packet.h>
 #include <daemonlib/socket.h>
-#include <daemonlib/writer.h>
+
+#define BRICKD_RECEIVE_BUFFER_LENGTH 65536
+#define BRICKD_SEND_BUFFER_LENGTH 262144
+#define BRICKD_SEND_BATCH_LENGTH 16384 // send right away if this much is buffered
+#define BRICKD_SEND_HIGH_WATER_MARK (BRICKD_SEND_BUFFER_LENGTH / 2) // becomes congested above this
+#define BRICKD_SEND_LOW_WATER_MARK (BRICKD_SEND_BUFFER_LENGTH / 8) // stops being congested below this
 
 typedef struct {
 	Socket *socket;
+	uint32_t connection_id; // assigned by the network subsystem, never 0
 	bool disconnected;
-	Packet request;
-	int request_used;
+	uint8_t *receive_buffer; // BRICKD_RECEIVE_BUFFER_LENGTH bytes
+	int receive_buffer_used;
 	bool request_header_checked;
-	Writer response_writer;
+	uint8_t *send_buffer; // BRICKD_SEND_BUFFER_LENGTH bytes
+	int send_buffer_offset; // start of the part not sent yet
+	int send_buffer_used;
+	bool write_pending; // waiting for the socket to become writable
+	bool congested; // asynchronous producers should pause
+	uint32_t receive_wakeups;
+	uint32_t received_requests;
+	int max_requests_per_wakeup;
+	int batch_depth; // number of responses added since the send buffer was last drained
+	uint32_t flushes;
+	uint32_t flushed_responses;
+	int max_batch_depth;
+	uint32_t dropped_responses;
+	uint32_t congestions;
 } BrickDaemon;
 
 int brickd_create(BrickDaemon *brickd, Socket *socket);
 void brickd_destroy(BrickDaemon *brickd);
 
 void brickd_dispatch_response(BrickDaemon *brickd, Packet *response);
+void brickd_flush_responses(BrickDaemon *brickd);
+
+void brickd_log_statistics(BrickDaemon *brickd);
 
 #endif // REDAPID_BRICKD_H
@@ -24,5 +24,12 @@
 ConfigOption config_options[] = {
 	CONFIG_OPTION_SYMBOL_INITIALIZER("log.level", config_parse_log_level, config_format_log_level, LOG_LEVEL_INFO),
 	CONFIG_OPTION_STRING_INITIALIZER("log.debug_filter", 0, -1, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("file.async_read_chunks_per_event", 1, 1024, 16),
+	CONFIG_OPTION_INTEGER_INITIALIZER("file.open_helpers", 0, 32, 4),
+	CONFIG_OPTION_INTEGER_INITIALIZER("file.read_ahead_length", 0, 65536, 65536),
+	CONFIG_OPTION_INTEGER_INITIALIZER("file.write_behind_length", 0, 65536, 0),
+	CONFIG_OPTION_INTEGER_INITIALIZER("file.write_behind_delay", 1, 1000, 20),
+	CONFIG_OPTION_INTEGER_INITIALIZER("api.callback_coalescing_window", 0, 1000, 0),
+	CONFIG_OPTION_INTEGER_INITIALIZER("worker.threads", 1, 16, 2),
 	CONFIG_OPTION_NULL_INITIALIZER // end of list
 };
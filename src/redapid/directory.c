@@ -36,9 +36,28 @@
 #include "inventory.h"
 #include "process.h"
 #include "string.h"
+#include "worker.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+typedef struct {
+	String *name;
+	SessionID session_id; // the session is looked up again after the directory was opened
+	DirectoryOpenedFunction opened;
+	void *opaque;
+	APIE error_code;
+	DIR *dp;
+} DirectoryOpenJob;
+
+typedef struct {
+	Directory *directory; // pinned by an internal reference
+	SessionID session_id; // the session is looked up again after the entry was read
+	DirectoryEntryFunction done;
+	void *opaque;
+	APIE error_code;
+	uint8_t type;
+} DirectoryEntryJob;
+
 static void directory_destroy(Object *object) {
 	Directory *directory = (Directory *)object;
 
@@ -125,61 +144,75 @@ static APIE directory_create_helper(char *name, uint32_t flags, mode_t mode) {
 	return API_E_SUCCESS;
 }
 
-// public API
-APIE directory_open(ObjectID name_id, Session *session, ObjectID *id) {
-	int phase = 0;
+static APIE directory_prepare_open(ObjectID name_id, String **name) {
 	APIE error_code;
-	String *name;
-	DIR *dp;
-	Directory *directory;
 
 	// acquire and lock name string object
-	error_code = string_get_acquired_and_locked(name_id, &name);
+	error_code = string_get_acquired_and_locked(name_id, name);
 
 	if (error_code != API_E_SUCCESS) {
-		goto cleanup;
+		return error_code;
 	}
 
-	phase = 1;
-
-	if (*name->buffer == '\0') {
+	if (*(*name)->buffer == '\0') {
 		error_code = API_E_INVALID_PARAMETER;
 
 		log_warn("Directory name cannot be empty");
 
-		goto cleanup;
+		goto error;
 	}
 
-	if (*name->buffer != '/') {
+	if (*(*name)->buffer != '/') {
 		error_code = API_E_INVALID_PARAMETER;
 
-		log_warn("Cannot open directory with relative name '%s'", name->buffer);
+		log_warn("Cannot open directory with relative name '%s'", (*name)->buffer);
 
-		goto cleanup;
+		goto error;
 	}
 
 	// check name string length
-	if (name->length > DIRECTORY_MAX_NAME_LENGTH) {
+	if ((*name)->length > DIRECTORY_MAX_NAME_LENGTH) {
 		error_code = API_E_OUT_OF_RANGE;
 
 		log_warn("Directory name string object (id: %u) is too long", name_id);
 
-		goto cleanup;
+		goto error;
 	}
 
-	// open directory
-	dp = opendir(name->buffer);
+	return API_E_SUCCESS;
 
-	if (dp == NULL) {
+error:
+	string_unlock_and_release(*name);
+
+	return error_code;
+}
+
+// only uses the locked name string object read-only, it is safe to call this
+// on a worker thread
+static APIE directory_open_handle(String *name, DIR **dp) {
+	APIE error_code;
+
+	*dp = opendir(name->buffer);
+
+	if (*dp == NULL) {
 		error_code = api_get_error_code_from_errno();
 
 		log_error("Could not open directory '%s': %s (%d)",
 		          name->buffer, get_errno_name(errno), errno);
 
-		goto cleanup;
+		return error_code;
 	}
 
-	phase = 2;
+	return API_E_SUCCESS;
+}
+
+// takes ownership of the name string object and the directory handle, also on
+// error
+static APIE directory_create_object(String *name, DIR *dp, Session *session,
+                                    ObjectID *id) {
+	int phase = 0;
+	APIE error_code;
+	Directory *directory;
 
 	// create directory object
 	directory = calloc(1, sizeof(Directory));
@@ -193,7 +226,7 @@ APIE directory_open(ObjectID name_id, Session *session, ObjectID *id) {
 		goto cleanup;
 	}
 
-	phase = 3;
+	phase = 1;
 
 	directory->name = name;
 	directory->name_length = name->length;
@@ -215,7 +248,7 @@ APIE directory_open(ObjectID name_id, Session *session, ObjectID *id) {
 		goto cleanup;
 	}
 
-	phase = 4;
+	phase = 2;
 
 	*id = directory->base.id;
 
@@ -224,20 +257,113 @@ APIE directory_open(ObjectID name_id, Session *session, ObjectID *id) {
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 3:
+	case 1:
 		free(directory);
 
-	case 2:
+	case 0:
 		closedir(dp);
-
-	case 1:
 		string_unlock_and_release(name);
 
 	default:
 		break;
 	}
 
-	return phase == 4 ? API_E_SUCCESS : error_code;
+	return phase == 2 ? API_E_SUCCESS : error_code;
+}
+
+// public API
+APIE directory_open(ObjectID name_id, Session *session, ObjectID *id) {
+	APIE error_code;
+	String *name;
+	DIR *dp;
+
+	error_code = directory_prepare_open(name_id, &name);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	error_code = directory_open_handle(name, &dp);
+
+	if (error_code != API_E_SUCCESS) {
+		string_unlock_and_release(name);
+
+		return error_code;
+	}
+
+	return directory_create_object(name, dp, session, id);
+}
+
+static void directory_work_open_job(void *opaque) {
+	DirectoryOpenJob *job = opaque;
+
+	job->error_code = directory_open_handle(job->name, &job->dp);
+}
+
+static void directory_complete_open_job(void *opaque) {
+	DirectoryOpenJob *job = opaque;
+	Session *session;
+	ObjectID id = OBJECT_ID_ZERO;
+
+	if (job->error_code != API_E_SUCCESS) {
+		string_unlock_and_release(job->name);
+	} else {
+		// the session might have expired while the directory was opened
+		job->error_code = inventory_get_session(job->session_id, &session);
+
+		if (job->error_code != API_E_SUCCESS) {
+			closedir(job->dp);
+			string_unlock_and_release(job->name);
+		} else {
+			job->error_code = directory_create_object(job->name, job->dp,
+			                                          session, &id);
+		}
+	}
+
+	job->opened(job->error_code, id, job->opaque);
+
+	free(job);
+}
+
+// like directory_open, but the directory is opened on a worker thread. if this
+// function returns API_E_SUCCESS then the opened function is called exactly
+// once, after the worker thread is done
+APIE directory_open_deferred(ObjectID name_id, Session *session,
+                             DirectoryOpenedFunction opened, void *opaque) {
+	APIE error_code;
+	DirectoryOpenJob *job;
+
+	job = calloc(1, sizeof(DirectoryOpenJob));
+
+	if (job == NULL) {
+		log_error("Could not allocate directory open job: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return API_E_NO_FREE_MEMORY;
+	}
+
+	error_code = directory_prepare_open(name_id, &job->name);
+
+	if (error_code != API_E_SUCCESS) {
+		free(job);
+
+		return error_code;
+	}
+
+	job->session_id = session->id;
+	job->opened = opened;
+	job->opaque = opaque;
+
+	error_code = worker_submit(directory_work_open_job, directory_complete_open_job, job);
+
+	if (error_code != API_E_SUCCESS) {
+		string_unlock_and_release(job->name);
+		free(job);
+
+		return error_code;
+	}
+
+	return API_E_SUCCESS;
 }
 
 // public API
@@ -253,9 +379,11 @@ APIE directory_get_name(Directory *directory, Session *session, ObjectID *name_i
 	return API_E_SUCCESS;
 }
 
-// public API
-APIE directory_get_next_entry(Directory *directory, Session *session,
-                              ObjectID *name_id, uint8_t *type) {
+// reads the next entry into the buffer of the directory object. this blocks on
+// the SD card, but doesn't use any state of the event loop thread. it is safe
+// to call it on a worker thread while the directory object is pinned and
+// marked as reading
+static APIE directory_read_next_entry(Directory *directory, uint8_t *type) {
 	struct dirent *dirent;
 	APIE error_code;
 	struct stat st;
@@ -336,14 +464,125 @@ APIE directory_get_next_entry(Directory *directory, Session *session,
 			}
 		}
 
-		return string_wrap(directory->buffer,
-		                   session, OBJECT_CREATE_FLAG_EXTERNAL,
-		                   name_id, NULL);
+		return API_E_SUCCESS;
+	}
+}
+
+static bool directory_is_reading(Directory *directory) {
+	if (directory->reading) {
+		log_warn("Still reading next entry of directory object (id: %u, name: %s)",
+		         directory->base.id, directory->name->buffer);
+
+		return true;
+	}
+
+	return false;
+}
+
+// public API
+APIE directory_get_next_entry(Directory *directory, Session *session,
+                              ObjectID *name_id, uint8_t *type) {
+	APIE error_code;
+
+	if (directory_is_reading(directory)) {
+		return API_E_INVALID_OPERATION;
+	}
+
+	error_code = directory_read_next_entry(directory, type);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	return string_wrap(directory->buffer,
+	                   session, OBJECT_CREATE_FLAG_EXTERNAL,
+	                   name_id, NULL);
+}
+
+static void directory_work_entry_job(void *opaque) {
+	DirectoryEntryJob *job = opaque;
+
+	job->error_code = directory_read_next_entry(job->directory, &job->type);
+}
+
+static void directory_complete_entry_job(void *opaque) {
+	DirectoryEntryJob *job = opaque;
+	Session *session;
+	ObjectID name_id = OBJECT_ID_ZERO;
+
+	job->directory->reading = false;
+
+	if (job->error_code == API_E_SUCCESS) {
+		// the session might have expired while the entry was read
+		job->error_code = inventory_get_session(job->session_id, &session);
+
+		if (job->error_code == API_E_SUCCESS) {
+			job->error_code = string_wrap(job->directory->buffer,
+			                              session, OBJECT_CREATE_FLAG_EXTERNAL,
+			                              &name_id, NULL);
+		}
+	}
+
+	job->done(job->error_code, name_id,
+	          job->error_code == API_E_SUCCESS ? job->type : DIRECTORY_ENTRY_TYPE_UNKNOWN,
+	          job->opaque);
+
+	object_remove_internal_reference(&job->directory->base);
+
+	free(job);
+}
+
+// like directory_get_next_entry, but the entry is read on a worker thread. the
+// directory object is pinned and marked as reading until then. if this function
+// returns API_E_SUCCESS then the done function is called exactly once, after
+// the worker thread is done
+APIE directory_get_next_entry_deferred(Directory *directory, Session *session,
+                                       DirectoryEntryFunction done, void *opaque) {
+	APIE error_code;
+	DirectoryEntryJob *job;
+
+	if (directory_is_reading(directory)) {
+		return API_E_INVALID_OPERATION;
 	}
+
+	job = calloc(1, sizeof(DirectoryEntryJob));
+
+	if (job == NULL) {
+		log_error("Could not allocate directory entry job: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return API_E_NO_FREE_MEMORY;
+	}
+
+	job->directory = directory;
+	job->session_id = session->id;
+	job->done = done;
+	job->opaque = opaque;
+
+	object_add_internal_reference(&directory->base);
+
+	directory->reading = true;
+
+	error_code = worker_submit(directory_work_entry_job, directory_complete_entry_job, job);
+
+	if (error_code != API_E_SUCCESS) {
+		directory->reading = false;
+
+		object_remove_internal_reference(&directory->base);
+		free(job);
+
+		return error_code;
+	}
+
+	return API_E_SUCCESS;
 }
 
 // public API
 APIE directory_rewind(Directory *directory) {
+	if (directory_is_reading(directory)) {
+		return API_E_INVALID_OPERATION;
+	}
+
 	rewinddir(directory->dp);
 
 	return API_E_SUCCESS;
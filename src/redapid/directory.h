@@ -23,6 +23,7 @@
 #define REDAPID_DIRECTORY_H
 
 #include <dirent.h>
+#include <stdbool.h>
 
 #include "object.h"
 #include "string.h"
@@ -55,15 +56,23 @@ typedef struct {
 	String *name;
 	int name_length; // length of name in buffer
 	DIR *dp;
+	bool reading; // a worker thread is reading the next entry into buffer
 	char buffer[DIRECTORY_MAX_NAME_LENGTH + 1 /* for / */ + DIRECTORY_MAX_ENTRY_LENGTH + 1 /* for \0 */];
 } Directory;
 
+typedef void (*DirectoryOpenedFunction)(APIE error_code, ObjectID directory_id, void *opaque);
+typedef void (*DirectoryEntryFunction)(APIE error_code, ObjectID name_id, uint8_t type, void *opaque);
+
 APIE directory_open(ObjectID name_id, Session *session, ObjectID *id);
+APIE directory_open_deferred(ObjectID name_id, Session *session,
+                             DirectoryOpenedFunction opened, void *opaque);
 
 APIE directory_get_name(Directory *directory, Session *session, ObjectID *name_id);
 
 APIE directory_get_next_entry(Directory *directory, Session *session,
                               ObjectID *name_id, uint8_t *type);
+APIE directory_get_next_entry_deferred(Directory *directory, Session *session,
+                                       DirectoryEntryFunction done, void *opaque);
 APIE directory_rewind(Directory *directory);
 
 APIE directory_create(const char *name, uint32_t flags, uint16_t permissions,
@@ -28,98 +28,72 @@
 #include <string.h>
 #include <sys/eventfd.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
 #include "file.h"
 
 #include "api.h"
 #include "inventory.h"
-#include "process.h"
+#include "network.h"
+#include "open_helper.h"
+#include "pool.h"
+#include "uring.h"
+#include "worker.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+static Pool _file_pool = POOL_INITIALIZER("file", File, 16);
+static Node _congested_async_reads = { &_congested_async_reads, &_congested_async_reads };
+static int _async_read_chunks_per_event = 1; // read from config by file_init
+static int _read_ahead_max_length = 0; // read from config by file_init
+static uint32_t _read_ahead_hits = 0;
+static uint32_t _read_ahead_misses = 0;
+static int _write_behind_max_length = 0; // read from config by file_init
+static uint64_t _write_behind_delay = 0; // in microseconds, read from config by file_init
+static uint32_t _write_behind_writes = 0;
+static uint32_t _write_behind_flushes = 0;
+static Timer _write_behind_timer; // only created if _write_behind_max_length > 0
+static Node _dirty_files = { &_dirty_files, &_dirty_files }; // ordered by write-behind deadline
+
+#define FILE_READ_AHEAD_MIN_LENGTH 4096
+
+typedef struct {
+	String *name;
+	uint32_t flags;
+	uint16_t permissions;
+	int oflags;
+	mode_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	SessionID session_id; // the session is looked up again after the file was opened
+	uint16_t object_create_flags;
+	FileOpenedFunction opened;
+	void *opaque;
+	APIE error_code;
+	IOHandle fd;
+} FileOpenJob;
+
+typedef struct {
+	File *file; // pinned by an internal reference, its name is locked anyway
+	SessionID session_id; // the session is looked up again after the information was queried
+	FileInfoFunction done;
+	void *opaque;
+	APIE error_code;
+	struct stat st;
+	int pipe_length;
+} FileInfoJob;
 
 #define FILE_SIGNATURE_FORMAT "id: %u, type: %s, name: %s, flags: 0x%04X"
 
 #define file_expand_signature(file) (file)->base.id, \
 	file_get_type_name((file)->type), (file)->name->buffer, (file)->flags
 
-static int sendfd(int socket_handle, int fd) {
-	uint8_t buffer[1] = { 0 };
-	struct iovec iovec;
-	struct msghdr msghdr;
-	struct cmsghdr *cmsghdr;
-	uint8_t control[CMSG_SPACE(sizeof(int))];
-
-	iovec.iov_base = buffer;
-	iovec.iov_len = sizeof(buffer);
-
-	memset(&msghdr, 0, sizeof(msghdr));
-
-	msghdr.msg_iov = &iovec;
-	msghdr.msg_iovlen = 1;
-
-	if (fd < 0) {
-		msghdr.msg_control = NULL;
-		msghdr.msg_controllen = 0;
-	} else {
-		msghdr.msg_control = (caddr_t)control;
-		msghdr.msg_controllen = CMSG_LEN(sizeof(int));
-
-		cmsghdr = CMSG_FIRSTHDR(&msghdr);
-		cmsghdr->cmsg_len = CMSG_LEN(sizeof(int));
-		cmsghdr->cmsg_level = SOL_SOCKET;
-		cmsghdr->cmsg_type = SCM_RIGHTS;
-
-		memcpy(CMSG_DATA(cmsghdr), &fd, sizeof(int));
-	}
-
-	if (sendmsg(socket_handle, &msghdr, 0) != (int)iovec.iov_len) {
-		return -1;
-	}
-
-	return 0;
-}
-
-static int recvfd(int socket_handle, int *fd) {
-	uint8_t buffer[1] = { 0 };
-	struct iovec iovec;
-	struct msghdr msghdr;
-	struct cmsghdr *cmsghdr;
-	uint8_t control[CMSG_SPACE(sizeof(int))];
-
-	iovec.iov_base = buffer;
-	iovec.iov_len = sizeof(buffer);
-
-	memset(&msghdr, 0, sizeof (msghdr));
-
-	msghdr.msg_name = 0;
-	msghdr.msg_namelen = 0;
-	msghdr.msg_iov = &iovec;
-	msghdr.msg_iovlen = 1;
-	msghdr.msg_control = (caddr_t)control;
-	msghdr.msg_controllen = sizeof(control);
-
-	if (recvmsg(socket_handle, &msghdr, 0) <= 0) {
-		return -1;
-	}
-
-	cmsghdr = CMSG_FIRSTHDR(&msghdr);
-
-	if (cmsghdr != NULL) {
-		memcpy(fd, CMSG_DATA(cmsghdr), sizeof(int));
-	} else {
-		*fd = -1;
-	}
-
-	return 0;
-}
-
 static const char *file_get_type_name(FileType type) {
 	switch (type) {
 	default:
@@ -197,6 +171,379 @@ static uint16_t file_get_permissions_from_stat_mode(mode_t mode) {
 	return permissions;
 }
 
+static int file_get_next_read_ahead_length(File *file) {
+	int length = file->read_ahead_length * 2;
+
+	if (length < FILE_READ_AHEAD_MIN_LENGTH) {
+		length = FILE_READ_AHEAD_MIN_LENGTH;
+	}
+
+	if (length > _read_ahead_max_length) {
+		length = _read_ahead_max_length;
+	}
+
+	return length;
+}
+
+// sets errno on error
+static int file_refill_read_ahead(File *file, int length) {
+	uint8_t *buffer;
+	int rc;
+
+	if (length > file->read_ahead_allocated) {
+		buffer = realloc(file->read_ahead_buffer, length);
+
+		if (buffer == NULL) {
+			errno = ENOMEM;
+
+			return -1;
+		}
+
+		file->read_ahead_buffer = buffer;
+		file->read_ahead_allocated = length;
+	}
+
+	rc = read(file->fd, file->read_ahead_buffer, length);
+
+	if (rc < 0) {
+		return -1;
+	}
+
+	file->read_ahead_length = length;
+	file->read_ahead_used = rc;
+	file->read_ahead_offset = 0;
+
+	return rc;
+}
+
+// serves sequential reads from the read-ahead buffer. the file position is at
+// the end of the buffered data, not at the position of the reader. a read
+// that is at least as long as the next refill bypasses the buffer. sets errno
+// on error
+static int file_read_ahead(File *file, uint8_t *buffer, int length) {
+	int length_read = 0;
+	int available;
+	int next_length;
+	int rc;
+	bool bypass;
+	bool hit = true;
+
+	while (length_read < length) {
+		available = file->read_ahead_used - file->read_ahead_offset;
+
+		if (available == 0) {
+			hit = false;
+			next_length = file_get_next_read_ahead_length(file);
+
+			bypass = length - length_read >= next_length;
+
+			if (bypass) {
+				rc = read(file->fd, buffer + length_read, length - length_read);
+			} else {
+				rc = file_refill_read_ahead(file, next_length);
+			}
+
+			if (rc < 0) {
+				if (length_read > 0) {
+					break; // the error is reported by the next read
+				}
+
+				length_read = -1;
+
+				break;
+			}
+
+			if (rc == 0) {
+				break; // end-of-file
+			}
+
+			if (bypass) {
+				length_read += rc;
+
+				break;
+			}
+
+			available = rc;
+		}
+
+		if (available > length - length_read) {
+			available = length - length_read;
+		}
+
+		memcpy(buffer + length_read, file->read_ahead_buffer + file->read_ahead_offset, available);
+
+		file->read_ahead_offset += available;
+		length_read += available;
+	}
+
+	if (hit) {
+		++file->read_ahead_hits;
+		++_read_ahead_hits;
+	} else {
+		++file->read_ahead_misses;
+		++_read_ahead_misses;
+	}
+
+	return length_read;
+}
+
+// discards the unread part of the read-ahead buffer and moves the file
+// position back to the position of the reader. sets errno on error
+static int file_discard_read_ahead(File *file) {
+	int unread = file->read_ahead_used - file->read_ahead_offset;
+
+	file->read_ahead_length = 0;
+	file->read_ahead_used = 0;
+	file->read_ahead_offset = 0;
+
+	if (unread > 0 && lseek(file->fd, -(off_t)unread, SEEK_CUR) == (off_t)-1) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void file_flush_write_behind(File *file);
+static void file_stop_async_read(File *file);
+static void file_send_async_read_callback(File *file, APIE error_code,
+                                          uint8_t *buffer, uint8_t length_read);
+
+// returns -1 if the read could not be paused. the asynchronous read is
+// aborted then and the error is reported by an async-file-read callback
+static int file_pause_async_read(File *file) {
+	if (file->async_read_paused) {
+		return 0;
+	}
+
+	if (event_modify_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC,
+	                        EVENT_READ, 0, NULL, NULL) < 0) {
+		log_error("Could not pause asynchronous read from file object ("FILE_SIGNATURE_FORMAT"), aborting it",
+		          file_expand_signature(file));
+
+		file_stop_async_read(file);
+
+		file_send_async_read_callback(file, API_E_INTERNAL_ERROR, NULL, 0);
+
+		return -1;
+	}
+
+	file->async_read_paused = true;
+
+	return 0;
+}
+
+static void file_handle_async_read(void *opaque);
+
+// aborts the asynchronous read and reports the error by an async-file-read
+// callback, if the read could not be resumed
+static void file_resume_async_read(File *file) {
+	if (!file->async_read_paused) {
+		return;
+	}
+
+	if (event_modify_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC,
+	                        0, EVENT_READ, file_handle_async_read, file) < 0) {
+		log_error("Could not resume asynchronous read from file object ("FILE_SIGNATURE_FORMAT"), aborting it",
+		          file_expand_signature(file));
+
+		file_stop_async_read(file);
+
+		file_send_async_read_callback(file, API_E_INTERNAL_ERROR, NULL, 0);
+
+		return;
+	}
+
+	file->async_read_paused = false;
+}
+
+static void file_handle_async_read_completion(int result, void *opaque);
+
+// refills the async read buffer through io_uring. if the read cannot be
+// submitted then the buffer is refilled synchronously instead
+static void file_refill_async_read_buffer(File *file, uint64_t length_to_read) {
+	int length = FILE_ASYNC_READ_URING_BUFFER_LENGTH;
+	ssize_t rc;
+
+	if ((uint64_t)length > length_to_read) {
+		length = length_to_read;
+	}
+
+	file->async_read_buffer_used = 0;
+	file->async_read_buffer_offset = 0;
+	file->async_read_request = uring_read(file->fd, file->async_read_buffer,
+	                                      length, file->async_read_position,
+	                                      file_handle_async_read_completion, file);
+
+	if (file->async_read_request != NULL) {
+		return;
+	}
+
+	log_debug("Could not submit io_uring read for file object ("FILE_SIGNATURE_FORMAT"), reading synchronously: %s (%d)",
+	          file_expand_signature(file), get_errno_name(errno), errno);
+
+	do {
+		rc = pread(file->fd, file->async_read_buffer, length, file->async_read_position);
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc < 0) {
+		file->async_read_error = errno;
+	} else {
+		file->async_read_buffer_used = rc;
+	}
+}
+
+static void file_handle_async_read_completion(int result, void *opaque) {
+	File *file = opaque;
+
+	file->async_read_request = NULL;
+
+	if (result == -EINTR || result == -EAGAIN) {
+		file_refill_async_read_buffer(file, file->length_to_read_async);
+
+		if (file->async_read_request != NULL) {
+			return;
+		}
+	} else if (result < 0) {
+		file->async_read_error = -result;
+	} else {
+		file->async_read_buffer_used = result;
+	}
+
+	// continue unless the read is waiting for credits or for the congestion
+	// to clear
+	if ((!file->async_read_flow_controlled || file->async_read_credits > 0) &&
+	    file->async_read_congestion_node.next == &file->async_read_congestion_node) {
+		file_resume_async_read(file);
+	}
+}
+
+// hands out the async read buffer chunk by chunk and refills it once it is
+// drained. sets errno on error, EINPROGRESS if the buffer is being refilled
+static int file_read_async_buffer(File *file, uint8_t *buffer, int length) {
+	int available;
+
+	if (file->async_read_request != NULL) {
+		errno = EINPROGRESS;
+
+		return -1;
+	}
+
+	if (file->async_read_error != 0) {
+		errno = file->async_read_error;
+
+		return -1;
+	}
+
+	available = file->async_read_buffer_used - file->async_read_buffer_offset;
+
+	if (available == 0) {
+		return 0; // end-of-file
+	}
+
+	if (length > available) {
+		length = available;
+	}
+
+	memcpy(buffer, file->async_read_buffer + file->async_read_buffer_offset, length);
+
+	file->async_read_buffer_offset += length;
+	file->async_read_position += length;
+
+	// start the next read right away, so it overlaps with sending this chunk
+	if (file->async_read_buffer_offset == file->async_read_buffer_used &&
+	    file->length_to_read_async > (uint64_t)length) {
+		file_refill_async_read_buffer(file, file->length_to_read_async - length);
+	}
+
+	return length;
+}
+
+// reads regular files through io_uring, if available. otherwise the async
+// read falls back to the read function of the file object
+static void file_start_async_read_buffer(File *file) {
+	off_t position;
+
+	if (file->type != FILE_TYPE_REGULAR ||
+	    (file->flags & FILE_FLAG_NON_BLOCKING) == 0 || !uring_is_available()) {
+		return;
+	}
+
+	file_flush_write_behind(file);
+
+	// the io_uring reads start at the position of the reader
+	if (file_discard_read_ahead(file) < 0) {
+		log_debug("Could not discard read-ahead buffer of file object ("FILE_SIGNATURE_FORMAT"), not reading through io_uring: %s (%d)",
+		          file_expand_signature(file), get_errno_name(errno), errno);
+
+		return;
+	}
+
+	position = lseek(file->fd, 0, SEEK_CUR);
+
+	if (position == (off_t)-1) {
+		log_debug("Could not get position of file object ("FILE_SIGNATURE_FORMAT"), not reading through io_uring: %s (%d)",
+		          file_expand_signature(file), get_errno_name(errno), errno);
+
+		return;
+	}
+
+	file->async_read_buffer = malloc(FILE_ASYNC_READ_URING_BUFFER_LENGTH);
+
+	if (file->async_read_buffer == NULL) {
+		log_debug("Could not allocate asynchronous read buffer for file object ("FILE_SIGNATURE_FORMAT"), not reading through io_uring: %s (%d)",
+		          file_expand_signature(file), get_errno_name(ENOMEM), ENOMEM);
+
+		return;
+	}
+
+	file->async_read_error = 0;
+	file->async_read_position = position;
+
+	file_refill_async_read_buffer(file, file->length_to_read_async);
+}
+
+static void file_stop_async_read_buffer(File *file) {
+	if (file->async_read_buffer == NULL) {
+		return;
+	}
+
+	if (file->async_read_request != NULL) {
+		// the buffer is freed once the read in flight completed
+		uring_abandon(file->async_read_request);
+	} else {
+		free(file->async_read_buffer);
+	}
+
+	file->async_read_buffer = NULL;
+	file->async_read_buffer_used = 0;
+	file->async_read_buffer_offset = 0;
+	file->async_read_error = 0;
+	file->async_read_request = NULL;
+
+	// the io_uring reads used explicit offsets. move the file position to the
+	// end of the data that was actually delivered
+	if (lseek(file->fd, file->async_read_position, SEEK_SET) == (off_t)-1) {
+		log_error("Could not set position of file object ("FILE_SIGNATURE_FORMAT") to %"PRIu64": %s (%d)",
+		          file_expand_signature(file), file->async_read_position,
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void file_stop_async_read(File *file) {
+	event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+
+	file_stop_async_read_buffer(file);
+
+	node_remove(&file->async_read_congestion_node);
+	node_reset(&file->async_read_congestion_node);
+
+	file->async_read_in_progress = false;
+	file->length_to_read_async = 0;
+	file->async_read_flow_controlled = false;
+	file->async_read_credits = 0;
+	file->async_read_paused = false;
+}
+
 static void file_destroy(Object *object) {
 	File *file = (File *)object;
 
@@ -204,7 +551,13 @@ static void file_destroy(Object *object) {
 		log_warn("Destroying file object ("FILE_SIGNATURE_FORMAT") while an asynchronous read for %"PRIu64" byte(s) is in progress",
 		         file_expand_signature(file), file->length_to_read_async);
 
-		event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+		file_stop_async_read(file);
+	}
+
+	if (file->write_behind_buffer != NULL) {
+		file_flush_write_behind(file);
+
+		free(file->write_behind_buffer);
 	}
 
 	if (file->type == FILE_TYPE_PIPE) {
@@ -223,14 +576,21 @@ static void file_destroy(Object *object) {
 			unlink(file->name->buffer);
 		}
 
+		if (file->type == FILE_TYPE_REGULAR) {
+			log_debug("Read-ahead of file object ("FILE_SIGNATURE_FORMAT") had %u hit(s) and %u miss(es)",
+			          file_expand_signature(file), file->read_ahead_hits,
+			          file->read_ahead_misses);
+		}
+
 		close(file->fd);
 	}
 
+	free(file->read_ahead_buffer);
 	close(file->async_read_eventfd);
 
 	string_unlock_and_release(file->name);
 
-	free(file);
+	pool_free(&_file_pool, file);
 }
 
 static void file_signature(Object *object, char *signature) {
@@ -246,8 +606,8 @@ static void file_send_async_read_callback(File *file, APIE error_code,
 	// only send a async-file-read callback if there is at least one
 	// external reference to the file object. otherwise there is no one that
 	// could be interested in this callback anyway
-	if (file->base.external_reference_count > 0) {
-		api_send_async_file_read_callback(file->base.id, error_code, buffer, length_read);
+	if (object_has_callback_subscriber(&file->base, OBJECT_CALLBACK_ASYNC_FILE_READ)) {
+		api_send_async_file_read_callback(&file->base, error_code, buffer, length_read);
 	}
 }
 
@@ -256,8 +616,8 @@ static void file_send_async_write_callback(File *file, APIE error_code,
 	// only send a async-file-write callback if there is at least one
 	// external reference to the file object. otherwise there is no one that
 	// could be interested in this callback anyway
-	if (file->base.external_reference_count > 0) {
-		api_send_async_file_write_callback(file->base.id, error_code, length_written);
+	if (object_has_callback_subscriber(&file->base, OBJECT_CALLBACK_ASYNC_FILE_WRITE)) {
+		api_send_async_file_write_callback(&file->base, error_code, length_written);
 	}
 }
 
@@ -265,8 +625,8 @@ static void file_send_events_occurred_callback(File *file, uint16_t events) {
 	// only send a file-events-occurred callback if there is at least one
 	// external reference to the file object. otherwise there is no one that
 	// could be interested in this callback anyway
-	if (file->base.external_reference_count > 0) {
-		api_send_file_events_occurred_callback(file->base.id, events);
+	if (object_has_callback_subscriber(&file->base, OBJECT_CALLBACK_FILE_EVENTS_OCCURRED)) {
+		api_send_file_events_occurred_callback(&file->base, events);
 	}
 }
 
@@ -290,6 +650,189 @@ static void file_handle_writable_event(void *opaque) {
 	file_send_events_occurred_callback(file, FILE_EVENT_WRITABLE);
 }
 
+// writes the write-behind buffer and sends the async-file-write callbacks
+// for the buffered asynchronous writes. if writing fails then the rest of the
+// buffer is lost. each callback reports how much of its write was written, the
+// callbacks of the writes that were not written completely report the error.
+// if there are none then the error is reported by the callback of the next
+// asynchronous write
+static void file_flush_write_behind(File *file) {
+	int offset = 0;
+	int rc;
+	APIE error_code = API_E_SUCCESS;
+	bool error_reported = false;
+	int start;
+	int length;
+	int i;
+
+	if (file->write_behind_used == 0) {
+		return;
+	}
+
+	// the shared timer stays armed, it skips files that are not due
+	node_remove(&file->write_behind_node);
+	node_reset(&file->write_behind_node);
+
+	while (offset < file->write_behind_used) {
+		rc = write(file->fd, file->write_behind_buffer + offset,
+		           file->write_behind_used - offset);
+
+		if (rc < 0) {
+			if (errno_interrupted()) {
+				continue;
+			}
+
+			error_code = api_get_error_code_from_errno();
+
+			log_error("Could not write %d buffered byte(s) to file object ("FILE_SIGNATURE_FORMAT"): %s (%d)",
+			          file->write_behind_used - offset, file_expand_signature(file),
+			          get_errno_name(errno), errno);
+
+			break;
+		}
+
+		offset += rc;
+	}
+
+	file->write_behind_used = 0;
+
+	++_write_behind_flushes;
+
+	for (i = 0; i < file->write_behind_async_count; ++i) {
+		start = file->write_behind_async_offsets[i];
+		length = file->write_behind_async_lengths[i];
+
+		if (offset >= start + length) {
+			file_send_async_write_callback(file, API_E_SUCCESS, length);
+		} else {
+			file_send_async_write_callback(file, error_code,
+			                               offset > start ? offset - start : 0);
+
+			error_reported = true;
+		}
+	}
+
+	if (error_code != API_E_SUCCESS && !error_reported) {
+		file->write_behind_error = error_code;
+	}
+
+	file->write_behind_async_count = 0;
+}
+
+// in microseconds, the wall clock could jump
+static uint64_t file_get_monotonic_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// all files share one timer. it is armed for the earliest deadline of the
+// dirty files, all files that are due are flushed when it fires
+static void file_handle_write_behind_timer(void *opaque) {
+	uint64_t now = file_get_monotonic_time();
+	File *file;
+
+	(void)opaque;
+
+	while (_dirty_files.next != &_dirty_files) {
+		file = containerof(_dirty_files.next, File, write_behind_node);
+
+		if (file->write_behind_deadline > now) {
+			if (timer_configure(&_write_behind_timer, file->write_behind_deadline - now, 0) < 0) {
+				log_error("Could not restart write-behind timer, flushing all write-behind buffers now: %s (%d)",
+				          get_errno_name(errno), errno);
+
+				now = UINT64_MAX;
+
+				continue;
+			}
+
+			break;
+		}
+
+		file_flush_write_behind(file);
+	}
+}
+
+// allocates the write-behind buffer on first use. returns false if the write
+// has to be done directly, this includes writes that don't fit into the buffer
+static bool file_use_write_behind(File *file, uint8_t length_to_write) {
+	if (file->write_behind_buffer != NULL) {
+		return length_to_write <= file->write_behind_allocated;
+	}
+
+	if (file->type != FILE_TYPE_REGULAR || _write_behind_max_length == 0 ||
+	    (file->flags & FILE_FLAG_NON_BLOCKING) == 0 ||
+	    length_to_write > _write_behind_max_length) {
+		return false;
+	}
+
+	file->write_behind_buffer = malloc(_write_behind_max_length);
+
+	if (file->write_behind_buffer == NULL) {
+		log_debug("Could not allocate write-behind buffer for file object ("FILE_SIGNATURE_FORMAT"), writing directly: %s (%d)",
+		          file_expand_signature(file), get_errno_name(ENOMEM), ENOMEM);
+
+		return false;
+	}
+
+	file->write_behind_allocated = _write_behind_max_length;
+
+	return true;
+}
+
+// appends to the write-behind buffer. the async-file-write callback for an
+// asynchronous write is sent once the buffer was written
+static APIE file_write_behind(File *file, uint8_t *buffer, uint8_t length_to_write,
+                              bool async) {
+	APIE error_code;
+
+	if (file->write_behind_used + length_to_write > file->write_behind_allocated ||
+	    (async && file->write_behind_async_count == FILE_MAX_WRITE_BEHIND_ASYNC_WRITES)) {
+		file_flush_write_behind(file);
+	}
+
+	if (file->write_behind_used == 0) {
+		// the buffered data is written at the position of the reader
+		if (file_discard_read_ahead(file) < 0) {
+			error_code = api_get_error_code_from_errno();
+
+			log_error("Could not discard read-ahead buffer of file object ("FILE_SIGNATURE_FORMAT"): %s (%d)",
+			          file_expand_signature(file), get_errno_name(errno), errno);
+
+			return error_code;
+		}
+
+		// all files use the same delay, appending keeps the list ordered
+		if (_dirty_files.next == &_dirty_files &&
+		    timer_configure(&_write_behind_timer, _write_behind_delay, 0) < 0) {
+			log_error("Could not start write-behind timer for file object ("FILE_SIGNATURE_FORMAT"): %s (%d)",
+			          file_expand_signature(file), get_errno_name(errno), errno);
+
+			return API_E_INTERNAL_ERROR;
+		}
+
+		file->write_behind_deadline = file_get_monotonic_time() + _write_behind_delay;
+
+		node_insert_before(&_dirty_files, &file->write_behind_node);
+	}
+
+	memcpy(file->write_behind_buffer + file->write_behind_used, buffer, length_to_write);
+
+	file->write_behind_used += length_to_write;
+
+	if (async) {
+		file->write_behind_async_offsets[file->write_behind_async_count] = file->write_behind_used;
+		file->write_behind_async_lengths[file->write_behind_async_count++] = length_to_write;
+	}
+
+	++_write_behind_writes;
+
+	return API_E_SUCCESS;
+}
+
 // sets errno on error
 static int file_handle_read(File *file, void *buffer, int length) {
 	if ((file->flags & FILE_FLAG_NON_BLOCKING) == 0) {
@@ -298,6 +841,12 @@ static int file_handle_read(File *file, void *buffer, int length) {
 		return -1;
 	}
 
+	file_flush_write_behind(file);
+
+	if (file->type == FILE_TYPE_REGULAR && _read_ahead_max_length > 0) {
+		return file_read_ahead(file, buffer, length);
+	}
+
 	return read(file->fd, buffer, length);
 }
 
@@ -309,11 +858,38 @@ static int file_handle_write(File *file, void *buffer, int length) {
 		return -1;
 	}
 
+	file_flush_write_behind(file);
+
+	// write at the position of the reader, the following reads see the
+	// written data then
+	if (file_discard_read_ahead(file) < 0) {
+		return -1;
+	}
+
 	return write(file->fd, buffer, length);
 }
 
 // sets errno on error
 static off_t file_handle_seek(File *file, off_t offset, int whence) {
+	off_t position;
+
+	file_flush_write_behind(file);
+
+	// getting the position keeps the read-ahead buffer
+	if (offset == 0 && whence == SEEK_CUR) {
+		position = lseek(file->fd, 0, SEEK_CUR);
+
+		if (position == (off_t)-1) {
+			return position;
+		}
+
+		return position - (file->read_ahead_used - file->read_ahead_offset);
+	}
+
+	if (file_discard_read_ahead(file) < 0) {
+		return (off_t)-1;
+	}
+
 	return lseek(file->fd, offset, whence);
 }
 
@@ -350,35 +926,52 @@ static off_t pipe_handle_seek(File *file, off_t offset, int whence) {
 	return (off_t)-1;
 }
 
-// FIXME: maybe add a loop here and read multiple times per read event
-static void file_handle_async_read(void *opaque) {
-	File *file = opaque;
+// reads one chunk and sends it as async-file-read callback. returns false if
+// no further chunk should be read during the current event
+static bool file_read_async_chunk(File *file) {
 	uint8_t buffer[FILE_MAX_READ_ASYNC_BUFFER_LENGTH];
 	uint8_t length_to_read = sizeof(buffer);
 	int length_read;
 	APIE error_code;
 
-	if (!file->async_read_in_progress) {
-		log_error("Got asynchronous read event for file object ("FILE_SIGNATURE_FORMAT") without an asynchronous read in progress",
+	// stop producing callbacks while the send buffer of a subscribed connection
+	// is congested. file_resume_async_reads will continue once it drained
+	if (network_is_congested(&file->base, OBJECT_CALLBACK_ASYNC_FILE_READ)) {
+		log_debug("Pausing asynchronous read from file object ("FILE_SIGNATURE_FORMAT") because of congestion",
 		          file_expand_signature(file));
 
-		event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+		if (file_pause_async_read(file) < 0) {
+			return false;
+		}
 
-		return;
+		if (file->async_read_congestion_node.next == &file->async_read_congestion_node) {
+			node_insert_before(&_congested_async_reads, &file->async_read_congestion_node);
+		}
+
+		return false;
 	}
 
 	if (length_to_read > file->length_to_read_async) {
 		length_to_read = file->length_to_read_async;
 	}
 
-	length_read = file->read(file, buffer, length_to_read);
+	if (file->async_read_buffer != NULL) {
+		length_read = file_read_async_buffer(file, buffer, length_to_read);
+	} else {
+		length_read = file->read(file, buffer, length_to_read);
+	}
 
 	if (length_read < 0) {
-		if (errno_interrupted()) {
+		if (errno == EINPROGRESS) {
+			// file_handle_async_read_completion resumes the read
+			file_pause_async_read(file);
+
+			return false;
+		} else if (errno_interrupted()) {
 			log_debug("Reading from file object ("FILE_SIGNATURE_FORMAT") asynchronously was interrupted, retrying",
 			          file_expand_signature(file));
 
-			return;
+			return false;
 		} else if (errno_would_block()) {
 			// don't report an error, just return an empty buffer if there is
 			// nothing to read at this time
@@ -390,14 +983,11 @@ static void file_handle_async_read(void *opaque) {
 			          length_to_read, file_expand_signature(file),
 			          get_errno_name(errno), errno);
 
-			event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
-
-			file->async_read_in_progress = false;
-			file->length_to_read_async = 0;
+			file_stop_async_read(file);
 
 			file_send_async_read_callback(file, error_code, NULL, 0);
 
-			return;
+			return false;
 		}
 	}
 
@@ -409,10 +999,7 @@ static void file_handle_async_read(void *opaque) {
 	if (length_read == 0 || file->length_to_read_async == 0) {
 		// finished asynchronous reading either because there is nothing
 		// to read or the request amount was read
-		file->async_read_in_progress = false;
-		file->length_to_read_async = 0;
-
-		event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+		file_stop_async_read(file);
 	}
 
 	file_send_async_read_callback(file, API_E_SUCCESS, buffer, length_read);
@@ -420,168 +1007,51 @@ static void file_handle_async_read(void *opaque) {
 	if (!file->async_read_in_progress) {
 		log_debug("Finished asynchronous reading from file object ("FILE_SIGNATURE_FORMAT")",
 		          file_expand_signature(file));
-	}
-}
-
-// NOTE: assumes that name is absolute (starts with '/')
-static APIE file_open_as(const char *name, uint32_t flags, int oflags,
-                         mode_t mode, uint32_t uid, uint32_t gid, IOHandle *fd_) {
-	APIE error_code;
-	int pair[2];
-	pid_t pid;
-	int fd = -1;
-	int rc;
-	int status;
-
-	// create socket pair to pass FD from child to parent
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
-		error_code = api_get_error_code_from_errno();
-
-		log_error("Could not create socket pair for opening file '%s': %s (%d)",
-		          name, get_errno_name(errno), errno);
-
-		return error_code;
-	}
-
-	error_code = process_fork(&pid);
 
-	if (error_code != API_E_SUCCESS) {
-		return error_code;
+		return false;
 	}
 
-	if (pid == 0) { // child
-		// close socket pair read end in child
-		close(pair[0]);
-
-		// change user and groups
-		error_code = process_set_identity(uid, gid);
-
-		if (error_code != API_E_SUCCESS) {
-			goto child_cleanup;
-		}
-
-		// open file
-		fd = open(name, oflags, mode);
-
-		if (fd < 0) {
-			error_code = api_get_error_code_from_errno();
-
-			if (errno == ENOENT) {
-				log_debug("Could not open non-existing file '%s'", name);
-			} else if ((flags & (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE)) ==
-			           (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE) && errno == EEXIST) {
-				log_debug("Could not exclusively create already existing file '%s'", name);
-			} else {
-				log_error("Could not open file '%s' with flags 0x%04X as %u:%u: %s (%d)",
-				          name, flags, uid, gid, get_errno_name(errno), errno);
-			}
-
-			goto child_cleanup;
-		}
-
-		error_code = API_E_SUCCESS;
-
-	child_cleanup:
-		// send FD to parent in all cases
-		do {
-			rc = sendfd(pair[1], fd);
-		} while (rc < 0 && errno_interrupted());
-
-		if (rc < 0) {
-			log_error("Could not send file descriptor to parent process for file '%s': %s (%d)",
-			          name, get_errno_name(errno), errno);
+	// pausing after the callback was sent, a failure to pause is reported
+	// after this chunk then
+	if (file->async_read_flow_controlled && --file->async_read_credits == 0) {
+		// the client has to grant more credits before the next callback
+		log_debug("Pausing asynchronous read from file object ("FILE_SIGNATURE_FORMAT") because all credits are used up",
+		          file_expand_signature(file));
 
-			if (fd >= 0) {
-				close(fd);
-			}
+		if (file_pause_async_read(file) < 0) {
+			return false;
 		}
-
-		// close socket pair write end in child
-		close(pair[1]);
-
-		// report error code as exit status
-		_exit(error_code);
-	}
-
-	// close socket pair write end in parent
-	close(pair[1]);
-
-	// receive FD from child
-	do {
-		rc = recvfd(pair[0], &fd);
-	} while (rc < 0 && errno_interrupted());
-
-	if (rc < 0) {
-		error_code = api_get_error_code_from_errno();
-
-		log_error("Could not receive file descriptor from child process opening file '%s' as %u:%u: %s (%d)",
-		          name, uid, gid, get_errno_name(errno), errno);
-
-		// close socket pair read end in parent
-		close(pair[0]);
-
-		// wait for child to exit
-		while (waitpid(pid, NULL, 0) < 0 && errno_interrupted());
-
-		return error_code;
 	}
 
-	// close socket pair read end in parent
-	close(pair[0]);
-
-	// wait for child to exit
-	do {
-		rc = waitpid(pid, &status, 0);
-	} while (rc < 0 && errno_interrupted());
+	return !file->async_read_paused;
+}
 
-	if (rc < 0) {
-		error_code = api_get_error_code_from_errno();
+// reads up to file.async_read_chunks_per_event chunks per event. the eventfd
+// stays readable, so the next chunks are read during the next event loop
+// iteration, after all other pending events got handled
+static void file_handle_async_read(void *opaque) {
+	File *file = opaque;
+	int i;
 
-		log_error("Could not wait for child process opening file '%s' as %u:%u: %s (%d)",
-		          name, uid, gid, get_errno_name(errno), errno);
+	if (!file->async_read_in_progress) {
+		log_error("Got asynchronous read event for file object ("FILE_SIGNATURE_FORMAT") without an asynchronous read in progress",
+		          file_expand_signature(file));
 
-		if (fd >= 0) {
-			close(fd);
-		}
+		event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
 
-		return error_code;
+		return;
 	}
 
-	// check if child exited normally
-	if (!WIFEXITED(status)) {
-		log_error("Child process opening file '%s' as %u:%u did not exit normally",
-		          name, uid, gid);
-
-		if (fd >= 0) {
-			close(fd);
-		}
-
-		return API_E_INTERNAL_ERROR;
+	// the event might have been collected before the read got paused
+	if (file->async_read_paused) {
+		return;
 	}
 
-	// get child error code from child exit status
-	error_code = WEXITSTATUS(status);
-
-	if (error_code != API_E_SUCCESS) {
-		if (fd >= 0) {
-			close(fd);
+	for (i = 0; i < _async_read_chunks_per_event; ++i) {
+		if (!file_read_async_chunk(file)) {
+			break;
 		}
-
-		return error_code;
-	}
-
-	// check if FD is invalid after child process exited successfully. this
-	// should not be possible. the check is here just to be on the safe side
-	if (fd < 0) {
-		log_error("Child process opening file '%s' as %u:%u succeeded, but returned an invalid file descriptor",
-		          name, uid, gid);
-
-		return API_E_INTERNAL_ERROR;
 	}
-
-	*fd_ = fd;
-
-	return API_E_SUCCESS;
 }
 
 static int file_get_oflags_from_flags(uint32_t flags) {
@@ -622,6 +1092,45 @@ static int file_get_oflags_from_flags(uint32_t flags) {
 	return oflags;
 }
 
+int file_init(void) {
+	log_debug("Initializing file subsystem");
+
+	_async_read_chunks_per_event = config_get_option_value("file.async_read_chunks_per_event")->integer;
+	_read_ahead_max_length = config_get_option_value("file.read_ahead_length")->integer;
+	_write_behind_max_length = config_get_option_value("file.write_behind_length")->integer;
+	_write_behind_delay = (uint64_t)config_get_option_value("file.write_behind_delay")->integer * 1000;
+
+	if (_write_behind_max_length > 0 &&
+	    timer_create_(&_write_behind_timer, file_handle_write_behind_timer, NULL) < 0) {
+		log_error("Could not create write-behind timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// file objects are destroyed by inventory_exit before, their write-behind
+// buffers are flushed already
+void file_exit(void) {
+	log_debug("Shutting down file subsystem");
+
+	if (_write_behind_max_length > 0) {
+		timer_destroy(&_write_behind_timer);
+	}
+}
+
+void file_log_statistics(void) {
+	uint32_t reads = _read_ahead_hits + _read_ahead_misses;
+
+	log_info("File read-ahead: %u hit(s), %u miss(es), %u%% hit ratio",
+	         _read_ahead_hits, _read_ahead_misses,
+	         reads > 0 ? (uint32_t)((uint64_t)_read_ahead_hits * 100 / reads) : 0);
+	log_info("File write-behind: %u write(s) buffered, %u flush(es)",
+	         _write_behind_writes, _write_behind_flushes);
+}
+
 mode_t file_get_mode_from_permissions(uint16_t permissions) {
 	mode_t mode = 0;
 
@@ -664,144 +1173,141 @@ mode_t file_get_mode_from_permissions(uint16_t permissions) {
 	return mode;
 }
 
-// public API
-APIE file_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
-               uint32_t uid, uint32_t gid, Session *session,
-               uint16_t object_create_flags, ObjectID *id, File **object) {
-	int phase = 0;
+// checks the parameters and acquires and locks the name string object
+static APIE file_prepare_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
+                              int *oflags, mode_t *mode, String **name) {
 	APIE error_code;
-	int oflags = O_NOCTTY;
-	mode_t mode = 0;
-	String *name;
-	IOHandle fd;
-	IOHandle async_read_eventfd;
-	File *file;
-	struct stat st;
 
 	// check parameters
 	if ((flags & ~FILE_FLAG_ALL) != 0) {
-		error_code = API_E_INVALID_PARAMETER;
-
 		log_warn("Invalid file flags 0x%04X", flags);
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
 	if ((permissions & ~FILE_PERMISSION_ALL) != 0) {
-		error_code = API_E_INVALID_PARAMETER;
-
 		log_warn("Invalid file permissions %04o", permissions);
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
 	if ((flags & FILE_FLAG_CREATE) != 0 && permissions == 0) {
-		error_code = API_E_INVALID_PARAMETER;
-
 		log_warn("FILE_FLAG_CREATE used without specifying file permissions");
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
 	if ((flags & FILE_FLAG_CREATE) == 0 && permissions != 0) {
-		error_code = API_E_INVALID_PARAMETER;
-
 		log_warn("Permissions specified without using FILE_FLAG_CREATE");
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
 	// translate flags
-	oflags |= file_get_oflags_from_flags(flags);
+	*oflags = O_NOCTTY | file_get_oflags_from_flags(flags);
 
 	if ((flags & FILE_FLAG_TEMPORARY) != 0 &&
 	    ((flags & FILE_FLAG_CREATE) == 0 || (flags & FILE_FLAG_EXCLUSIVE) == 0)) {
-		error_code = API_E_INVALID_PARAMETER;
-
 		log_warn("FILE_FLAG_TEMPORARY used without using FILE_FLAG_CREATE and FILE_FLAG_EXCLUSIVE as well");
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
 	if ((flags & FILE_FLAG_REPLACE) != 0 && (flags & FILE_FLAG_CREATE) == 0) {
-		error_code = API_E_INVALID_PARAMETER;
-
 		log_warn("FILE_FLAG_REPLACE used without using FILE_FLAG_CREATE as well");
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
 	// translate create permissions
+	*mode = 0;
+
 	if ((flags & FILE_FLAG_CREATE) != 0) {
-		mode |= file_get_mode_from_permissions(permissions);
+		*mode = file_get_mode_from_permissions(permissions);
 	}
 
 	// acquire and lock name string object
-	error_code = string_get_acquired_and_locked(name_id, &name);
+	error_code = string_get_acquired_and_locked(name_id, name);
 
 	if (error_code != API_E_SUCCESS) {
-		goto cleanup;
+		return error_code;
 	}
 
-	phase = 1;
-
-	if (*name->buffer == '\0') {
-		error_code = API_E_INVALID_PARAMETER;
-
+	if (*(*name)->buffer == '\0') {
 		log_warn("File name cannot be empty");
 
-		goto cleanup;
+		string_unlock_and_release(*name);
+
+		return API_E_INVALID_PARAMETER;
 	}
 
-	if (*name->buffer != '/') {
-		error_code = API_E_INVALID_PARAMETER;
+	if (*(*name)->buffer != '/') {
+		log_warn("Cannot open/create file with relative name '%s'", (*name)->buffer);
 
-		log_warn("Cannot open/create file with relative name '%s'", name->buffer);
+		string_unlock_and_release(*name);
 
-		goto cleanup;
+		return API_E_INVALID_PARAMETER;
 	}
 
+	return API_E_SUCCESS;
+}
+
+// replaces and opens the file. this blocks for an open helper round trip, or a
+// fork and waitpid, if the file is opened as a different user. it doesn't touch any object, so it can be
+// called on the worker thread
+static APIE file_open_handle(const char *name, uint32_t flags, int oflags,
+                             mode_t mode, uint32_t uid, uint32_t gid, IOHandle *fd) {
+	APIE error_code;
+
 	// unlink existing
 	if ((flags & FILE_FLAG_REPLACE) != 0) {
-		if (unlink(name->buffer) < 0 && errno != ENOENT) {
+		if (unlink(name) < 0 && errno != ENOENT) {
 			error_code = api_get_error_code_from_errno();
 
 			log_error("Could not unlink '%s' to replace it: %s (%d)",
-			          name->buffer, get_errno_name(errno), errno);
+			          name, get_errno_name(errno), errno);
 
-			goto cleanup;
+			return error_code;
 		}
 	}
 
 	// open file
-	if (geteuid() == uid && getegid() == gid) {
-		fd = open(name->buffer, oflags, mode);
+	if (geteuid() != uid || getegid() != gid) {
+		return open_helper_open(name, flags, oflags, mode, uid, gid, fd);
+	}
 
-		if (fd < 0) {
-			error_code = api_get_error_code_from_errno();
+	*fd = open(name, oflags, mode);
 
-			if (errno == ENOENT) {
-				log_debug("Could not open non-existing file '%s'", name->buffer);
-			} else if ((flags & (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE)) ==
-			           (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE) && errno == EEXIST) {
-				log_debug("Could not exclusively create already existing file '%s'",
-				          name->buffer);
-			} else {
-				log_error("Could not open file '%s' with flags 0x%04X as %u:%u: %s (%d)",
-				          name->buffer, flags, uid, gid, get_errno_name(errno), errno);
-			}
+	if (*fd < 0) {
+		error_code = api_get_error_code_from_errno();
 
-			goto cleanup;
+		if (errno == ENOENT) {
+			log_debug("Could not open non-existing file '%s'", name);
+		} else if ((flags & (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE)) ==
+		           (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE) && errno == EEXIST) {
+			log_debug("Could not exclusively create already existing file '%s'", name);
+		} else {
+			log_error("Could not open file '%s' with flags 0x%04X as %u:%u: %s (%d)",
+			          name, flags, uid, gid, get_errno_name(errno), errno);
 		}
-	} else {
-		error_code = file_open_as(name->buffer, flags, oflags, mode, uid, gid, &fd);
 
-		if (error_code != API_E_SUCCESS) {
-			goto cleanup;
-		}
+		return error_code;
 	}
 
-	phase = 2;
+	return API_E_SUCCESS;
+}
+
+// creates the file object for an opened file descriptor. takes ownership of
+// the locked name string object and of the file descriptor, also on error
+static APIE file_create_object(String *name, uint32_t flags, uint16_t permissions,
+                               uint32_t uid, uint32_t gid, IOHandle fd,
+                               Session *session, uint16_t object_create_flags,
+                               ObjectID *id, File **object) {
+	int phase = 2;
+	APIE error_code;
+	IOHandle async_read_eventfd;
+	File *file;
+	struct stat st;
 
 	if (fstat(fd, &st) < 0) {
 		error_code = api_get_error_code_from_errno();
@@ -813,7 +1319,7 @@ APIE file_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
 	}
 
 	// allocate file object
-	file = calloc(1, sizeof(File));
+	file = pool_allocate(&_file_pool);
 
 	if (file == NULL) {
 		error_code = API_E_NO_FREE_MEMORY;
@@ -849,10 +1355,34 @@ APIE file_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
 	file->async_read_eventfd = async_read_eventfd;
 	file->async_read_in_progress = false;
 	file->length_to_read_async = 0;
+	file->async_read_flow_controlled = false;
+	file->async_read_credits = 0;
+	file->async_read_paused = false;
+	file->async_read_buffer = NULL;
+	file->async_read_buffer_used = 0;
+	file->async_read_buffer_offset = 0;
+	file->async_read_error = 0;
+	file->async_read_position = 0;
+	file->async_read_request = NULL;
+	file->read_ahead_buffer = NULL;
+	file->read_ahead_allocated = 0;
+	file->read_ahead_length = 0;
+	file->read_ahead_used = 0;
+	file->read_ahead_offset = 0;
+	file->read_ahead_hits = 0;
+	file->read_ahead_misses = 0;
+	file->write_behind_buffer = NULL;
+	file->write_behind_allocated = 0;
+	file->write_behind_used = 0;
+	file->write_behind_async_count = 0;
+	file->write_behind_error = API_E_SUCCESS;
 	file->read = file_handle_read;
 	file->write = file_handle_write;
 	file->seek = file_handle_seek;
 
+	node_reset(&file->async_read_congestion_node);
+	node_reset(&file->write_behind_node);
+
 	error_code = object_create(&file->base, OBJECT_TYPE_FILE, session,
 	                           object_create_flags, file_destroy, file_signature);
 
@@ -881,25 +1411,137 @@ APIE file_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
 		          file_expand_signature(file), uid, gid, fd);
 	}
 
-cleanup:
-	switch (phase) { // no breaks, all cases fall through intentionally
-	case 4:
-		close(async_read_eventfd);
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		close(async_read_eventfd);
+
+	case 3:
+		pool_free(&_file_pool, file);
+
+	case 2:
+		close(fd);
+
+	case 1:
+		string_unlock_and_release(name);
+
+	default:
+		break;
+	}
+
+	return phase == 5 ? API_E_SUCCESS : error_code;
+}
+
+// public API
+APIE file_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
+               uint32_t uid, uint32_t gid, Session *session,
+               uint16_t object_create_flags, ObjectID *id, File **object) {
+	APIE error_code;
+	int oflags;
+	mode_t mode;
+	String *name;
+	IOHandle fd;
+
+	error_code = file_prepare_open(name_id, flags, permissions, &oflags, &mode, &name);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	error_code = file_open_handle(name->buffer, flags, oflags, mode, uid, gid, &fd);
+
+	if (error_code != API_E_SUCCESS) {
+		string_unlock_and_release(name);
+
+		return error_code;
+	}
+
+	return file_create_object(name, flags, permissions, uid, gid, fd, session,
+	                          object_create_flags, id, object);
+}
+
+static void file_work_open_job(void *opaque) {
+	FileOpenJob *job = opaque;
+
+	job->error_code = file_open_handle(job->name->buffer, job->flags, job->oflags,
+	                                   job->mode, job->uid, job->gid, &job->fd);
+}
+
+static void file_complete_open_job(void *opaque) {
+	FileOpenJob *job = opaque;
+	Session *session;
+	ObjectID id = OBJECT_ID_ZERO;
+
+	if (job->error_code != API_E_SUCCESS) {
+		string_unlock_and_release(job->name);
+	} else {
+		// the session might have expired while the file was opened
+		job->error_code = inventory_get_session(job->session_id, &session);
+
+		if (job->error_code != API_E_SUCCESS) {
+			close(job->fd);
+			string_unlock_and_release(job->name);
+		} else {
+			job->error_code = file_create_object(job->name, job->flags, job->permissions,
+			                                     job->uid, job->gid, job->fd, session,
+			                                     job->object_create_flags, &id, NULL);
+		}
+	}
+
+	job->opened(job->error_code, id, job->opaque);
+
+	free(job);
+}
+
+// like file_open, but the file is opened on a worker thread, to avoid blocking
+// the event loop on slow storage or on the open helper. if this function
+// returns API_E_SUCCESS then the opened function is called exactly once, after
+// the worker thread is done
+APIE file_open_deferred(ObjectID name_id, uint32_t flags, uint16_t permissions,
+                        uint32_t uid, uint32_t gid, Session *session,
+                        uint16_t object_create_flags, FileOpenedFunction opened,
+                        void *opaque) {
+	APIE error_code;
+	FileOpenJob *job;
+
+	job = calloc(1, sizeof(FileOpenJob));
+
+	if (job == NULL) {
+		log_error("Could not allocate file open job: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return API_E_NO_FREE_MEMORY;
+	}
+
+	error_code = file_prepare_open(name_id, flags, permissions, &job->oflags,
+	                               &job->mode, &job->name);
 
-	case 3:
-		free(file);
+	if (error_code != API_E_SUCCESS) {
+		free(job);
 
-	case 2:
-		close(fd);
+		return error_code;
+	}
 
-	case 1:
-		string_unlock_and_release(name);
+	job->flags = flags;
+	job->permissions = permissions;
+	job->uid = uid;
+	job->gid = gid;
+	job->session_id = session->id;
+	job->object_create_flags = object_create_flags;
+	job->opened = opened;
+	job->opaque = opaque;
+	job->fd = -1;
 
-	default:
-		break;
+	error_code = worker_submit(file_work_open_job, file_complete_open_job, job);
+
+	if (error_code != API_E_SUCCESS) {
+		string_unlock_and_release(job->name);
+		free(job);
+
+		return error_code;
 	}
 
-	return phase == 5 ? API_E_SUCCESS : error_code;
+	return API_E_SUCCESS;
 }
 
 // public API
@@ -936,7 +1578,7 @@ APIE pipe_create_(uint32_t flags, uint64_t length, Session *session,
 	phase = 1;
 
 	// allocate file object
-	file = calloc(1, sizeof(File));
+	file = pool_allocate(&_file_pool);
 
 	if (file == NULL) {
 		error_code = API_E_NO_FREE_MEMORY;
@@ -993,10 +1635,34 @@ APIE pipe_create_(uint32_t flags, uint64_t length, Session *session,
 	file->async_read_eventfd = async_read_eventfd;
 	file->async_read_in_progress = false;
 	file->length_to_read_async = 0;
+	file->async_read_flow_controlled = false;
+	file->async_read_credits = 0;
+	file->async_read_paused = false;
+	file->async_read_buffer = NULL;
+	file->async_read_buffer_used = 0;
+	file->async_read_buffer_offset = 0;
+	file->async_read_error = 0;
+	file->async_read_position = 0;
+	file->async_read_request = NULL;
+	file->read_ahead_buffer = NULL;
+	file->read_ahead_allocated = 0;
+	file->read_ahead_length = 0;
+	file->read_ahead_used = 0;
+	file->read_ahead_offset = 0;
+	file->read_ahead_hits = 0;
+	file->read_ahead_misses = 0;
+	file->write_behind_buffer = NULL;
+	file->write_behind_allocated = 0;
+	file->write_behind_used = 0;
+	file->write_behind_async_count = 0;
+	file->write_behind_error = API_E_SUCCESS;
 	file->read = pipe_handle_read;
 	file->write = pipe_handle_write;
 	file->seek = pipe_handle_seek;
 
+	node_reset(&file->async_read_congestion_node);
+	node_reset(&file->write_behind_node);
+
 	error_code = object_create(&file->base, OBJECT_TYPE_FILE, session,
 	                           object_create_flags, file_destroy, file_signature);
 
@@ -1026,7 +1692,7 @@ cleanup:
 		pipe_destroy(&file->pipe);
 
 	case 2:
-		free(file);
+		pool_free(&_file_pool, file);
 
 	case 1:
 		string_unlock_and_release(name);
@@ -1038,33 +1704,12 @@ cleanup:
 	return phase == 5 ? API_E_SUCCESS : error_code;
 }
 
-// public API
-APIE file_get_info(File *file, Session *session, uint8_t *type,
-                   ObjectID *name_id, uint32_t *flags,
-                   uint16_t *permissions, uint32_t *uid, uint32_t *gid,
-                   uint64_t *length, uint64_t *access_timestamp,
-                   uint64_t *modification_timestamp,
-                   uint64_t *status_change_timestamp) {
+// gets the current information of the file. this blocks on the SD card for
+// regular files, but uses the file object read-only. it is safe to call it on
+// a worker thread as long as the file object is pinned
+static APIE file_query_info(File *file, struct stat *st, int *pipe_length) {
 	APIE error_code;
-	struct stat st;
 	int rc;
-	FileType current_type;
-
-	*type = file->type;
-
-	if (file->type == FILE_TYPE_PIPE) {
-		*name_id = OBJECT_ID_ZERO;
-	} else {
-		error_code = object_add_external_reference(&file->name->base, session);
-
-		if (error_code != API_E_SUCCESS) {
-			return error_code;
-		}
-
-		*name_id = file->name->base.id;
-	}
-
-	*flags = file->flags;
 
 	if (file->type == FILE_TYPE_PIPE) {
 		rc = fcntl(file->pipe.read_end, F_GETPIPE_SZ);
@@ -1078,15 +1723,9 @@ APIE file_get_info(File *file, Session *session, uint8_t *type,
 			return error_code;
 		}
 
-		*permissions = 0;
-		*uid = 0;
-		*gid = 0;
-		*length = rc;
-		*access_timestamp = 0;
-		*modification_timestamp = 0;
-		*status_change_timestamp = 0;
+		*pipe_length = rc;
 	} else {
-		rc = fstat(file->fd, &st);
+		rc = fstat(file->fd, st);
 
 		if (rc < 0) {
 			error_code = api_get_error_code_from_errno();
@@ -1096,8 +1735,18 @@ APIE file_get_info(File *file, Session *session, uint8_t *type,
 
 			return error_code;
 		}
+	}
+
+	return API_E_SUCCESS;
+}
+
+static APIE file_fill_info(File *file, Session *session, struct stat *st,
+                           int pipe_length, FileInfo *info) {
+	APIE error_code;
+	FileType current_type;
 
-		current_type = file_get_type_from_stat_mode(st.st_mode);
+	if (file->type != FILE_TYPE_PIPE) {
+		current_type = file_get_type_from_stat_mode(st->st_mode);
 
 		if (current_type != file->type) {
 			log_error("Current type (%s) of file object ("FILE_SIGNATURE_FORMAT") differs from cached type",
@@ -1105,32 +1754,133 @@ APIE file_get_info(File *file, Session *session, uint8_t *type,
 
 			return API_E_INTERNAL_ERROR;
 		}
+	}
+
+	memset(info, 0, sizeof(*info));
+
+	info->type = file->type;
+	info->flags = file->flags;
+
+	if (file->type == FILE_TYPE_PIPE) {
+		info->name_id = OBJECT_ID_ZERO;
+		info->length = pipe_length;
+	} else {
+		error_code = object_add_external_reference(&file->name->base, session);
+
+		if (error_code != API_E_SUCCESS) {
+			return error_code;
+		}
 
-		*permissions = file_get_permissions_from_stat_mode(st.st_mode);
-		*uid = st.st_uid;
-		*gid = st.st_gid;
-		*length = st.st_size;
-		*access_timestamp = st.st_atime;
-		*modification_timestamp = st.st_mtime;
-		*status_change_timestamp = st.st_ctime;
+		info->name_id = file->name->base.id;
+		info->permissions = file_get_permissions_from_stat_mode(st->st_mode);
+		info->uid = st->st_uid;
+		info->gid = st->st_gid;
+		info->length = st->st_size;
+		info->access_timestamp = st->st_atime;
+		info->modification_timestamp = st->st_mtime;
+		info->status_change_timestamp = st->st_ctime;
 	}
 
 	return API_E_SUCCESS;
 }
 
 // public API
-APIE file_read(File *file, uint8_t *buffer, uint8_t length_to_read,
-               uint8_t *length_read) {
-	int rc;
+APIE file_get_info(File *file, Session *session, FileInfo *info) {
 	APIE error_code;
+	struct stat st;
+	int pipe_length = 0;
 
-	if (length_to_read > FILE_MAX_READ_BUFFER_LENGTH) {
-		log_warn("Length of %u byte(s) exceeds maximum length of file read buffer",
-		         length_to_read);
+	// the length includes the buffered data
+	if (file->type != FILE_TYPE_PIPE) {
+		file_flush_write_behind(file);
+	}
 
-		return API_E_OUT_OF_RANGE;
+	error_code = file_query_info(file, &st, &pipe_length);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	return file_fill_info(file, session, &st, pipe_length, info);
+}
+
+static void file_work_info_job(void *opaque) {
+	FileInfoJob *job = opaque;
+
+	job->error_code = file_query_info(job->file, &job->st, &job->pipe_length);
+}
+
+static void file_complete_info_job(void *opaque) {
+	FileInfoJob *job = opaque;
+	Session *session;
+	FileInfo info;
+
+	memset(&info, 0, sizeof(info));
+
+	if (job->error_code == API_E_SUCCESS) {
+		// the session might have expired while the information was queried
+		job->error_code = inventory_get_session(job->session_id, &session);
+
+		if (job->error_code == API_E_SUCCESS) {
+			job->error_code = file_fill_info(job->file, session, &job->st,
+			                                 job->pipe_length, &info);
+		}
+	}
+
+	job->done(job->error_code, &info, job->opaque);
+
+	object_remove_internal_reference(&job->file->base);
+
+	free(job);
+}
+
+// like file_get_info, but the information is queried on a worker thread. the
+// file object is pinned until then. if this function returns API_E_SUCCESS
+// then the done function is called exactly once, after the worker thread is
+// done
+APIE file_get_info_deferred(File *file, Session *session,
+                            FileInfoFunction done, void *opaque) {
+	APIE error_code;
+	FileInfoJob *job;
+
+	job = calloc(1, sizeof(FileInfoJob));
+
+	if (job == NULL) {
+		log_error("Could not allocate file info job: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return API_E_NO_FREE_MEMORY;
+	}
+
+	// the length includes the buffered data
+	if (file->type != FILE_TYPE_PIPE) {
+		file_flush_write_behind(file);
+	}
+
+	job->file = file;
+	job->session_id = session->id;
+	job->done = done;
+	job->opaque = opaque;
+
+	object_add_internal_reference(&file->base);
+
+	error_code = worker_submit(file_work_info_job, file_complete_info_job, job);
+
+	if (error_code != API_E_SUCCESS) {
+		object_remove_internal_reference(&file->base);
+		free(job);
+
+		return error_code;
 	}
 
+	return API_E_SUCCESS;
+}
+
+static APIE file_read_buffer(File *file, uint8_t *buffer, uint32_t length_to_read,
+                             int *length_read) {
+	int rc;
+	APIE error_code;
+
 	if (file->async_read_in_progress) {
 		log_warn("Cannot read %u byte(s) synchronously while reading %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously",
 		         length_to_read, file->length_to_read_async, file_expand_signature(file));
@@ -1162,22 +1912,74 @@ APIE file_read(File *file, uint8_t *buffer, uint8_t length_to_read,
 }
 
 // public API
-PacketE file_read_async(File *file, uint64_t length_to_read) {
+APIE file_read(File *file, uint8_t *buffer, uint8_t length_to_read,
+               uint8_t *length_read) {
+	int rc;
+	APIE error_code;
+
+	if (length_to_read > FILE_MAX_READ_BUFFER_LENGTH) {
+		log_warn("Length of %u byte(s) exceeds maximum length of file read buffer",
+		         length_to_read);
+
+		return API_E_OUT_OF_RANGE;
+	}
+
+	error_code = file_read_buffer(file, buffer, length_to_read, &rc);
+
+	if (error_code == API_E_SUCCESS) {
+		*length_read = rc;
+	}
+
+	return error_code;
+}
+
+// public API
+APIE file_read_large(File *file, uint8_t *buffer, uint32_t length_to_read,
+                     uint32_t *length_read) {
+	int rc;
+	APIE error_code;
+
+	if (length_to_read > FILE_MAX_LARGE_BUFFER_LENGTH) {
+		log_warn("Length of %u byte(s) exceeds maximum length of large file read buffer",
+		         length_to_read);
+
+		return API_E_OUT_OF_RANGE;
+	}
+
+	error_code = file_read_buffer(file, buffer, length_to_read, &rc);
+
+	if (error_code == API_E_SUCCESS) {
+		*length_read = rc;
+	}
+
+	return error_code;
+}
+
+// public API
+static PacketE file_start_async_read(File *file, uint64_t length_to_read,
+                                     bool flow_controlled, uint16_t window) {
 	if (length_to_read > INT64_MAX) {
 		log_warn("Length of %"PRIu64" byte(s) exceeds maximum length of file",
 		         length_to_read);
 
-		// FIXME: this callback should be delivered after the response of this function
 		file_send_async_read_callback(file, API_E_OUT_OF_RANGE, NULL, 0);
 
 		return PACKET_E_INVALID_PARAMETER;
 	}
 
+	if (flow_controlled && window == 0) {
+		log_warn("Cannot read from file object ("FILE_SIGNATURE_FORMAT") asynchronously with an empty window",
+		         file_expand_signature(file));
+
+		file_send_async_read_callback(file, API_E_INVALID_PARAMETER, NULL, 0);
+
+		return PACKET_E_INVALID_PARAMETER;
+	}
+
 	if (file->async_read_in_progress) {
 		log_warn("Still reading %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously",
 		         file->length_to_read_async, file_expand_signature(file));
 
-		// FIXME: this callback should be delivered after the response of this function
 		file_send_async_read_callback(file, API_E_INVALID_OPERATION, NULL, 0);
 
 		return PACKET_E_UNKNOWN_ERROR;
@@ -1185,6 +1987,9 @@ PacketE file_read_async(File *file, uint64_t length_to_read) {
 
 	file->async_read_in_progress = true;
 	file->length_to_read_async = length_to_read;
+	file->async_read_flow_controlled = flow_controlled;
+	file->async_read_credits = window;
+	file->async_read_paused = false;
 
 	// reading the whole file and generating the callbacks here could block the
 	// event loop too long. instead poll a readable eventfd for readability.
@@ -1192,45 +1997,105 @@ PacketE file_read_async(File *file, uint64_t length_to_read) {
 	// loop again
 	if (event_add_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC,
 	                     EVENT_READ, file_handle_async_read, file) < 0) {
-		// FIXME: this callback should be delivered after the response of this function
+		file->async_read_in_progress = false;
+		file->length_to_read_async = 0;
+		file->async_read_flow_controlled = false;
+		file->async_read_credits = 0;
+
 		file_send_async_read_callback(file, API_E_INTERNAL_ERROR, NULL, 0);
 
 		return PACKET_E_UNKNOWN_ERROR;
 	}
 
-	log_debug("Started reading of %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously",
-	          length_to_read, file_expand_signature(file));
+	file_start_async_read_buffer(file);
+
+	if (flow_controlled) {
+		log_debug("Started reading of %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously with a window of %u chunk(s)",
+		          length_to_read, file_expand_signature(file), window);
+	} else {
+		log_debug("Started reading of %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously",
+		          length_to_read, file_expand_signature(file));
+	}
 
 	return PACKET_E_SUCCESS;
 }
 
+// public API
+PacketE file_read_async(File *file, uint64_t length_to_read) {
+	return file_start_async_read(file, length_to_read, false, 0);
+}
+
+// public API
+PacketE file_read_async_windowed(File *file, uint64_t length_to_read, uint16_t window) {
+	return file_start_async_read(file, length_to_read, true, window);
+}
+
+// public API
+APIE file_grant_async_read_credits(File *file, uint16_t credits) {
+	if (!file->async_read_in_progress || !file->async_read_flow_controlled) {
+		log_warn("Cannot grant credits for file object ("FILE_SIGNATURE_FORMAT") without a windowed asynchronous read in progress",
+		         file_expand_signature(file));
+
+		return API_E_INVALID_OPERATION;
+	}
+
+	if (file->async_read_credits + credits > UINT16_MAX) {
+		log_warn("Granting %u credit(s) for file object ("FILE_SIGNATURE_FORMAT") exceeds maximum window of %u chunk(s)",
+		         credits, file_expand_signature(file), UINT16_MAX);
+
+		return API_E_OUT_OF_RANGE;
+	}
+
+	file->async_read_credits += credits;
+
+	// a read paused by congestion is resumed by file_resume_async_reads
+	if (file->async_read_credits > 0 &&
+	    file->async_read_congestion_node.next == &file->async_read_congestion_node) {
+		file_resume_async_read(file);
+	}
+
+	return API_E_SUCCESS;
+}
+
 // public API
 APIE file_abort_async_read(File *file) {
 	if (file->async_read_in_progress) {
-		event_remove_source(file->async_read_eventfd, EVENT_SOURCE_TYPE_GENERIC);
-
-		file->async_read_in_progress = false;
-		file->length_to_read_async = 0;
+		file_stop_async_read(file);
 
-		// FIXME: this callback should be delivered after the response of this function
 		file_send_async_read_callback(file, API_E_OPERATION_ABORTED, NULL, 0);
 	}
 
 	return API_E_SUCCESS;
 }
 
-// public API
-APIE file_write(File *file, uint8_t *buffer, uint8_t length_to_write,
-                uint8_t *length_written) {
-	int rc;
-	APIE error_code;
+// resumes the asynchronous reads that got paused because of congestion and
+// whose subscribed connections are not congested anymore, unless they are
+// still waiting for credits
+void file_resume_async_reads(void) {
+	Node *node = _congested_async_reads.next;
+	File *file;
 
-	if (length_to_write > FILE_MAX_WRITE_BUFFER_LENGTH) {
-		log_warn("Length of %u byte(s) exceeds maximum length of file write buffer",
-		         length_to_write);
+	while (node != &_congested_async_reads) {
+		file = containerof(node, File, async_read_congestion_node);
+		node = node->next;
 
-		return API_E_OUT_OF_RANGE;
+		if (network_is_congested(&file->base, OBJECT_CALLBACK_ASYNC_FILE_READ)) {
+			continue;
+		}
+
+		node_remove(&file->async_read_congestion_node);
+		node_reset(&file->async_read_congestion_node);
+
+		if (!file->async_read_flow_controlled || file->async_read_credits > 0) {
+			file_resume_async_read(file);
+		}
 	}
+}
+
+static APIE file_write_buffer(File *file, uint8_t *buffer, uint32_t length_to_write,
+                              int *length_written) {
+	int rc;
+	APIE error_code;
 
 	if (file->async_read_in_progress) {
 		log_warn("Cannot write %u byte(s) while reading %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously",
@@ -1261,6 +2126,50 @@ APIE file_write(File *file, uint8_t *buffer, uint8_t length_to_write,
 	return API_E_SUCCESS;
 }
 
+// public API
+APIE file_write(File *file, uint8_t *buffer, uint8_t length_to_write,
+                uint8_t *length_written) {
+	int rc;
+	APIE error_code;
+
+	if (length_to_write > FILE_MAX_WRITE_BUFFER_LENGTH) {
+		log_warn("Length of %u byte(s) exceeds maximum length of file write buffer",
+		         length_to_write);
+
+		return API_E_OUT_OF_RANGE;
+	}
+
+	error_code = file_write_buffer(file, buffer, length_to_write, &rc);
+
+	if (error_code == API_E_SUCCESS) {
+		*length_written = rc;
+	}
+
+	return error_code;
+}
+
+// public API
+APIE file_write_large(File *file, uint8_t *buffer, uint32_t length_to_write,
+                      uint32_t *length_written) {
+	int rc;
+	APIE error_code;
+
+	if (length_to_write > FILE_MAX_LARGE_BUFFER_LENGTH) {
+		log_warn("Length of %u byte(s) exceeds maximum length of large file write buffer",
+		         length_to_write);
+
+		return API_E_OUT_OF_RANGE;
+	}
+
+	error_code = file_write_buffer(file, buffer, length_to_write, &rc);
+
+	if (error_code == API_E_SUCCESS) {
+		*length_written = rc;
+	}
+
+	return error_code;
+}
+
 // public API
 PacketE file_write_unchecked(File *file, uint8_t *buffer, uint8_t length_to_write) {
 	if (length_to_write > FILE_MAX_WRITE_UNCHECKED_BUFFER_LENGTH) {
@@ -1277,6 +2186,14 @@ PacketE file_write_unchecked(File *file, uint8_t *buffer, uint8_t length_to_writ
 		return PACKET_E_UNKNOWN_ERROR;
 	}
 
+	if (file_use_write_behind(file, length_to_write)) {
+		if (file_write_behind(file, buffer, length_to_write, false) != API_E_SUCCESS) {
+			return PACKET_E_UNKNOWN_ERROR;
+		}
+
+		return PACKET_E_SUCCESS;
+	}
+
 	if (file->write(file, buffer, length_to_write) < 0) { // FIXME: handle EINTR
 		if (errno_would_block()) {
 			log_debug("Writing %u byte(s) unchecked to file object ("FILE_SIGNATURE_FORMAT") would block",
@@ -1302,7 +2219,6 @@ PacketE file_write_async(File *file, uint8_t *buffer, uint8_t length_to_write) {
 		log_warn("Length of %u byte(s) exceeds maximum length of file async write buffer",
 		         length_to_write);
 
-		// FIXME: this callback should be delivered after the response of this function
 		file_send_async_write_callback(file, API_E_OUT_OF_RANGE, 0);
 
 		return PACKET_E_INVALID_PARAMETER;
@@ -1312,12 +2228,30 @@ PacketE file_write_async(File *file, uint8_t *buffer, uint8_t length_to_write) {
 		log_warn("Cannot write %u byte(s) asynchronously while reading %"PRIu64" byte(s) from file object ("FILE_SIGNATURE_FORMAT") asynchronously",
 		         length_to_write, file->length_to_read_async, file_expand_signature(file));
 
-		// FIXME: this callback should be delivered after the response of this function
 		file_send_async_write_callback(file, API_E_INVALID_OPERATION, 0);
 
 		return PACKET_E_UNKNOWN_ERROR;
 	}
 
+	if (file_use_write_behind(file, length_to_write)) {
+		// an error writing buffered data from unchecked writes is reported
+		// instead of doing this write
+		if (file->write_behind_error != API_E_SUCCESS) {
+			error_code = file->write_behind_error;
+			file->write_behind_error = API_E_SUCCESS;
+		} else {
+			error_code = file_write_behind(file, buffer, length_to_write, true);
+		}
+
+		if (error_code != API_E_SUCCESS) {
+			file_send_async_write_callback(file, error_code, 0);
+
+			return PACKET_E_UNKNOWN_ERROR;
+		}
+
+		return PACKET_E_SUCCESS;
+	}
+
 	length_written = file->write(file, buffer, length_to_write); // FIXME: handle EINTR
 
 	if (length_written < 0) {
@@ -1332,13 +2266,11 @@ PacketE file_write_async(File *file, uint8_t *buffer, uint8_t length_to_write) {
 			          get_errno_name(errno), errno);
 		}
 
-		// FIXME: this callback should be delivered after the response of this function
 		file_send_async_write_callback(file, error_code, 0);
 
 		return PACKET_E_UNKNOWN_ERROR;
 	}
 
-	// FIXME: this callback should be delivered after the response of this function
 	file_send_async_write_callback(file, API_E_SUCCESS, length_written);
 
 	return PACKET_E_SUCCESS;
@@ -1391,6 +2323,13 @@ APIE file_get_position(File *file, uint64_t *position) {
 	off_t rc;
 	APIE error_code;
 
+	// the actual file position is updated when the io_uring read stops
+	if (file->async_read_buffer != NULL) {
+		*position = file->async_read_position;
+
+		return API_E_SUCCESS;
+	}
+
 	rc = file->seek(file, 0, SEEK_CUR);
 
 	if (rc == (off_t)-1) {
@@ -1458,6 +2397,21 @@ APIE file_get_events(File *file, uint16_t *events) {
 	return API_E_SUCCESS;
 }
 
+// writes buffered data and moves the file position to the position of the
+// reader, before the file descriptor is shared with a child process
+void file_synchronize(File *file) {
+	if (file->type == FILE_TYPE_PIPE) {
+		return;
+	}
+
+	file_flush_write_behind(file);
+
+	if (file_discard_read_ahead(file) < 0) {
+		log_error("Could not discard read-ahead buffer of file object ("FILE_SIGNATURE_FORMAT"): %s (%d)",
+		          file_expand_signature(file), get_errno_name(errno), errno);
+	}
+}
+
 IOHandle file_get_read_handle(File *file) {
 	if (file->type == FILE_TYPE_PIPE) {
 		return file->pipe.read_end;
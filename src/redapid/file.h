@@ -31,6 +31,7 @@
 
 #include "object.h"
 #include "string.h"
+#include "uring.h"
 
 typedef enum { // bitmask
 	FILE_FLAG_READ_ONLY    = 0x0001,
@@ -118,6 +119,9 @@ typedef enum {
 #define FILE_MAX_WRITE_BUFFER_LENGTH 61
 #define FILE_MAX_WRITE_UNCHECKED_BUFFER_LENGTH 61
 #define FILE_MAX_WRITE_ASYNC_BUFFER_LENGTH 61
+#define FILE_MAX_LARGE_BUFFER_LENGTH 65520 // fits into a local client packet
+#define FILE_ASYNC_READ_URING_BUFFER_LENGTH 16384
+#define FILE_MAX_WRITE_BEHIND_ASYNC_WRITES 64
 
 typedef struct _File File;
 
@@ -139,34 +143,88 @@ struct _File {
 	Pipe async_read_pipe; // only created if type == FILE_TYPE_REGULAR
 	bool async_read_in_progress;
 	uint64_t length_to_read_async;
+	bool async_read_flow_controlled; // only send a callback per granted credit
+	uint32_t async_read_credits;
+	bool async_read_paused; // EVENT_READ removed from async_read_eventfd
+	Node async_read_congestion_node; // linked while paused by congestion
+	uint8_t *async_read_buffer; // only allocated while reading through io_uring
+	int async_read_buffer_used;
+	int async_read_buffer_offset;
+	int async_read_error; // errno value of the last failed io_uring read
+	uint64_t async_read_position; // file position of the next byte to deliver
+	URingRequest *async_read_request; // io_uring read in flight, if any
+	uint8_t *read_ahead_buffer; // only allocated if type == FILE_TYPE_REGULAR
+	int read_ahead_allocated;
+	int read_ahead_length; // length of the last refill, grows with each refill
+	int read_ahead_used;
+	int read_ahead_offset;
+	uint32_t read_ahead_hits;
+	uint32_t read_ahead_misses;
+	uint8_t *write_behind_buffer; // only allocated if type == FILE_TYPE_REGULAR
+	int write_behind_allocated;
+	int write_behind_used;
+	int write_behind_async_offsets[FILE_MAX_WRITE_BEHIND_ASYNC_WRITES]; // buffered async writes
+	uint8_t write_behind_async_lengths[FILE_MAX_WRITE_BEHIND_ASYNC_WRITES];
+	int write_behind_async_count;
+	APIE write_behind_error; // reported by the next async write
+	Node write_behind_node; // linked while the write-behind buffer is not empty
+	uint64_t write_behind_deadline; // in microseconds, the buffer is written then
 	FileWriteFunction read;
 	FileWriteFunction write;
 	FileSeekFunction seek;
 };
 
+typedef struct {
+	uint8_t type;
+	ObjectID name_id;
+	uint32_t flags;
+	uint16_t permissions;
+	uint32_t uid;
+	uint32_t gid;
+	uint64_t length;
+	uint64_t access_timestamp;
+	uint64_t modification_timestamp;
+	uint64_t status_change_timestamp;
+} FileInfo;
+
+typedef void (*FileOpenedFunction)(APIE error_code, ObjectID file_id, void *opaque);
+typedef void (*FileInfoFunction)(APIE error_code, FileInfo *info, void *opaque);
+
+int file_init(void);
+void file_exit(void);
+void file_log_statistics(void);
+
 mode_t file_get_mode_from_permissions(uint16_t permissions);
 
 APIE file_open(ObjectID name_id, uint32_t flags, uint16_t permissions,
                uint32_t uid, uint32_t gid, Session *session,
                uint16_t object_create_flags, ObjectID *id, File **object);
+APIE file_open_deferred(ObjectID name_id, uint32_t flags, uint16_t permissions,
+                        uint32_t uid, uint32_t gid, Session *session,
+                        uint16_t object_create_flags, FileOpenedFunction opened,
+                        void *opaque);
 
 APIE pipe_create_(uint32_t flags, uint64_t length, Session *session,
                   uint16_t object_create_flags, ObjectID *id, File **object);
 
-APIE file_get_info(File *file, Session *session, uint8_t *type,
-                   ObjectID *name_id, uint32_t *flags,
-                   uint16_t *permissions, uint32_t *uid, uint32_t *gid,
-                   uint64_t *length, uint64_t *access_timestamp,
-                   uint64_t *modification_timestamp,
-                   uint64_t *status_change_timestamp);
+APIE file_get_info(File *file, Session *session, FileInfo *info);
+APIE file_get_info_deferred(File *file, Session *session,
+                            FileInfoFunction done, void *opaque);
 
 APIE file_read(File *file, uint8_t *buffer, uint8_t length_to_read,
                uint8_t *length_read);
+APIE file_read_large(File *file, uint8_t *buffer, uint32_t length_to_read,
+                     uint32_t *length_read);
 PacketE file_read_async(File *file, uint64_t length_to_read);
+PacketE file_read_async_windowed(File *file, uint64_t length_to_read, uint16_t window);
+APIE file_grant_async_read_credits(File *file, uint16_t credits);
+void file_resume_async_reads(void);
 APIE file_abort_async_read(File *file);
 
 APIE file_write(File *file, uint8_t *buffer, uint8_t length_to_write,
                 uint8_t *length_written);
+APIE file_write_large(File *file, uint8_t *buffer, uint32_t length_to_write,
+                      uint32_t *length_written);
 PacketE file_write_unchecked(File *file, uint8_t *buffer, uint8_t length_to_write);
 PacketE file_write_async(File *file, uint8_t *buffer, uint8_t length_to_write);
 
@@ -177,6 +235,8 @@ APIE file_get_position(File *file, uint64_t *position);
 APIE file_set_events(File *file, uint16_t events);
 APIE file_get_events(File *file, uint16_t *events);
 
+void file_synchronize(File *file);
+
 IOHandle file_get_read_handle(File *file);
 IOHandle file_get_write_handle(File *file);
 
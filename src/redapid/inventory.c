@@ -40,8 +40,8 @@
 #include <pwd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
-#include <daemonlib/array.h>
 #include <daemonlib/log.h>
 #include <daemonlib/utils.h>
 
@@ -53,108 +53,179 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+// one bit per ID of a 16 bit ID number space (8 KiB). a set bit marks the
+// corresponding ID as in use. ID zero is marked as in use permanently, so it
+// is never handed out
+typedef struct {
+	uint32_t words[(UINT16_MAX + 1) / 32];
+	uint32_t next; // next ID to try, wraps around from 0xFFFF to 1
+	int used; // includes ID zero
+} IDBitmap;
+
+// stock strings are interned in an open addressing hash table with linear
+// probing. the hash of each string is stored next to it, so probing and
+// growing the table only compare the string content on a hash match
+typedef struct {
+	uint32_t hash;
+	String *string; // NULL marks an empty entry
+} StockStringEntry;
+
+#define STOCK_STRING_INITIAL_CAPACITY 64 // has to be a power of two
+
 static char _programs_directory[1024]; // <home>/programs
-static SessionID _next_session_id = 1; // don't use session ID zero
-static Array _sessions;
-static ObjectID _next_object_id = 1; // don't use object ID zero
-static Array _objects[OBJECT_TYPE_PROGRAM - OBJECT_TYPE_STRING + 1];
-static Array _stock_strings;
+static IDBitmap _session_ids;
+static Session *_session_table[SESSION_ID_MAX + 1]; // indexed by session ID
+static IDBitmap _object_ids;
+static Object *_object_table[OBJECT_ID_MAX + 1]; // indexed by object ID
+static Node _object_sentinels[OBJECT_TYPE_PROGRAM - OBJECT_TYPE_STRING + 1];
+static int _object_counts[OBJECT_TYPE_PROGRAM - OBJECT_TYPE_STRING + 1];
+static StockStringEntry *_stock_strings;
+static int _stock_string_capacity; // always a power of two
+static int _stock_string_count;
+static uint32_t _stock_string_hits;
+static uint32_t _stock_string_misses;
+
+// unlink all objects of the given type one by one before destroying them. an
+// object destroy function might remove other objects of the same type from the
+// inventory, this is safe because the list is not walked while destroying
+static void inventory_destroy_objects(ObjectType type) {
+	Object *object;
 
-static void inventory_destroy_session(void *item) {
-	Session *session = *(Session **)item;
+	while (_object_sentinels[type].next != &_object_sentinels[type]) {
+		object = containerof(_object_sentinels[type].next, Object, inventory_node);
 
-	session_destroy(session);
+		node_remove(&object->inventory_node);
+		--_object_counts[type];
+
+		_object_table[object->id] = NULL;
+
+		object_destroy(object);
+	}
 }
 
-static void inventory_destroy_object(void *item) {
-	Object *object = *(Object **)item;
+// 32 bit FNV-1a
+static uint32_t inventory_hash_stock_string(const char *buffer) {
+	uint32_t hash = 2166136261u;
 
-	object_destroy(object);
+	while (*buffer != '\0') {
+		hash ^= (uint8_t)*buffer++;
+		hash *= 16777619u;
+	}
+
+	return hash;
 }
 
-static void inventory_unlock_and_release_string(void *item) {
-	String *string = *(String **)item;
+// returns the matching entry or the empty entry where the string belongs
+static StockStringEntry *inventory_find_stock_string(StockStringEntry *entries,
+                                                     int capacity, uint32_t hash,
+                                                     const char *buffer) {
+	int mask = capacity - 1;
+	int i = hash & mask;
 
-	string_unlock_and_release(string);
+	while (entries[i].string != NULL &&
+	       (entries[i].hash != hash || strcmp(entries[i].string->buffer, buffer) != 0)) {
+		i = (i + 1) & mask;
+	}
+
+	return &entries[i];
 }
 
-static APIE inventory_get_next_session_id(SessionID *id) {
+static int inventory_grow_stock_strings(void) {
+	int capacity = _stock_string_capacity * 2;
+	StockStringEntry *entries;
+	StockStringEntry *entry;
 	int i;
-	SessionID candidate;
-	bool collision;
-	int k;
-	Session *session;
-
-	// FIXME: this is an O(n^2) algorithm
-	for (i = 0; i < SESSION_ID_MAX; ++i) {
-		if (_next_session_id == SESSION_ID_ZERO) {
-			_next_session_id = 1; // don't use object ID zero
-		}
 
-		candidate = _next_session_id++;
-		collision = false;
+	entries = calloc(capacity, sizeof(StockStringEntry));
 
-		for (k = 0; k < _sessions.count; ++k) {
-			session = *(Session **)array_get(&_sessions, k);
+	if (entries == NULL) {
+		errno = ENOMEM;
 
-			if (candidate == session->id) {
-				collision = true;
+		return -1;
+	}
 
-				break;
-			}
+	// all strings in the old table are distinct, so only the first empty
+	// entry along the probe sequence has to be found
+	for (i = 0; i < _stock_string_capacity; ++i) {
+		if (_stock_strings[i].string == NULL) {
+			continue;
 		}
 
-		if (!collision) {
-			*id = candidate;
+		entry = &entries[_stock_strings[i].hash & (capacity - 1)];
 
-			return API_E_SUCCESS;
+		while (entry->string != NULL) {
+			if (++entry == entries + capacity) {
+				entry = entries;
+			}
 		}
+
+		*entry = _stock_strings[i];
 	}
 
-	return API_E_NO_FREE_SESSION_ID;
+	free(_stock_strings);
+
+	_stock_strings = entries;
+	_stock_string_capacity = capacity;
+
+	return 0;
 }
 
-static APIE inventory_get_next_object_id(ObjectID *id) {
-	int i;
-	ObjectID candidate;
-	bool collision;
-	int type;
-	int k;
-	Object *object;
+static void inventory_reset_id_bitmap(IDBitmap *bitmap) {
+	memset(bitmap->words, 0, sizeof(bitmap->words));
 
-	// FIXME: this is an O(n^2) algorithm
-	for (i = 0; i < OBJECT_ID_MAX; ++i) {
-		if (_next_object_id == OBJECT_ID_ZERO) {
-			_next_object_id = 1; // don't use object ID zero
-		}
+	bitmap->words[0] = 1; // don't use ID zero
+	bitmap->next = 1;
+	bitmap->used = 1;
+}
 
-		candidate = _next_object_id++;
-		collision = false;
+// the search continues after the last handed out ID and wraps around, like the
+// former linear scan did. it inspects 32 IDs per step and stops at the first
+// word with a free bit. this makes the cost independent of the number of IDs
+// in use, in the worst case all 2048 words are inspected once
+static bool inventory_acquire_id(IDBitmap *bitmap, uint16_t *id) {
+	int word_count = sizeof(bitmap->words) / sizeof(bitmap->words[0]);
+	uint32_t candidate = bitmap->next;
+	int word_index;
+	uint32_t free_bits;
+	int i;
 
-		for (type = OBJECT_TYPE_STRING; type <= OBJECT_TYPE_PROGRAM; ++type) {
-			for (k = 0; k < _objects[type].count; ++k) {
-				object = *(Object **)array_get(&_objects[type], k);
+	if (bitmap->used > UINT16_MAX) {
+		return false;
+	}
 
-				if (candidate == object->id) {
-					collision = true;
+	// one more step than there are words, because the search might start in
+	// the middle of a word that has only free bits below the start position
+	for (i = 0; i <= word_count; ++i) {
+		word_index = candidate / 32;
+		free_bits = ~bitmap->words[word_index] & (0xFFFFFFFF << (candidate % 32));
 
-					break;
-				}
-			}
+		if (free_bits != 0) {
+			candidate = word_index * 32 + ffs((int)free_bits) - 1;
 
-			if (collision) {
-				break;
-			}
-		}
+			bitmap->words[word_index] |= (uint32_t)1 << (candidate % 32);
+			bitmap->next = candidate < UINT16_MAX ? candidate + 1 : 1;
+			++bitmap->used;
 
-		if (!collision) {
 			*id = candidate;
 
-			return API_E_SUCCESS;
+			return true;
 		}
+
+		candidate = ((word_index + 1) % word_count) * 32;
 	}
 
-	return API_E_NO_FREE_OBJECT_ID;
+	return false;
+}
+
+static void inventory_release_id(IDBitmap *bitmap, uint16_t id) {
+	uint32_t mask = (uint32_t)1 << (id % 32);
+
+	if (id == 0 || (bitmap->words[id / 32] & mask) == 0) {
+		return;
+	}
+
+	bitmap->words[id / 32] &= ~mask;
+	--bitmap->used;
 }
 
 int inventory_init(void) {
@@ -182,65 +253,81 @@ int inventory_init(void) {
 		goto cleanup;
 	}
 
-	// create session array
-	if (array_create(&_sessions, 32, sizeof(Session *), true) < 0) {
-		log_error("Could not create session array: %s (%d)",
-		          get_errno_name(errno), errno);
+	memset(_session_table, 0, sizeof(_session_table));
+	inventory_reset_id_bitmap(&_session_ids);
 
+	if (session_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 1;
 
-	// create object arrays
+	// reset object lists
 	for (type = OBJECT_TYPE_STRING; type <= OBJECT_TYPE_PROGRAM; ++type) {
-		if (array_create(&_objects[type], 32, sizeof(Object *), true) < 0) {
-			log_error("Could not create %s object array: %s (%d)",
-			          object_get_type_name(type), get_errno_name(errno), errno);
+		node_reset(&_object_sentinels[type]);
 
-			goto cleanup;
-		}
-
-		phase = 2;
+		_object_counts[type] = 0;
 	}
 
-	// create stock string array
-	if (array_create(&_stock_strings, 32, sizeof(String *), true) < 0) {
-		log_error("Could not create stock string array: %s (%d)",
-		          get_errno_name(errno), errno);
+	memset(_object_table, 0, sizeof(_object_table));
+	inventory_reset_id_bitmap(&_object_ids);
+
+	// create stock string table
+	_stock_strings = calloc(STOCK_STRING_INITIAL_CAPACITY, sizeof(StockStringEntry));
+
+	if (_stock_strings == NULL) {
+		log_error("Could not create stock string table: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
 
 		goto cleanup;
 	}
 
-	phase = 3;
+	_stock_string_capacity = STOCK_STRING_INITIAL_CAPACITY;
+	_stock_string_count = 0;
+	_stock_string_hits = 0;
+	_stock_string_misses = 0;
+
+	phase = 2;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 2:
-		for (--type; type >= OBJECT_TYPE_STRING; --type) {
-			array_destroy(&_objects[type], inventory_destroy_object);
-		}
-
 	case 1:
-		array_destroy(&_sessions, inventory_destroy_session);
+		session_exit();
 
 	default:
 		break;
 	}
 
-	return phase == 3 ? 0 : -1;
+	return phase == 2 ? 0 : -1;
 }
 
 void inventory_exit(void) {
+	int id;
+	int i;
+
 	log_debug("Shutting down inventory subsystem");
 
 	// destroy all sessions to ensure that all external references are released
 	// before starting to destroy the remaining objects. then all remaining
 	// relations between objects that constrains the destruction order are known
-	array_destroy(&_sessions, inventory_destroy_session);
+	for (id = 1; id <= SESSION_ID_MAX; ++id) {
+		if (_session_table[id] != NULL) {
+			session_destroy(_session_table[id]);
+
+			_session_table[id] = NULL;
+		}
+	}
+
+	session_exit();
 
 	// unlock and release all stock string objects
-	array_destroy(&_stock_strings, inventory_unlock_and_release_string);
+	for (i = 0; i < _stock_string_capacity; ++i) {
+		if (_stock_strings[i].string != NULL) {
+			string_unlock_and_release(_stock_strings[i].string);
+		}
+	}
+
+	free(_stock_strings);
 
 	// object types have to be destroyed in a specific order. if objects of
 	// type A can use (have a reference to) objects of type B then A has to be
@@ -255,12 +342,12 @@ void inventory_exit(void) {
 	// - file uses string
 	// - list can contain any object as item, currently only string is used
 	// - string doesn't use other objects
-	array_destroy(&_objects[OBJECT_TYPE_PROGRAM], inventory_destroy_object);
-	array_destroy(&_objects[OBJECT_TYPE_PROCESS], inventory_destroy_object);
-	array_destroy(&_objects[OBJECT_TYPE_DIRECTORY], inventory_destroy_object);
-	array_destroy(&_objects[OBJECT_TYPE_FILE], inventory_destroy_object);
-	array_destroy(&_objects[OBJECT_TYPE_LIST], inventory_destroy_object);
-	array_destroy(&_objects[OBJECT_TYPE_STRING], inventory_destroy_object);
+	inventory_destroy_objects(OBJECT_TYPE_PROGRAM);
+	inventory_destroy_objects(OBJECT_TYPE_PROCESS);
+	inventory_destroy_objects(OBJECT_TYPE_DIRECTORY);
+	inventory_destroy_objects(OBJECT_TYPE_FILE);
+	inventory_destroy_objects(OBJECT_TYPE_LIST);
+	inventory_destroy_objects(OBJECT_TYPE_STRING);
 }
 
 const char *inventory_get_programs_directory(void) {
@@ -268,21 +355,38 @@ const char *inventory_get_programs_directory(void) {
 }
 
 APIE inventory_get_stock_string(const char *buffer, String **string) {
-	int i;
-	String *candidate;
+	uint32_t hash = inventory_hash_stock_string(buffer);
+	StockStringEntry *entry;
 	APIE error_code;
-	String **string_ptr;
 
-	for (i = 0; i < _stock_strings.count; ++i) {
-		candidate = *(String **)array_get(&_stock_strings, i);
+	entry = inventory_find_stock_string(_stock_strings, _stock_string_capacity,
+	                                    hash, buffer);
+
+	if (entry->string != NULL) {
+		++_stock_string_hits;
+
+		string_acquire_and_lock(entry->string);
+
+		*string = entry->string;
 
-		if (strcmp(candidate->buffer, buffer) == 0) {
-			string_acquire_and_lock(candidate);
+		return API_E_SUCCESS;
+	}
+
+	++_stock_string_misses;
 
-			*string = candidate;
+	// keep the load factor at or below 75%
+	if ((_stock_string_count + 1) * 4 > _stock_string_capacity * 3) {
+		if (inventory_grow_stock_strings() < 0) {
+			error_code = api_get_error_code_from_errno();
+
+			log_error("Could not grow stock string table: %s (%d)",
+			          get_errno_name(errno), errno);
 
-			return API_E_SUCCESS;
+			return error_code;
 		}
+
+		entry = inventory_find_stock_string(_stock_strings, _stock_string_capacity,
+		                                    hash, buffer);
 	}
 
 	error_code = string_wrap(buffer, NULL,
@@ -294,26 +398,21 @@ APIE inventory_get_stock_string(const char *buffer, String **string) {
 		return error_code;
 	}
 
-	string_ptr = array_append(&_stock_strings);
-
-	if (string_ptr == NULL) {
-		error_code = api_get_error_code_from_errno();
-
-		log_error("Could not append to stock string array: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		string_unlock_and_release(*string);
-
-		return error_code;
-	}
+	entry->hash = hash;
+	entry->string = *string;
 
-	*string_ptr = *string;
+	++_stock_string_count;
 
 	string_acquire_and_lock(*string);
 
 	return API_E_SUCCESS;
 }
 
+void inventory_log_statistics(void) {
+	log_info("Stock strings: %d interned, %u hit(s), %u miss(es)",
+	         _stock_string_count, _stock_string_hits, _stock_string_misses);
+}
+
 int inventory_load_programs(void) {
 	bool success = false;
 	DIR *dp;
@@ -399,43 +498,29 @@ cleanup:
 }
 
 void inventory_unload_programs(void) {
-	int i;
+	Node *sentinel = &_object_sentinels[OBJECT_TYPE_PROGRAM];
+	Node *node = sentinel->next;
 	Object *program;
 
 	// object_remove_internal_reference can remove program objects from the
-	// objects array if it removed the last reference. iterate backwards so
-	// the remaining part of the indices is not affected by this
-	for (i = _objects[OBJECT_TYPE_PROGRAM].count - 1; i >= 0; --i) {
-		program = *(Object **)array_get(&_objects[OBJECT_TYPE_PROGRAM], i);
+	// program list if it removed the last reference. get the next node before
+	// calling it, so the iteration is not affected by this
+	while (node != sentinel) {
+		program = containerof(node, Object, inventory_node);
+		node = node->next;
 
 		object_remove_internal_reference(program);
 	}
 }
 
 APIE inventory_add_session(Session *session) {
-	Session **session_ptr;
-	APIE error_code;
-
-	error_code = inventory_get_next_session_id(&session->id);
-
-	if (error_code != API_E_SUCCESS) {
+	if (!inventory_acquire_id(&_session_ids, &session->id)) {
 		log_warn("Cannot add new session, all session IDs are in use");
 
-		return error_code;
+		return API_E_NO_FREE_SESSION_ID;
 	}
 
-	session_ptr = array_append(&_sessions);
-
-	if (session_ptr == NULL) {
-		error_code = api_get_error_code_from_errno();
-
-		log_error("Could not append to session array: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		return error_code;
-	}
-
-	*session_ptr = session;
+	_session_table[session->id] = session;
 
 	log_object_debug("Added session (id: %u)", session->id);
 
@@ -443,38 +528,32 @@ APIE inventory_add_session(Session *session) {
 }
 
 void inventory_remove_session(Session *session) {
-	int i;
-	Session *candidate;
+	SessionID id = session->id;
 
-	for (i = 0; i < _sessions.count; ++i) {
-		candidate = *(Session **)array_get(&_sessions, i);
+	if (_session_table[id] != session) {
+		log_error("Could not find session (id: %u) to remove it", id);
 
-		if (candidate != session) {
-			continue;
-		}
+		return;
+	}
 
-		log_object_debug("Removing session (id: %u)", session->id);
+	log_object_debug("Removing session (id: %u)", id);
 
-		array_remove(&_sessions, i, inventory_destroy_session);
+	_session_table[id] = NULL;
 
-		return;
-	}
+	session_destroy(session);
 
-	log_error("Could not find session (id: %u) to remove it", session->id);
+	// release the ID after the session got destroyed, so it cannot be handed
+	// out again while the session is still being torn down
+	inventory_release_id(&_session_ids, id);
 }
 
 APIE inventory_get_session(SessionID id, Session **session) {
-	int i;
-	Session *candidate;
+	Session *candidate = _session_table[id]; // is NULL for session ID zero
 
-	for (i = 0; i < _sessions.count; ++i) {
-		candidate = *(Session **)array_get(&_sessions, i);
+	if (candidate != NULL) {
+		*session = candidate;
 
-		if (candidate->id == id) {
-			*session = candidate;
-
-			return API_E_SUCCESS;
-		}
+		return API_E_SUCCESS;
 	}
 
 	log_warn("Could not find session (id: %u)", id);
@@ -483,31 +562,17 @@ APIE inventory_get_session(SessionID id, Session **session) {
 }
 
 APIE inventory_add_object(Object *object) {
-	Object **object_ptr;
-	APIE error_code;
-
-	error_code = inventory_get_next_object_id(&object->id);
-
-	if (error_code != API_E_SUCCESS) {
+	if (!inventory_acquire_id(&_object_ids, &object->id)) {
 		log_warn("Cannot add new %s object, all object IDs are in use",
 		         object_get_type_name(object->type));
 
-		return error_code;
+		return API_E_NO_FREE_OBJECT_ID;
 	}
 
-	object_ptr = array_append(&_objects[object->type]);
+	_object_table[object->id] = object;
 
-	if (object_ptr == NULL) {
-		error_code = api_get_error_code_from_errno();
-
-		log_error("Could not append to %s object array: %s (%d)",
-		          object_get_type_name(object->type),
-		          get_errno_name(errno), errno);
-
-		return error_code;
-	}
-
-	*object_ptr = object;
+	node_insert_before(&_object_sentinels[object->type], &object->inventory_node);
+	++_object_counts[object->type];
 
 	log_object_debug("Added %s object (id: %u)",
 	                 object_get_type_name(object->type), object->id);
@@ -516,53 +581,37 @@ APIE inventory_add_object(Object *object) {
 }
 
 void inventory_remove_object(Object *object) {
-	int i;
-	Object *candidate;
+	ObjectID id = object->id;
 
-	for (i = 0; i < _objects[object->type].count; ++i) {
-		candidate = *(Object **)array_get(&_objects[object->type], i);
+	if (_object_table[id] != object) {
+		log_error("Could not find %s object (id: %u) to remove it",
+		          object_get_type_name(object->type), id);
 
-		if (candidate != object) {
-			continue;
-		}
+		return;
+	}
 
-		log_object_debug("Removing %s object (id: %u)",
-		                 object_get_type_name(object->type), object->id);
+	log_object_debug("Removing %s object (id: %u)",
+	                 object_get_type_name(object->type), id);
 
-		array_remove(&_objects[object->type], i, inventory_destroy_object);
+	_object_table[id] = NULL;
 
-		return;
-	}
+	node_remove(&object->inventory_node);
+	--_object_counts[object->type];
+
+	object_destroy(object);
 
-	log_error("Could not find %s object (id: %u) to remove it",
-	          object_get_type_name(object->type), object->id);
+	// release the ID after the object got destroyed, so it cannot be handed
+	// out again while the object is still being torn down
+	inventory_release_id(&_object_ids, id);
 }
 
 APIE inventory_get_object(ObjectType type, ObjectID id, Object **object) {
-	ObjectType start_type;
-	ObjectType end_type;
-	ObjectType t;
-	int i;
-	Object *candidate;
-
-	if (type == OBJECT_TYPE_ANY) {
-		start_type = OBJECT_TYPE_STRING;
-		end_type = OBJECT_TYPE_PROGRAM;
-	} else {
-		start_type = type;
-		end_type = type;
-	}
+	Object *candidate = _object_table[id]; // is NULL for object ID zero
 
-	for (t = start_type; t <= end_type; ++t) {
-		for (i = 0; i < _objects[t].count; ++i) {
-			candidate = *(Object **)array_get(&_objects[t], i);
+	if (candidate != NULL && (type == OBJECT_TYPE_ANY || candidate->type == type)) {
+		*object = candidate;
 
-			if (candidate->id == id) {
-				*object = candidate;
-
-				return API_E_SUCCESS;
-			}
-		}
+		return API_E_SUCCESS;
 	}
 
 	if (type == OBJECT_TYPE_ANY) {
@@ -576,11 +625,14 @@ APIE inventory_get_object(ObjectType type, ObjectID id, Object **object) {
 
 void inventory_for_each_object(ObjectType type, InventoryForEachObjectFunction function,
                                void *opaque) {
-	int i;
+	Node *node = _object_sentinels[type].next;
 	Object *object;
 
-	for (i = 0; i < _objects[type].count; ++i) {
-		object = *(Object **)array_get(&_objects[type], i);
+	// get the next node before calling the function, so the function can
+	// remove the current object from the inventory
+	while (node != &_object_sentinels[type]) {
+		object = containerof(node, Object, inventory_node);
+		node = node->next;
 
 		function(object, opaque);
 	}
@@ -590,10 +642,10 @@ void inventory_for_each_object(ObjectType type, InventoryForEachObjectFunction f
 APIE inventory_get_processes(Session *session, ObjectID *processes_id) {
 	List *processes;
 	APIE error_code;
-	int i;
+	Node *node;
 	Process *process;
 
-	error_code = list_allocate(_objects[OBJECT_TYPE_PROCESS].count,
+	error_code = list_allocate(_object_counts[OBJECT_TYPE_PROCESS],
 	                           session, OBJECT_CREATE_FLAG_EXTERNAL,
 	                           NULL, &processes);
 
@@ -601,8 +653,9 @@ APIE inventory_get_processes(Session *session, ObjectID *processes_id) {
 		return error_code;
 	}
 
-	for (i = 0; i < _objects[OBJECT_TYPE_PROCESS].count; ++i) {
-		process = *(Process **)array_get(&_objects[OBJECT_TYPE_PROCESS], i);
+	for (node = _object_sentinels[OBJECT_TYPE_PROCESS].next;
+	     node != &_object_sentinels[OBJECT_TYPE_PROCESS]; node = node->next) {
+		process = containerof(node, Process, base.inventory_node);
 		error_code = list_append_to(processes, process->base.id);
 
 		if (error_code != API_E_SUCCESS) {
@@ -621,10 +674,10 @@ APIE inventory_get_processes(Session *session, ObjectID *processes_id) {
 APIE inventory_get_programs(Session *session, ObjectID *programs_id) {
 	List *programs;
 	APIE error_code;
-	int i;
+	Node *node;
 	Program *program;
 
-	error_code = list_allocate(_objects[OBJECT_TYPE_PROCESS].count,
+	error_code = list_allocate(_object_counts[OBJECT_TYPE_PROGRAM],
 	                           session, OBJECT_CREATE_FLAG_EXTERNAL,
 	                           NULL, &programs);
 
@@ -632,8 +685,9 @@ APIE inventory_get_programs(Session *session, ObjectID *programs_id) {
 		return error_code;
 	}
 
-	for (i = 0; i < _objects[OBJECT_TYPE_PROGRAM].count; ++i) {
-		program = *(Program **)array_get(&_objects[OBJECT_TYPE_PROGRAM], i);
+	for (node = _object_sentinels[OBJECT_TYPE_PROGRAM].next;
+	     node != &_object_sentinels[OBJECT_TYPE_PROGRAM]; node = node->next) {
+		program = containerof(node, Program, base.inventory_node);
 
 		if (program->base.internal_reference_count == 0) {
 			// ignore program object that are only alive because there are
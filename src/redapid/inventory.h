@@ -34,6 +34,7 @@ void inventory_exit(void);
 const char *inventory_get_programs_directory(void);
 
 APIE inventory_get_stock_string(const char *buffer, String **string);
+void inventory_log_statistics(void);
 
 int inventory_load_programs(void);
 void inventory_unload_programs(void);
@@ -20,7 +20,6 @@
  */
 
 #include <errno.h>
-#include <stdlib.h>
 #include <string.h>
 
 #include <daemonlib/log.h>
@@ -30,8 +29,10 @@
 
 #include "api.h"
 #include "inventory.h"
+#include "pool.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+static Pool _list_pool = POOL_INITIALIZER("list", List, 32);
 
 static void list_unlock_and_release_item(void *item) {
 	Object *object = *(Object **)item;
@@ -45,7 +46,7 @@ static void list_destroy(Object *object) {
 
 	array_destroy(&list->items, list_unlock_and_release_item);
 
-	free(list);
+	pool_free(&_list_pool, list);
 }
 
 static void list_signature(Object *object, char *signature) {
@@ -63,7 +64,7 @@ APIE list_allocate(uint16_t reserve, Session *session,
 	List *list;
 
 	// allocate list object
-	list = calloc(1, sizeof(List));
+	list = pool_allocate(&_list_pool);
 
 	if (list == NULL) {
 		error_code = API_E_NO_FREE_MEMORY;
@@ -111,7 +112,7 @@ cleanup:
 		array_destroy(&list->items, list_unlock_and_release_item);
 
 	case 1:
-		free(list);
+		pool_free(&_list_pool, list);
 
 	default:
 		break;
@@ -0,0 +1,409 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * local_client.c: Local client specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * local clients are programs running on the RED Brick itself that connect to
+ * redapid directly, instead of going through brickd. they use the same API,
+ * but each packet is prefixed by a LocalFrameHeader. this allows for packets
+ * up to 64 KiB, used by the local-only functions such as read-file-large.
+ *
+ * a local client that doesn't read its responses cannot make redapid buffer
+ * an unbounded amount of data. if the send buffer cannot take another maximum
+ * size frame then no further requests are handled until it drained. like for
+ * brickd, asynchronous producers pause while the send buffer is filled above
+ * its high-water mark, so callback streams are not cut short by a slow reader.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "local_client.h"
+
+#include "api.h"
+#include "network.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static void local_client_handle_read(void *opaque);
+static void local_client_handle_write(void *opaque);
+
+static bool local_client_has_send_room(LocalClient *client) {
+	return LOCAL_SEND_BUFFER_LENGTH - client->send_buffer_used >= LOCAL_MAX_FRAME_LENGTH;
+}
+
+static void local_client_set_read_paused(LocalClient *client, bool paused) {
+	if (client->read_paused == paused) {
+		return;
+	}
+
+	if (paused) {
+		if (event_modify_source(client->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                        EVENT_READ, 0, NULL, NULL) < 0) {
+			return;
+		}
+	} else {
+		if (event_modify_source(client->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                        0, EVENT_READ, local_client_handle_read, client) < 0) {
+			log_error("Could not resume receiving from local client (handle: %d), disconnecting it",
+			          client->socket->base.handle);
+
+			client->disconnected = true;
+
+			return;
+		}
+	}
+
+	client->read_paused = paused;
+}
+
+static void local_client_set_write_pending(LocalClient *client, bool pending) {
+	if (client->write_pending == pending) {
+		return;
+	}
+
+	if (pending) {
+		if (event_modify_source(client->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                        0, EVENT_WRITE, local_client_handle_write, client) < 0) {
+			log_error("Could not wait for local client (handle: %d) to become writable, disconnecting it",
+			          client->socket->base.handle);
+
+			client->disconnected = true;
+
+			return;
+		}
+	} else {
+		event_modify_source(client->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                    EVENT_WRITE, 0, NULL, NULL);
+	}
+
+	client->write_pending = pending;
+}
+
+// like packet_header_is_valid_request, but the length field is not checked.
+// it is zero for the local-only functions, the frame gives the actual length
+static bool local_client_is_valid_request(PacketHeader *header, const char **message) {
+	if (header->function_id == 0) {
+		*message = "Invalid function ID";
+
+		return false;
+	}
+
+	// sequence number 0 is reserved for callbacks
+	if (packet_header_get_sequence_number(header) == 0) {
+		*message = "Invalid sequence number";
+
+		return false;
+	}
+
+	return true;
+}
+
+// dispatches all complete requests in the receive buffer and moves the
+// remaining partial request to the front
+static void local_client_dispatch_requests(LocalClient *client) {
+	int offset = 0;
+	LocalFrameHeader *frame_header;
+	uint32_t length;
+	Packet *request;
+	const char *message = NULL;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	while (!client->disconnected &&
+	       client->receive_buffer_used - offset >= (int)sizeof(LocalFrameHeader)) {
+		frame_header = (LocalFrameHeader *)(client->receive_buffer + offset);
+		length = uint32_from_le(frame_header->length);
+
+		if (length < sizeof(PacketHeader) || length > LOCAL_MAX_PACKET_LENGTH) {
+			log_error("Received frame with invalid length %u from local client (handle: %d), disconnecting it",
+			          length, client->socket->base.handle);
+
+			client->disconnected = true;
+
+			return;
+		}
+
+		if (client->receive_buffer_used - offset < (int)(sizeof(LocalFrameHeader) + length)) {
+			// wait for complete frame
+			break;
+		}
+
+		// the response to this request might be a maximum size frame
+		if (!local_client_has_send_room(client)) {
+			local_client_set_read_paused(client, true);
+
+			break;
+		}
+
+		request = (Packet *)(client->receive_buffer + offset + sizeof(LocalFrameHeader));
+
+		if (!local_client_is_valid_request(&request->header, &message)) {
+			log_warn("Received invalid request (%s) from local client (handle: %d), dropping request: %s",
+			         packet_get_request_signature(packet_signature, request),
+			         client->socket->base.handle, message);
+		} else if (request->header.uid != api_get_uid()) {
+			log_debug("Received unknown request (%s) from local client (handle: %d) with mismatching UID, dropping request",
+			          packet_get_request_signature(packet_signature, request),
+			          client->socket->base.handle);
+		} else {
+			network_handle_local_request(client, request, length);
+		}
+
+		offset += sizeof(LocalFrameHeader) + length;
+
+		++client->received_requests;
+	}
+
+	if (offset > 0) {
+		memmove(client->receive_buffer, client->receive_buffer + offset,
+		        client->receive_buffer_used - offset);
+
+		client->receive_buffer_used -= offset;
+	}
+}
+
+static void local_client_handle_read(void *opaque) {
+	LocalClient *client = opaque;
+	int length;
+
+	length = socket_receive(client->socket, client->receive_buffer + client->receive_buffer_used,
+	                        LOCAL_RECEIVE_BUFFER_LENGTH - client->receive_buffer_used);
+
+	if (length == 0) {
+		log_debug("Local client (handle: %d) disconnected by peer",
+		          client->socket->base.handle);
+
+		client->disconnected = true;
+
+		return;
+	}
+
+	if (length < 0) {
+		if (length == IO_CONTINUE) {
+			// no actual data received
+		} else if (errno_interrupted()) {
+			log_debug("Receiving from local client (handle: %d) was interrupted, retrying",
+			          client->socket->base.handle);
+		} else if (errno_would_block()) {
+			log_debug("Receiving from local client (handle: %d) would block, retrying",
+			          client->socket->base.handle);
+		} else {
+			log_error("Could not receive from local client (handle: %d), disconnecting it: %s (%d)",
+			          client->socket->base.handle, get_errno_name(errno), errno);
+
+			client->disconnected = true;
+		}
+
+		return;
+	}
+
+	client->receive_buffer_used += length;
+
+	local_client_dispatch_requests(client);
+}
+
+static void local_client_flush(LocalClient *client) {
+	int length;
+
+	if (client->disconnected || client->send_buffer_used == 0) {
+		return;
+	}
+
+	length = socket_send(client->socket, client->send_buffer, client->send_buffer_used);
+
+	if (length < 0) {
+		if (length == IO_CONTINUE || errno_interrupted() || errno_would_block()) {
+			local_client_set_write_pending(client, true);
+		} else {
+			log_error("Could not send to local client (handle: %d), disconnecting it: %s (%d)",
+			          client->socket->base.handle, get_errno_name(errno), errno);
+
+			client->disconnected = true;
+		}
+
+		return;
+	}
+
+	if (length < client->send_buffer_used) {
+		memmove(client->send_buffer, client->send_buffer + length,
+		        client->send_buffer_used - length);
+	}
+
+	client->send_buffer_used -= length;
+
+	if (client->congested && client->send_buffer_used <= LOCAL_SEND_LOW_WATER_MARK) {
+		log_debug("Send buffer for local client (handle: %d) drained to %d byte(s), no longer congested",
+		          client->socket->base.handle, client->send_buffer_used);
+
+		client->congested = false;
+	}
+
+	local_client_set_write_pending(client, client->send_buffer_used > 0);
+
+	// handle the requests that were held back because the send buffer was full
+	if (client->read_paused && local_client_has_send_room(client)) {
+		local_client_set_read_paused(client, false);
+		local_client_dispatch_requests(client);
+
+		// this might be called from the end of the event loop iteration, so
+		// the responses of these requests have to be sent on writability
+		if (client->send_buffer_used > 0) {
+			local_client_set_write_pending(client, true);
+		}
+	}
+}
+
+static void local_client_handle_write(void *opaque) {
+	LocalClient *client = opaque;
+
+	local_client_flush(client);
+}
+
+int local_client_create(LocalClient *client, Socket *socket) {
+	log_debug("Creating local client from UNIX domain socket (handle: %d)", socket->base.handle);
+
+	client->socket = socket;
+	client->connection_id = 0;
+	client->disconnected = false;
+	client->receive_buffer_used = 0;
+	client->read_paused = false;
+	client->send_buffer_used = 0;
+	client->write_pending = false;
+	client->congested = false;
+	client->received_requests = 0;
+	client->sent_responses = 0;
+	client->dropped_responses = 0;
+	client->dropping_responses = 0;
+	client->congestions = 0;
+
+	// allocate receive and send buffer
+	client->receive_buffer = malloc(LOCAL_RECEIVE_BUFFER_LENGTH);
+
+	if (client->receive_buffer == NULL) {
+		log_error("Could not allocate receive buffer: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+
+	client->send_buffer = malloc(LOCAL_SEND_BUFFER_LENGTH);
+
+	if (client->send_buffer == NULL) {
+		log_error("Could not allocate send buffer: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		free(client->receive_buffer);
+
+		return -1;
+	}
+
+	// add I/O object as event source
+	if (event_add_source(client->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, local_client_handle_read, client) < 0) {
+		free(client->send_buffer);
+		free(client->receive_buffer);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void local_client_destroy(LocalClient *client) {
+	local_client_flush(client);
+	local_client_log_statistics(client);
+
+	free(client->send_buffer);
+	free(client->receive_buffer);
+
+	event_remove_source(client->socket->base.handle, EVENT_SOURCE_TYPE_GENERIC);
+	socket_destroy(client->socket);
+	free(client->socket);
+}
+
+// like for brickd, responses are collected in the send buffer and are sent
+// out at the end of the current event loop iteration
+void local_client_dispatch_response(LocalClient *client, Packet *response, int length) {
+	LocalFrameHeader frame_header;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (client->disconnected) {
+		return;
+	}
+
+	if (client->send_buffer_used + (int)sizeof(frame_header) + length > LOCAL_SEND_BUFFER_LENGTH) {
+		++client->dropped_responses;
+
+		// only warn about the first response dropped in a row, the rest is
+		// counted and reported once the send buffer takes responses again
+		if (client->dropping_responses++ == 0) {
+			log_warn("Send buffer for local client (handle: %d) is full, dropping %s (%s)",
+			         client->socket->base.handle, packet_get_response_type(response),
+			         packet_get_response_signature(packet_signature, response));
+		} else {
+			log_packet_debug("Send buffer for local client (handle: %d) is still full, dropping %s (%s)",
+			                 client->socket->base.handle, packet_get_response_type(response),
+			                 packet_get_response_signature(packet_signature, response));
+		}
+
+		return;
+	}
+
+	if (client->dropping_responses > 0) {
+		log_warn("Send buffer for local client (handle: %d) has room again, %u response(s) were dropped",
+		         client->socket->base.handle, client->dropping_responses);
+
+		client->dropping_responses = 0;
+	}
+
+	frame_header.length = uint32_to_le(length);
+
+	memcpy(client->send_buffer + client->send_buffer_used, &frame_header, sizeof(frame_header));
+	memcpy(client->send_buffer + client->send_buffer_used + sizeof(frame_header), response, length);
+
+	client->send_buffer_used += sizeof(frame_header) + length;
+	++client->sent_responses;
+
+	if (!client->congested && client->send_buffer_used > LOCAL_SEND_HIGH_WATER_MARK) {
+		log_debug("Send buffer for local client (handle: %d) filled up to %d byte(s), congested",
+		          client->socket->base.handle, client->send_buffer_used);
+
+		client->congested = true;
+		++client->congestions;
+	}
+}
+
+void local_client_flush_responses(LocalClient *client) {
+	if (!client->write_pending) {
+		local_client_flush(client);
+	}
+}
+
+void local_client_log_statistics(LocalClient *client) {
+	log_info("Local client (handle: %d): received %u request(s), sent %u response(s), %u response(s) dropped, congested %u time(s)",
+	         client->socket->base.handle, client->received_requests,
+	         client->sent_responses, client->dropped_responses,
+	         client->congestions);
+}
@@ -0,0 +1,75 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * local_client.h: Local client specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef REDAPID_LOCAL_CLIENT_H
+#define REDAPID_LOCAL_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/socket.h>
+
+#include <daemonlib/packed_begin.h>
+
+// each packet exchanged with a local client is prefixed by a frame header.
+// the packet header length field is only one byte, the frame header carries
+// the actual packet length instead
+typedef struct {
+	uint32_t length; // of the packet following the frame header, little endian
+} ATTRIBUTE_PACKED LocalFrameHeader;
+
+#include <daemonlib/packed_end.h>
+
+#define LOCAL_MAX_PACKET_LENGTH 65536
+#define LOCAL_MAX_FRAME_LENGTH ((int)sizeof(LocalFrameHeader) + LOCAL_MAX_PACKET_LENGTH)
+#define LOCAL_RECEIVE_BUFFER_LENGTH (LOCAL_MAX_FRAME_LENGTH * 2)
+#define LOCAL_SEND_BUFFER_LENGTH (LOCAL_MAX_FRAME_LENGTH * 4)
+#define LOCAL_SEND_HIGH_WATER_MARK (LOCAL_SEND_BUFFER_LENGTH / 2) // becomes congested above this
+#define LOCAL_SEND_LOW_WATER_MARK (LOCAL_SEND_BUFFER_LENGTH / 8) // stops being congested below this
+
+typedef struct {
+	Socket *socket;
+	uint32_t connection_id; // assigned by the network subsystem, never 0
+	bool disconnected;
+	uint8_t *receive_buffer; // LOCAL_RECEIVE_BUFFER_LENGTH bytes
+	int receive_buffer_used;
+	bool read_paused; // EVENT_READ removed until the send buffer has room again
+	uint8_t *send_buffer; // LOCAL_SEND_BUFFER_LENGTH bytes
+	int send_buffer_used;
+	bool write_pending; // waiting for the socket to become writable
+	bool congested; // asynchronous producers should pause
+	uint32_t received_requests;
+	uint32_t sent_responses;
+	uint32_t dropped_responses;
+	uint32_t dropping_responses; // dropped since the send buffer was full last
+	uint32_t congestions;
+} LocalClient;
+
+int local_client_create(LocalClient *client, Socket *socket);
+void local_client_destroy(LocalClient *client);
+
+void local_client_dispatch_response(LocalClient *client, Packet *response, int length);
+void local_client_flush_responses(LocalClient *client);
+
+void local_client_log_statistics(LocalClient *client);
+
+#endif // REDAPID_LOCAL_CLIENT_H
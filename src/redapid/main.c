@@ -40,10 +40,15 @@
 
 #include "api.h"
 #include "cron.h"
+#include "file.h"
 #include "inventory.h"
 #include "network.h"
+#include "open_helper.h"
+#include "pool.h"
 #include "process_monitor.h"
+#include "uring.h"
 #include "version.h"
+#include "worker.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
@@ -51,6 +56,7 @@ static char _config_filename[1024] = SYSCONFDIR"/redapid.conf";
 static char _pid_filename[1024] = LOCALSTATEDIR"/run/redapid.pid";
 static char _brickd_socket_filename[1024] = LOCALSTATEDIR"/run/redapid-brickd.socket";
 static char _cron_socket_filename[1024] = LOCALSTATEDIR"/run/redapid-cron.socket";
+static char _local_socket_filename[1024] = LOCALSTATEDIR"/run/redapid-local.socket";
 static char _log_filename[1024] = LOCALSTATEDIR"/log/redapid.log";
 static char _image_version[128] = "<unknown>";
 bool _x11_enabled = false;
@@ -155,6 +161,14 @@ static int prepare_paths(void) {
 		return -1;
 	}
 
+	if (robust_snprintf(_local_socket_filename, sizeof(_local_socket_filename),
+	                    "%s/.redapid/redapid-local.socket", home) < 0) {
+		fprintf(stderr, "Could not format ~/.redapid/redapid-local.socket file name: %s (%d)\n",
+		        get_errno_name(errno), errno);
+
+		return -1;
+	}
+
 	if (robust_snprintf(_log_filename, sizeof(_log_filename),
 	                    "%s/.redapid/redapid.log", home) < 0) {
 		fprintf(stderr, "Could not format ~/.redapid/redapid.log file name: %s (%d)\n",
@@ -200,6 +214,17 @@ static void print_usage(void) {
 	       "  --debug [<filter>]  Set log level to debug and apply optional filter\n");
 }
 
+static void handle_sigusr1(void) {
+	api_log_statistics();
+	inventory_log_statistics();
+	file_log_statistics();
+	pool_log_statistics();
+	network_log_statistics();
+	worker_log_statistics();
+	open_helper_log_statistics();
+	uring_log_statistics();
+}
+
 static void handle_sighup(void) {
 	FILE *log_file = log_get_file();
 
@@ -336,7 +361,7 @@ int main(int argc, char **argv) {
 		goto error_event;
 	}
 
-	if (signal_init(handle_sighup, NULL) < 0) {
+	if (signal_init(handle_sighup, handle_sigusr1) < 0) {
 		goto error_signal;
 	}
 
@@ -348,6 +373,16 @@ int main(int argc, char **argv) {
 		goto error_cron;
 	}
 
+	// file objects are destroyed by inventory_exit, the io_uring subsystem
+	// has to outlive them
+	if (uring_init() < 0) {
+		goto error_uring;
+	}
+
+	if (file_init() < 0) {
+		goto error_file;
+	}
+
 	if (inventory_init() < 0) {
 		goto error_inventory;
 	}
@@ -356,10 +391,19 @@ int main(int argc, char **argv) {
 		goto error_api;
 	}
 
-	if (network_init(_brickd_socket_filename, _cron_socket_filename) < 0) {
+	if (network_init(_brickd_socket_filename, _cron_socket_filename,
+	                 _local_socket_filename) < 0) {
 		goto error_network;
 	}
 
+	if (open_helper_init() < 0) {
+		goto error_open_helper;
+	}
+
+	if (worker_init() < 0) {
+		goto error_worker;
+	}
+
 	if (inventory_load_programs() < 0) {
 		goto error_load_programs;
 	}
@@ -374,6 +418,12 @@ error_run:
 	inventory_unload_programs();
 
 error_load_programs:
+	worker_exit();
+
+error_worker:
+	open_helper_exit();
+
+error_open_helper:
 	network_exit();
 
 error_network:
@@ -381,8 +431,15 @@ error_network:
 
 error_api:
 	inventory_exit();
+	pool_exit();
 
 error_inventory:
+	file_exit();
+
+error_file:
+	uring_exit();
+
+error_uring:
 	cron_exit();
 
 error_cron:
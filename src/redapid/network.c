@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -39,6 +40,7 @@
 
 #include "api.h"
 #include "brickd.h"
+#include "file.h"
 #include "inventory.h"
 #include "program.h"
 #include "socat.h"
@@ -49,9 +51,26 @@ static const char *_brickd_socket_filename = NULL; // only != NULL if correspond
 static Socket _brickd_server_socket;
 static const char *_cron_socket_filename = NULL; // only != NULL if corresponding socket is open
 static Socket _cron_server_socket;
-static BrickDaemon _brickd;
-static bool _brickd_connected = false;
+static const char *_local_socket_filename = NULL; // only != NULL if corresponding socket is open
+static Socket _local_server_socket;
+static Array _brickds;
 static Array _socats;
+static Array _local_clients;
+static BrickDaemon *_requesting_brickd = NULL; // only != NULL while a brickd request is handled
+static LocalClient *_requesting_local_client = NULL; // only != NULL while a local request is handled
+static uint32_t _next_connection_id = 1;
+
+// connection IDs identify a brickd connection or local client for deferred
+// responses. unlike a pointer, an ID cannot refer to a reused array slot
+static uint32_t network_get_next_connection_id(void) {
+	uint32_t connection_id = _next_connection_id++;
+
+	if (_next_connection_id == 0) {
+		_next_connection_id = 1;
+	}
+
+	return connection_id;
+}
 
 static void network_notify_program_scheduler(Object *object, void *opaque) {
 	Program *program = (Program *)object;
@@ -65,6 +84,7 @@ static void network_handle_brickd_accept(void *opaque) {
 	Socket *client_socket;
 	struct sockaddr_storage address;
 	socklen_t length = sizeof(address);
+	BrickDaemon *brickd;
 
 	(void)opaque;
 
@@ -80,8 +100,12 @@ static void network_handle_brickd_accept(void *opaque) {
 		return;
 	}
 
-	if (_brickd_connected) {
-		log_error("Brick Daemon is already connected, disconnecting the new client socket");
+	// append to brickd array
+	brickd = array_append(&_brickds);
+
+	if (brickd == NULL) {
+		log_error("Could not append to brickd array: %s (%d)",
+		          get_errno_name(errno), errno);
 
 		socket_destroy(client_socket);
 		free(client_socket);
@@ -90,13 +114,19 @@ static void network_handle_brickd_accept(void *opaque) {
 	}
 
 	// create new brickd that takes ownership of the I/O object
-	if (brickd_create(&_brickd, client_socket) < 0) {
+	if (brickd_create(brickd, client_socket) < 0) {
+		array_remove(&_brickds, _brickds.count - 1, NULL);
+
+		socket_destroy(client_socket);
+		free(client_socket);
+
 		return;
 	}
 
-	_brickd_connected = true;
+	brickd->connection_id = network_get_next_connection_id();
 
-	log_info("Brick Daemon connected");
+	log_info("Brick Daemon connected (handle: %d), %d connection(s) in total",
+	         client_socket->base.handle, _brickds.count);
 
 	inventory_for_each_object(OBJECT_TYPE_PROGRAM, network_notify_program_scheduler, NULL);
 }
@@ -141,8 +171,58 @@ static void network_handle_cron_accept(void *opaque) {
 	log_debug("Added new socat (handle: %d)", socat->socket->base.handle);
 }
 
+static void network_handle_local_accept(void *opaque) {
+	Socket *client_socket;
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	LocalClient *client;
+
+	(void)opaque;
+
+	// accept new client socket
+	client_socket = socket_accept(&_local_server_socket, (struct sockaddr *)&address, &length);
+
+	if (client_socket == NULL) {
+		if (!errno_interrupted()) {
+			log_error("Could not accept new client socket: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		return;
+	}
+
+	// append to local client array
+	client = array_append(&_local_clients);
+
+	if (client == NULL) {
+		log_error("Could not append to local client array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		return;
+	}
+
+	// create new local client that takes ownership of the client socket
+	if (local_client_create(client, client_socket) < 0) {
+		array_remove(&_local_clients, _local_clients.count - 1, NULL);
+
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		return;
+	}
+
+	client->connection_id = network_get_next_connection_id();
+
+	log_debug("Added new local client (handle: %d)", client->socket->base.handle);
+}
+
+// the socket file gets the given mode before connections are accepted. if the
+// mode is -1 then the socket file keeps the mode given by the umask
 static int network_open_server_socket(Socket *server_socket,
-                                      const char *socket_filename,
+                                      const char *socket_filename, int mode,
                                       EventFunction handle_accept) {
 	struct sockaddr_un address;
 
@@ -183,6 +263,13 @@ static int network_open_server_socket(Socket *server_socket,
 		goto error;
 	}
 
+	if (mode >= 0 && chmod(socket_filename, (mode_t)mode) < 0) {
+		log_error("Could not change mode of UNIX domain server socket '%s' to %04o: %s (%d)",
+		          socket_filename, mode, get_errno_name(errno), errno);
+
+		goto error;
+	}
+
 	if (socket_listen(server_socket, 10, socket_create_allocated) < 0) {
 		log_error("Could not listen to UNIX domain server socket bound to '%s': %s (%d)",
 		          socket_filename, get_errno_name(errno), errno);
@@ -206,34 +293,70 @@ error:
 }
 
 int network_init(const char *brickd_socket_filename,
-                 const char *cron_socket_filename) {
+                 const char *cron_socket_filename,
+                 const char *local_socket_filename) {
 	log_debug("Initializing network subsystem");
 
+	// create brickd array. the BrickDaemon struct is not relocatable, because
+	// a pointer to it is passed as opaque parameter to the event subsystem
+	if (array_create(&_brickds, 4, sizeof(BrickDaemon), false) < 0) {
+		log_error("Could not create brickd array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
 	// create socats array. the Socat struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to the event subsystem
 	if (array_create(&_socats, 32, sizeof(Socat), false) < 0) {
 		log_error("Could not create socat array: %s (%d)",
 		          get_errno_name(errno), errno);
 
+		array_destroy(&_brickds, (ItemDestroyFunction)brickd_destroy);
+
+		return -1;
+	}
+
+	// create local clients array. the LocalClient struct is not relocatable,
+	// because a pointer to it is passed as opaque parameter to the event
+	// subsystem
+	if (array_create(&_local_clients, 8, sizeof(LocalClient), false) < 0) {
+		log_error("Could not create local client array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_destroy(&_socats, (ItemDestroyFunction)socat_destroy);
+		array_destroy(&_brickds, (ItemDestroyFunction)brickd_destroy);
+
 		return -1;
 	}
 
 	// open brickd server socket
-	if (network_open_server_socket(&_brickd_server_socket, brickd_socket_filename,
+	if (network_open_server_socket(&_brickd_server_socket, brickd_socket_filename, -1,
 	                               network_handle_brickd_accept) >= 0) {
 		_brickd_socket_filename = brickd_socket_filename;
 	}
 
 	// open cron server socket
-	if (network_open_server_socket(&_cron_server_socket, cron_socket_filename,
+	if (network_open_server_socket(&_cron_server_socket, cron_socket_filename, -1,
 	                               network_handle_cron_accept) >= 0) {
 		_cron_socket_filename = cron_socket_filename;
 	}
 
-	if (_brickd_socket_filename == NULL && _cron_socket_filename == NULL) {
+	// open local server socket. a local client has full access to the API,
+	// including spawning processes as any user. only the user redapid runs as
+	// is allowed to connect, independent of the umask
+	if (network_open_server_socket(&_local_server_socket, local_socket_filename, 0600,
+	                               network_handle_local_accept) >= 0) {
+		_local_socket_filename = local_socket_filename;
+	}
+
+	if (_brickd_socket_filename == NULL && _cron_socket_filename == NULL &&
+	    _local_socket_filename == NULL) {
 		log_error("Could not open any socket to listen to");
 
+		array_destroy(&_local_clients, (ItemDestroyFunction)local_client_destroy);
 		array_destroy(&_socats, (ItemDestroyFunction)socat_destroy);
+		array_destroy(&_brickds, (ItemDestroyFunction)brickd_destroy);
 
 		return -1;
 	}
@@ -244,10 +367,14 @@ int network_init(const char *brickd_socket_filename,
 void network_exit(void) {
 	log_debug("Shutting down network subsystem");
 
+	array_destroy(&_local_clients, (ItemDestroyFunction)local_client_destroy);
 	array_destroy(&_socats, (ItemDestroyFunction)socat_destroy);
+	array_destroy(&_brickds, (ItemDestroyFunction)brickd_destroy);
 
-	if (_brickd_connected) {
-		brickd_destroy(&_brickd);
+	if (_local_socket_filename != NULL) {
+		event_remove_source(_local_server_socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
+		socket_destroy(&_local_server_socket);
+		unlink(_local_socket_filename);
 	}
 
 	if (_cron_socket_filename != NULL) {
@@ -263,20 +390,77 @@ void network_exit(void) {
 	}
 }
 
+void network_log_statistics(void) {
+	int i;
+
+	for (i = 0; i < _brickds.count; ++i) {
+		brickd_log_statistics(array_get(&_brickds, i));
+	}
+
+	for (i = 0; i < _local_clients.count; ++i) {
+		local_client_log_statistics(array_get(&_local_clients, i));
+	}
+}
+
 bool network_is_brickd_connected(void) {
-	return _brickd_connected;
+	return _brickds.count > 0;
+}
+
+// asynchronous producers such as file_handle_async_read pause while this is
+// true. only the connections the callbacks of the object are sent to count.
+// the producers are resumed by network_cleanup_brickd_and_socats as soon as
+// the send buffers of these connections drained below their low-water mark
+bool network_is_congested(Object *object, ObjectCallback callback) {
+	BrickDaemon *brickd;
+	LocalClient *client;
+	int i;
+
+	for (i = 0; i < _brickds.count; ++i) {
+		brickd = array_get(&_brickds, i);
+
+		if (brickd->congested &&
+		    object_has_connection_callback_subscriber(object, callback, brickd->connection_id)) {
+			return true;
+		}
+	}
+
+	for (i = 0; i < _local_clients.count; ++i) {
+		client = array_get(&_local_clients, i);
+
+		if (client->congested &&
+		    object_has_connection_callback_subscriber(object, callback, client->connection_id)) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
 void network_cleanup_brickd_and_socats(void) {
 	int i;
+	BrickDaemon *brickd;
 	Socat *socat;
+	LocalClient *client;
 
-	if (_brickd_connected && _brickd.disconnected) {
-		log_debug("Removing disconnected Brick Daemon");
+	// send all responses that were added during this event loop iteration
+	for (i = 0; i < _brickds.count; ++i) {
+		brickd_flush_responses(array_get(&_brickds, i));
+	}
 
-		brickd_destroy(&_brickd);
+	for (i = 0; i < _local_clients.count; ++i) {
+		local_client_flush_responses(array_get(&_local_clients, i));
+	}
 
-		_brickd_connected = false;
+	// iterate backwards for simpler index handling
+	for (i = _brickds.count - 1; i >= 0; --i) {
+		brickd = array_get(&_brickds, i);
+
+		if (brickd->disconnected) {
+			log_debug("Removing disconnected Brick Daemon (handle: %d)",
+			          brickd->socket->base.handle);
+
+			array_remove(&_brickds, i, (ItemDestroyFunction)brickd_destroy);
+		}
 	}
 
 	// iterate backwards for simpler index handling
@@ -290,18 +474,145 @@ void network_cleanup_brickd_and_socats(void) {
 			array_remove(&_socats, i, (ItemDestroyFunction)socat_destroy);
 		}
 	}
+
+	// iterate backwards for simpler index handling
+	for (i = _local_clients.count - 1; i >= 0; --i) {
+		client = array_get(&_local_clients, i);
+
+		if (client->disconnected) {
+			log_debug("Removing disconnected local client (handle: %d)",
+			          client->socket->base.handle);
+
+			array_remove(&_local_clients, i, (ItemDestroyFunction)local_client_destroy);
+		}
+	}
+
+	file_resume_async_reads();
 }
 
+void network_handle_brickd_request(BrickDaemon *brickd, Packet *request) {
+	_requesting_brickd = brickd;
+
+	api_handle_request(request);
+
+	_requesting_brickd = NULL;
+}
+
+void network_handle_local_request(LocalClient *client, Packet *request, int length) {
+	_requesting_local_client = client;
+
+	api_handle_local_request(request, length);
+
+	_requesting_local_client = NULL;
+}
+
+// responses are sent to the brickd connection or local client whose request
+// is currently handled
 void network_dispatch_response(Packet *response) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	if (!_brickd_connected) {
-		log_packet_debug("No Brick Daemon connected, dropping %s (%s)",
-		                 packet_get_response_type(response),
-		                 packet_get_response_signature(packet_signature, response));
+	if (_requesting_brickd != NULL) {
+		brickd_dispatch_response(_requesting_brickd, response);
+	} else if (_requesting_local_client != NULL) {
+		local_client_dispatch_response(_requesting_local_client, response,
+		                               response->header.length);
+	} else {
+		log_error("Cannot send %s (%s) without a requesting connection, dropping it",
+		          packet_get_response_type(response),
+		          packet_get_response_signature(packet_signature, response));
+	}
+}
+
+// callbacks are only sent to the brickd connections and local clients that
+// used a session which is subscribed to the callback of the object
+void network_dispatch_callback(Packet *callback, Object *object, ObjectCallback type) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	BrickDaemon *brickd;
+	LocalClient *client;
+	bool dispatched = false;
+	int i;
+
+	for (i = 0; i < _brickds.count; ++i) {
+		brickd = array_get(&_brickds, i);
+
+		if (object_has_connection_callback_subscriber(object, type, brickd->connection_id)) {
+			brickd_dispatch_response(brickd, callback);
+
+			dispatched = true;
+		}
+	}
+
+	for (i = 0; i < _local_clients.count; ++i) {
+		client = array_get(&_local_clients, i);
+
+		if (object_has_connection_callback_subscriber(object, type, client->connection_id)) {
+			local_client_dispatch_response(client, callback, callback->header.length);
+
+			dispatched = true;
+		}
+	}
+
+	if (!dispatched) {
+		log_packet_debug("No subscribed Brick Daemon or local client connected, dropping %s (%s)",
+		                 packet_get_response_type(callback),
+		                 packet_get_response_signature(packet_signature, callback));
+	}
+}
+
+// returns the connection ID of the brickd connection or local client whose
+// request is currently handled, or 0 if no request is handled
+uint32_t network_get_requester(void) {
+	if (_requesting_brickd != NULL) {
+		return _requesting_brickd->connection_id;
+	} else if (_requesting_local_client != NULL) {
+		return _requesting_local_client->connection_id;
+	} else {
+		return 0;
+	}
+}
+
+// sends a response that was completed after its request was handled, for
+// example by the worker thread. the response is dropped if the requester
+// disconnected in the meantime
+void network_dispatch_deferred_response(uint32_t requester, Packet *response) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	BrickDaemon *brickd;
+	LocalClient *client;
+	int i;
+
+	for (i = 0; i < _brickds.count; ++i) {
+		brickd = array_get(&_brickds, i);
+
+		if (brickd->connection_id == requester) {
+			brickd_dispatch_response(brickd, response);
+
+			return;
+		}
+	}
+
+	for (i = 0; i < _local_clients.count; ++i) {
+		client = array_get(&_local_clients, i);
+
+		if (client->connection_id == requester) {
+			local_client_dispatch_response(client, response, response->header.length);
+
+			return;
+		}
+	}
+
+	log_debug("Requester of deferred %s (%s) disconnected, dropping it",
+	          packet_get_response_type(response),
+	          packet_get_response_signature(packet_signature, response));
+}
+
+// responses longer than a TFP packet can only be sent to local clients
+void network_dispatch_large_response(Packet *response, int length) {
+	if (_requesting_local_client == NULL) {
+		log_error("Cannot send %d byte response without a requesting local client, dropping it",
+		          length);
 
 		return;
 	}
 
-	brickd_dispatch_response(&_brickd, response);
+	local_client_dispatch_response(_requesting_local_client, response, length);
 }
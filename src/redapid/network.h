@@ -24,14 +24,32 @@
 
 #include <stdbool.h>
 
+#include <daemonlib/packet.h>
+
+#include "brickd.h"
+#include "local_client.h"
+#include "object.h"
+
 int network_init(const char *brickd_socket_filename,
-                 const char *cron_socket_filename);
+                 const char *cron_socket_filename,
+                 const char *local_socket_filename);
 void network_exit(void);
 
+void network_log_statistics(void);
+
 bool network_is_brickd_connected(void);
+bool network_is_congested(Object *object, ObjectCallback callback);
 
 void network_cleanup_brickd_and_socats(void);
 
+void network_handle_brickd_request(BrickDaemon *brickd, Packet *request);
+void network_handle_local_request(LocalClient *client, Packet *request, int length);
+
+uint32_t network_get_requester(void);
+
 void network_dispatch_response(Packet *response);
+void network_dispatch_callback(Packet *callback, Object *object, ObjectCallback type);
+void network_dispatch_deferred_response(uint32_t requester, Packet *response);
+void network_dispatch_large_response(Packet *response, int length);
 
 #endif // REDAPID_NETWORK_H
@@ -39,12 +39,12 @@
  */
 
 #include <errno.h>
-#include <stdlib.h>
 
 #include <daemonlib/log.h>
 
 #include "object.h"
 
+#include "api.h"
 #include "inventory.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -90,6 +90,7 @@ APIE object_create(Object *object, ObjectType type, Session *session,
 	object->external_reference_count = 0;
 	object->lock_count = 0;
 
+	node_reset(&object->inventory_node);
 	node_reset(&object->external_reference_sentinel);
 
 	// OBJECT_CREATE_FLAG_INTERNAL or OBJECT_CREATE_FLAG_EXTERNAL has to be used
@@ -134,6 +135,7 @@ APIE object_create(Object *object, ObjectType type, Session *session,
 }
 
 void object_destroy(Object *object) {
+	ObjectID id = object->id; // the object is freed by its destroy function
 	ExternalReference *external_reference;
 	Session *session;
 
@@ -148,12 +150,11 @@ void object_destroy(Object *object) {
 		session = external_reference->session;
 
 		node_remove(&external_reference->object_node);
-		node_remove(&external_reference->session_node);
 
 		object->external_reference_count -= external_reference->count;
 		session->external_reference_count -= external_reference->count;
 
-		free(external_reference);
+		session_free_external_reference(session, external_reference);
 	}
 
 	if (object->lock_count > 0) {
@@ -164,6 +165,9 @@ void object_destroy(Object *object) {
 	if (object->destroy != NULL) {
 		object->destroy(object);
 	}
+
+	// the destroy function might have triggered a state callback itself
+	api_drop_pending_callbacks(id);
 }
 
 void object_log_signature(Object *object) {
@@ -196,6 +200,42 @@ PacketE object_release_unchecked(Object *object, Session *session) {
 	return object_release(object, session) == API_E_SUCCESS ? PACKET_E_SUCCESS : PACKET_E_UNKNOWN_ERROR;
 }
 
+// public API
+APIE object_release_multiple(uint16_t *object_ids, uint8_t object_id_count,
+                             Session *session, uint8_t *objects_released) {
+	APIE error_code = API_E_SUCCESS;
+	APIE release_error_code;
+	int i;
+	Object *object;
+
+	*objects_released = 0;
+
+	if (object_id_count > OBJECT_MAX_RELEASE_OBJECTS_LENGTH) {
+		log_warn("Count of %u object ID(s) exceeds maximum count of release objects request",
+		         object_id_count);
+
+		return API_E_OUT_OF_RANGE;
+	}
+
+	// try to release all given objects, even if some of them cannot be
+	// released. report the first error that occurred
+	for (i = 0; i < object_id_count; ++i) {
+		release_error_code = inventory_get_object(OBJECT_TYPE_ANY, object_ids[i], &object);
+
+		if (release_error_code == API_E_SUCCESS) {
+			release_error_code = object_release(object, session);
+		}
+
+		if (release_error_code == API_E_SUCCESS) {
+			++*objects_released;
+		} else if (error_code == API_E_SUCCESS) {
+			error_code = release_error_code;
+		}
+	}
+
+	return error_code;
+}
+
 void object_add_internal_reference(Object *object) {
 	log_object_debug("Adding an internal %s object (id: %u) reference (count: %d +1)",
 	                 object_get_type_name(object->type), object->id,
@@ -224,36 +264,50 @@ void object_remove_internal_reference(Object *object) {
 	}
 }
 
+static uint16_t object_get_valid_callbacks(ObjectType type) {
+	switch (type) {
+	case OBJECT_TYPE_FILE:
+		return OBJECT_CALLBACK_ASYNC_FILE_READ |
+		       OBJECT_CALLBACK_ASYNC_FILE_WRITE |
+		       OBJECT_CALLBACK_FILE_EVENTS_OCCURRED;
+
+	case OBJECT_TYPE_PROCESS:
+		return OBJECT_CALLBACK_PROCESS_STATE_CHANGED;
+
+	case OBJECT_TYPE_PROGRAM:
+		return OBJECT_CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED |
+		       OBJECT_CALLBACK_PROGRAM_PROCESS_SPAWNED;
+
+	default:
+		return 0;
+	}
+}
+
 APIE object_add_external_reference(Object *object, Session *session) {
-	Node *external_reference_object_node = object->external_reference_sentinel.next;
 	ExternalReference *external_reference;
 	APIE error_code;
 
 	// check if there is already an external reference
-	while (external_reference_object_node != &object->external_reference_sentinel) {
-		external_reference = containerof(external_reference_object_node, ExternalReference, object_node);
-
-		if (external_reference->session == session) {
-			if (object->id != OBJECT_ID_ZERO) {
-				// only log a message if this is not the initial call from
-				// object_create were the object is not fully initialized yet
-				log_object_debug("Adding an external %s object (id: %u) reference (count: %d +1) to session (id: %u)",
-				                 object_get_type_name(object->type), object->id,
-				                 object->external_reference_count, session->id);
-			}
-
-			++external_reference->count;
-			++object->external_reference_count;
-			++session->external_reference_count;
-
-			return API_E_SUCCESS;
+	external_reference = session_get_external_reference(session, object);
+
+	if (external_reference != NULL) {
+		if (object->id != OBJECT_ID_ZERO) {
+			// only log a message if this is not the initial call from
+			// object_create were the object is not fully initialized yet
+			log_object_debug("Adding an external %s object (id: %u) reference (count: %d +1) to session (id: %u)",
+			                 object_get_type_name(object->type), object->id,
+			                 object->external_reference_count, session->id);
 		}
 
-		external_reference_object_node = external_reference_object_node->next;
+		++external_reference->count;
+		++object->external_reference_count;
+		++session->external_reference_count;
+
+		return API_E_SUCCESS;
 	}
 
 	// create new external reference
-	external_reference = calloc(1, sizeof(ExternalReference));
+	external_reference = session_allocate_external_reference(session, object);
 
 	if (external_reference == NULL) {
 		error_code = API_E_NO_FREE_MEMORY;
@@ -272,16 +326,14 @@ APIE object_add_external_reference(Object *object, Session *session) {
 		                 object->external_reference_count, session->id);
 	}
 
-	node_reset(&external_reference->object_node);
 	node_insert_before(&object->external_reference_sentinel, &external_reference->object_node);
 
-	node_reset(&external_reference->session_node);
-	node_insert_before(&session->external_reference_sentinel, &external_reference->session_node);
-
-	external_reference->object = object;
-	external_reference->session = session;
 	external_reference->count = 1;
 
+	// a new reference is interested in all callbacks of the object, until the
+	// session unsubscribes from some of them
+	external_reference->callback_mask = object_get_valid_callbacks(object->type);
+
 	++object->external_reference_count;
 	++session->external_reference_count;
 
@@ -289,7 +341,6 @@ APIE object_add_external_reference(Object *object, Session *session) {
 }
 
 void object_remove_external_reference(Object *object, Session *session) {
-	Node *external_reference_object_node;
 	ExternalReference *external_reference;
 
 	if (object->external_reference_count == 0) {
@@ -299,40 +350,123 @@ void object_remove_external_reference(Object *object, Session *session) {
 		return;
 	}
 
-	external_reference_object_node = object->external_reference_sentinel.next;
+	external_reference = session_get_external_reference(session, object);
 
-	while (external_reference_object_node != &object->external_reference_sentinel) {
-		external_reference = containerof(external_reference_object_node, ExternalReference, object_node);
+	if (external_reference == NULL) {
+		log_error("Could not find external %s object (id: %u) reference in session (id: %u)",
+		          object_get_type_name(object->type), object->id, session->id);
 
-		if (external_reference->session == session) {
-			log_object_debug("Removing an internal %s object (id: %u) reference (count: %d -1) from session (id: %u)",
-			                 object_get_type_name(object->type), object->id,
-			                 object->external_reference_count, session->id);
+		return;
+	}
 
-			--external_reference->count;
-			--object->external_reference_count;
-			--session->external_reference_count;
+	log_object_debug("Removing an internal %s object (id: %u) reference (count: %d -1) from session (id: %u)",
+	                 object_get_type_name(object->type), object->id,
+	                 object->external_reference_count, session->id);
 
-			if (external_reference->count == 0) {
-				node_remove(&external_reference->object_node);
-				node_remove(&external_reference->session_node);
+	--external_reference->count;
+	--object->external_reference_count;
+	--session->external_reference_count;
 
-				free(external_reference);
-			}
+	if (external_reference->count == 0) {
+		node_remove(&external_reference->object_node);
 
-			// destroy object if last reference was removed
-			if (object->internal_reference_count == 0 && object->external_reference_count == 0) {
-				inventory_remove_object(object); // calls object_destroy
-			}
+		session_free_external_reference(session, external_reference);
+	}
 
-			return;
+	// destroy object if last reference was removed
+	if (object->internal_reference_count == 0 && object->external_reference_count == 0) {
+		inventory_remove_object(object); // calls object_destroy
+	}
+}
+
+static APIE object_get_subscription(Object *object, Session *session, uint16_t callbacks,
+                                    ExternalReference **external_reference) {
+	if ((callbacks & ~object_get_valid_callbacks(object->type)) != 0) {
+		log_warn("Invalid callbacks 0x%04X for %s object (id: %u)",
+		         callbacks, object_get_type_name(object->type), object->id);
+
+		return API_E_INVALID_PARAMETER;
+	}
+
+	*external_reference = session_get_external_reference(session, object);
+
+	if (*external_reference == NULL) {
+		log_warn("Cannot change callback subscription of %s object (id: %u) without an external reference from session (id: %u)",
+		         object_get_type_name(object->type), object->id, session->id);
+
+		return API_E_INVALID_OPERATION;
+	}
+
+	return API_E_SUCCESS;
+}
+
+// public API
+APIE object_subscribe_callbacks(Object *object, Session *session, uint16_t callbacks) {
+	ExternalReference *external_reference;
+	APIE error_code = object_get_subscription(object, session, callbacks,
+	                                          &external_reference);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	external_reference->callback_mask |= callbacks;
+
+	return API_E_SUCCESS;
+}
+
+// public API
+APIE object_unsubscribe_callbacks(Object *object, Session *session, uint16_t callbacks) {
+	ExternalReference *external_reference;
+	APIE error_code = object_get_subscription(object, session, callbacks,
+	                                          &external_reference);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	external_reference->callback_mask &= ~callbacks;
+
+	return API_E_SUCCESS;
+}
+
+// a callback is only worth sending if at least one external reference to the
+// object is still subscribed to it. each external reference starts out with all
+// callbacks of the object subscribed
+bool object_has_callback_subscriber(Object *object, ObjectCallback callback) {
+	Node *node;
+	ExternalReference *external_reference;
+
+	for (node = object->external_reference_sentinel.next;
+	     node != &object->external_reference_sentinel; node = node->next) {
+		external_reference = containerof(node, ExternalReference, object_node);
+
+		if ((external_reference->callback_mask & callback) != 0) {
+			return true;
 		}
+	}
+
+	return false;
+}
+
+// callbacks are only sent to a connection if one of the sessions that last
+// used it holds a subscribed external reference to the object
+bool object_has_connection_callback_subscriber(Object *object, ObjectCallback callback,
+                                               uint32_t connection_id) {
+	Node *node;
+	ExternalReference *external_reference;
 
-		external_reference_object_node = external_reference_object_node->next;
+	for (node = object->external_reference_sentinel.next;
+	     node != &object->external_reference_sentinel; node = node->next) {
+		external_reference = containerof(node, ExternalReference, object_node);
+
+		if ((external_reference->callback_mask & callback) != 0 &&
+		    external_reference->session->connection_id == connection_id) {
+			return true;
+		}
 	}
 
-	log_error("Could not find external %s object (id: %u) reference in session (id: %u)",
-	          object_get_type_name(object->type), object->id, session->id);
+	return false;
 }
 
 void object_lock(Object *object) {
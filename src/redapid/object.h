@@ -37,6 +37,7 @@ typedef uint16_t ObjectID;
 #define OBJECT_ID_MAX UINT16_MAX
 #define OBJECT_ID_ZERO 0
 #define OBJECT_MAX_SIGNATURE_LENGTH 1024
+#define OBJECT_MAX_RELEASE_OBJECTS_LENGTH 32
 
 typedef enum {
 	OBJECT_TYPE_ANY = -1,
@@ -54,6 +55,15 @@ typedef enum { // bitmask
 	OBJECT_CREATE_FLAG_LOCKED   = 0x0004, // can only be used in combination with OBJECT_CREATE_FLAG_INTERNAL
 } ObjectCreateFlag;
 
+typedef enum { // bitmask
+	OBJECT_CALLBACK_ASYNC_FILE_READ                 = 0x0001,
+	OBJECT_CALLBACK_ASYNC_FILE_WRITE                = 0x0002,
+	OBJECT_CALLBACK_FILE_EVENTS_OCCURRED            = 0x0004,
+	OBJECT_CALLBACK_PROCESS_STATE_CHANGED           = 0x0008,
+	OBJECT_CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED = 0x0010,
+	OBJECT_CALLBACK_PROGRAM_PROCESS_SPAWNED         = 0x0020
+} ObjectCallback;
+
 typedef struct _Object Object;
 
 typedef void (*ObjectDestroyFunction)(Object *object);
@@ -64,6 +74,7 @@ struct _Object {
 	ObjectType type;
 	ObjectDestroyFunction destroy;
 	ObjectSignatureFunction signature;
+	Node inventory_node; // links all objects of the same type in the inventory
 	int internal_reference_count;
 	Node external_reference_sentinel;
 	int external_reference_count;
@@ -82,6 +93,8 @@ void object_log_signature(Object *object);
 
 APIE object_release(Object *object, Session *session);
 PacketE object_release_unchecked(Object *object, Session *session);
+APIE object_release_multiple(uint16_t *object_ids, uint8_t object_id_count,
+                             Session *session, uint8_t *objects_released);
 
 void object_add_internal_reference(Object *object);
 void object_remove_internal_reference(Object *object);
@@ -89,6 +102,12 @@ void object_remove_internal_reference(Object *object);
 APIE object_add_external_reference(Object *object, Session *session);
 void object_remove_external_reference(Object *object, Session *session);
 
+APIE object_subscribe_callbacks(Object *object, Session *session, uint16_t callbacks);
+APIE object_unsubscribe_callbacks(Object *object, Session *session, uint16_t callbacks);
+bool object_has_callback_subscriber(Object *object, ObjectCallback callback);
+bool object_has_connection_callback_subscriber(Object *object, ObjectCallback callback,
+                                               uint32_t connection_id);
+
 void object_lock(Object *object);
 void object_unlock(Object *object);
 
@@ -0,0 +1,746 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * open_helper.c: Persistent helper processes to open files as other users
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * opening a file as a different user requires a process running as that
+ * user. forking such a process for each file is slow on the RED Brick, the
+ * program scheduler alone does this for the log files of every program
+ * execution. instead a helper process is forked once per user and group. it
+ * receives open requests over a socket pair and passes the opened file
+ * descriptors back using SCM_RIGHTS.
+ *
+ * the number of helpers is limited by the file.open_helpers option. if this
+ * limit is reached then the least recently used helper is stopped to make room
+ * for a new one. helpers are used from the event loop thread and the worker
+ * thread. the mutex only protects the helper table and the statistics. a
+ * helper is marked as busy while a thread uses it, the round trip to it and
+ * spawning or stopping it are done without holding the mutex. if the helper
+ * for the requested identity is busy then the file is opened by forking.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "open_helper.h"
+
+#include "file.h"
+#include "process.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define OPEN_HELPER_MAX_COUNT 32
+
+typedef struct {
+	uint32_t flags;
+	int32_t oflags;
+	uint32_t mode;
+	char name[PATH_MAX]; // only the used part, including the NULL-terminator, is sent
+} OpenHelperRequest;
+
+typedef struct {
+	uint8_t error_code;
+	int32_t error_number; // errno of the failed open call
+} OpenHelperReply;
+
+typedef struct {
+	bool running; // slot is in use, the helper might still be spawned
+	bool busy; // a thread uses the helper, only this thread accesses pid and socket_handle
+	uint32_t uid;
+	uint32_t gid;
+	pid_t pid;
+	int socket_handle; // -1 until the helper got spawned
+	uint32_t last_used;
+} OpenHelper;
+
+static int _max_helper_count = 0; // 0 disables open helpers
+static Mutex _mutex; // protects all variables below
+static OpenHelper _helpers[OPEN_HELPER_MAX_COUNT];
+static int _helper_count = 0; // number of running helpers
+static uint32_t _use_counter = 0;
+static uint32_t _helper_opens = 0;
+static uint32_t _forked_opens = 0;
+static uint32_t _helper_spawns = 0;
+static uint32_t _helper_evictions = 0;
+
+// sends data and a file descriptor, if fd >= 0
+static int sendfd(int socket_handle, int fd, void *data, int length) {
+	struct iovec iovec;
+	struct msghdr msghdr;
+	struct cmsghdr *cmsghdr;
+	uint8_t control[CMSG_SPACE(sizeof(int))];
+
+	iovec.iov_base = data;
+	iovec.iov_len = length;
+
+	memset(&msghdr, 0, sizeof(msghdr));
+
+	msghdr.msg_iov = &iovec;
+	msghdr.msg_iovlen = 1;
+
+	if (fd < 0) {
+		msghdr.msg_control = NULL;
+		msghdr.msg_controllen = 0;
+	} else {
+		msghdr.msg_control = control;
+		msghdr.msg_controllen = CMSG_LEN(sizeof(int));
+
+		cmsghdr = CMSG_FIRSTHDR(&msghdr);
+		cmsghdr->cmsg_len = CMSG_LEN(sizeof(int));
+		cmsghdr->cmsg_level = SOL_SOCKET;
+		cmsghdr->cmsg_type = SCM_RIGHTS;
+
+		memcpy(CMSG_DATA(cmsghdr), &fd, sizeof(int));
+	}
+
+	if (sendmsg(socket_handle, &msghdr, MSG_NOSIGNAL) != length) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// receives data and a file descriptor, fd is set to -1 if none was sent
+static int recvfd(int socket_handle, int *fd, void *data, int length) {
+	struct iovec iovec;
+	struct msghdr msghdr;
+	struct cmsghdr *cmsghdr;
+	uint8_t control[CMSG_SPACE(sizeof(int))];
+	int rc;
+
+	iovec.iov_base = data;
+	iovec.iov_len = length;
+
+	memset(&msghdr, 0, sizeof (msghdr));
+
+	msghdr.msg_name = 0;
+	msghdr.msg_namelen = 0;
+	msghdr.msg_iov = &iovec;
+	msghdr.msg_iovlen = 1;
+	msghdr.msg_control = control;
+	msghdr.msg_controllen = sizeof(control);
+
+	rc = recvmsg(socket_handle, &msghdr, 0);
+
+	if (rc < 0) {
+		return -1;
+	}
+
+	// the peer closed its end or sent a truncated message
+	if (rc != length) {
+		errno = ECONNRESET;
+
+		return -1;
+	}
+
+	cmsghdr = CMSG_FIRSTHDR(&msghdr);
+
+	if (cmsghdr != NULL) {
+		memcpy(fd, CMSG_DATA(cmsghdr), sizeof(int));
+	} else {
+		*fd = -1;
+	}
+
+	return 0;
+}
+
+// forks a child process per file to open. this is used if open helpers are
+// disabled or if no open helper could be spawned for the requested identity
+static APIE open_helper_open_forked(const char *name, uint32_t flags, int oflags,
+                                    mode_t mode, uint32_t uid, uint32_t gid,
+                                    IOHandle *fd_) {
+	uint8_t dummy = 0;
+	APIE error_code;
+	int pair[2];
+	pid_t pid;
+	int fd = -1;
+	int rc;
+	int status;
+
+	// create socket pair to pass FD from child to parent
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		error_code = api_get_error_code_from_errno();
+
+		log_error("Could not create socket pair for opening file '%s': %s (%d)",
+		          name, get_errno_name(errno), errno);
+
+		return error_code;
+	}
+
+	error_code = process_fork(&pid);
+
+	if (error_code != API_E_SUCCESS) {
+		close(pair[0]);
+		close(pair[1]);
+
+		return error_code;
+	}
+
+	if (pid == 0) { // child
+		// close socket pair read end in child
+		close(pair[0]);
+
+		// change user and groups
+		error_code = process_set_identity(uid, gid);
+
+		if (error_code != API_E_SUCCESS) {
+			goto child_cleanup;
+		}
+
+		// open file
+		fd = open(name, oflags, mode);
+
+		if (fd < 0) {
+			error_code = api_get_error_code_from_errno();
+
+			if (errno == ENOENT) {
+				log_debug("Could not open non-existing file '%s'", name);
+			} else if ((flags & (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE)) ==
+			           (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE) && errno == EEXIST) {
+				log_debug("Could not exclusively create already existing file '%s'", name);
+			} else {
+				log_error("Could not open file '%s' with flags 0x%04X as %u:%u: %s (%d)",
+				          name, flags, uid, gid, get_errno_name(errno), errno);
+			}
+
+			goto child_cleanup;
+		}
+
+		error_code = API_E_SUCCESS;
+
+	child_cleanup:
+		// send FD to parent in all cases
+		do {
+			rc = sendfd(pair[1], fd, &dummy, sizeof(dummy));
+		} while (rc < 0 && errno_interrupted());
+
+		if (rc < 0) {
+			log_error("Could not send file descriptor to parent process for file '%s': %s (%d)",
+			          name, get_errno_name(errno), errno);
+
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+
+		// close socket pair write end in child
+		close(pair[1]);
+
+		// report error code as exit status
+		_exit(error_code);
+	}
+
+	// close socket pair write end in parent
+	close(pair[1]);
+
+	// receive FD from child
+	do {
+		rc = recvfd(pair[0], &fd, &dummy, sizeof(dummy));
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc < 0) {
+		error_code = api_get_error_code_from_errno();
+
+		log_error("Could not receive file descriptor from child process opening file '%s' as %u:%u: %s (%d)",
+		          name, uid, gid, get_errno_name(errno), errno);
+
+		// close socket pair read end in parent
+		close(pair[0]);
+
+		// wait for child to exit
+		while (waitpid(pid, NULL, 0) < 0 && errno_interrupted());
+
+		return error_code;
+	}
+
+	// close socket pair read end in parent
+	close(pair[0]);
+
+	// wait for child to exit
+	do {
+		rc = waitpid(pid, &status, 0);
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc < 0) {
+		error_code = api_get_error_code_from_errno();
+
+		log_error("Could not wait for child process opening file '%s' as %u:%u: %s (%d)",
+		          name, uid, gid, get_errno_name(errno), errno);
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return error_code;
+	}
+
+	// check if child exited normally
+	if (!WIFEXITED(status)) {
+		log_error("Child process opening file '%s' as %u:%u did not exit normally",
+		          name, uid, gid);
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return API_E_INTERNAL_ERROR;
+	}
+
+	// get child error code from child exit status
+	error_code = WEXITSTATUS(status);
+
+	if (error_code != API_E_SUCCESS) {
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return error_code;
+	}
+
+	// check if FD is invalid after child process exited successfully. this
+	// should not be possible. the check is here just to be on the safe side
+	if (fd < 0) {
+		log_error("Child process opening file '%s' as %u:%u succeeded, but returned an invalid file descriptor",
+		          name, uid, gid);
+
+		return API_E_INTERNAL_ERROR;
+	}
+
+	*fd_ = fd;
+
+	return API_E_SUCCESS;
+}
+
+
+// main loop of a helper process. it runs until the parent closes its end of
+// the socket pair
+static void open_helper_run(int socket_handle) {
+	OpenHelperRequest request;
+	OpenHelperReply reply;
+	int length;
+	int fd;
+
+	for (;;) {
+		length = recv(socket_handle, &request, sizeof(request), 0);
+
+		if (length < 0 && errno_interrupted()) {
+			continue;
+		}
+
+		if (length <= 0) {
+			break;
+		}
+
+		fd = -1;
+
+		if (length <= (int)offsetof(OpenHelperRequest, name) ||
+		    request.name[length - offsetof(OpenHelperRequest, name) - 1] != '\0') {
+			reply.error_code = API_E_INVALID_PARAMETER;
+			reply.error_number = EINVAL;
+		} else {
+			fd = open(request.name, request.oflags, (mode_t)request.mode);
+
+			if (fd < 0) {
+				reply.error_code = api_get_error_code_from_errno();
+				reply.error_number = errno;
+			} else {
+				reply.error_code = API_E_SUCCESS;
+				reply.error_number = 0;
+			}
+		}
+
+		while (sendfd(socket_handle, fd, &reply, sizeof(reply)) < 0 && errno_interrupted());
+
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	_exit(0);
+}
+
+// called without holding the mutex, the helper is marked as busy
+static int open_helper_spawn(OpenHelper *helper) {
+	uint32_t uid = helper->uid;
+	uint32_t gid = helper->gid;
+	int pair[2];
+	pid_t pid;
+	APIE error_code;
+	uint8_t status;
+	long sc_open_max;
+	int i;
+	int rc;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+		log_error("Could not create socket pair for open helper: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (process_fork(&pid) != API_E_SUCCESS) {
+		close(pair[0]);
+		close(pair[1]);
+
+		return -1;
+	}
+
+	if (pid == 0) { // child
+		close(pair[0]);
+
+		// change user and groups, and report the outcome to the parent
+		error_code = process_set_identity(uid, gid);
+		status = error_code;
+
+		while (send(pair[1], &status, sizeof(status), MSG_NOSIGNAL) < 0 && errno_interrupted());
+
+		if (error_code != API_E_SUCCESS) {
+			_exit(error_code);
+		}
+
+		// the helper outlives the request that spawned it. it must not keep
+		// any file descriptor of the parent open, otherwise pipes and sockets
+		// would not report EOF once the parent closes them. logging is
+		// disabled beforehand, because the log file is closed as well
+		log_set_file(NULL);
+
+		sc_open_max = sysconf(_SC_OPEN_MAX);
+
+		if (sc_open_max < 0) {
+			sc_open_max = 1024;
+		}
+
+		for (i = 0; i < sc_open_max; ++i) {
+			if (i != pair[1]) {
+				close(i);
+			}
+		}
+
+		open_helper_run(pair[1]);
+	}
+
+	close(pair[1]);
+
+	// wait for the helper to change its identity
+	do {
+		rc = recv(pair[0], &status, sizeof(status), 0);
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc != sizeof(status) || status != API_E_SUCCESS) {
+		log_error("Could not spawn open helper for %u:%u (pid: %u)",
+		          uid, gid, pid);
+
+		close(pair[0]);
+
+		while (waitpid(pid, NULL, 0) < 0 && errno_interrupted());
+
+		return -1;
+	}
+
+	helper->pid = pid;
+	helper->socket_handle = pair[0];
+
+	log_debug("Spawned open helper for %u:%u (pid: %u)", uid, gid, pid);
+
+	return 0;
+}
+
+// called without holding the mutex on a helper that was removed from the table
+static void open_helper_destroy(OpenHelper *helper) {
+	log_debug("Stopping open helper for %u:%u (pid: %u)",
+	          helper->uid, helper->gid, helper->pid);
+
+	// closing the socket pair makes the helper exit
+	close(helper->socket_handle);
+
+	while (waitpid(helper->pid, NULL, 0) < 0 && errno_interrupted());
+}
+
+// marks the helper for the given identity as busy and returns it. if there is
+// no helper for this identity yet then a free slot is reserved for it, its
+// socket handle is -1 and the caller has to spawn it. if the limit is reached
+// the least recently used idle helper is removed from the table and copied to
+// evicted, the caller has to stop it. returns NULL if the helper for this
+// identity or all helpers are busy
+static OpenHelper *open_helper_acquire(uint32_t uid, uint32_t gid, OpenHelper *evicted) {
+	int i;
+	OpenHelper *helper;
+	OpenHelper *free_slot = NULL;
+	OpenHelper *lru = NULL;
+
+	evicted->running = false;
+
+	for (i = 0; i < OPEN_HELPER_MAX_COUNT; ++i) {
+		helper = &_helpers[i];
+
+		if (!helper->running) {
+			if (free_slot == NULL) {
+				free_slot = helper;
+			}
+
+			continue;
+		}
+
+		if (helper->uid == uid && helper->gid == gid) {
+			if (helper->busy) {
+				return NULL;
+			}
+
+			helper->busy = true;
+
+			return helper;
+		}
+
+		if (!helper->busy && (lru == NULL || helper->last_used < lru->last_used)) {
+			lru = helper;
+		}
+	}
+
+	if (_helper_count >= _max_helper_count) {
+		if (lru == NULL) {
+			return NULL;
+		}
+
+		log_debug("Open helper limit of %d reached, stopping least recently used open helper",
+		          _max_helper_count);
+
+		memcpy(evicted, lru, sizeof(OpenHelper));
+
+		++_helper_evictions;
+
+		free_slot = lru;
+	} else {
+		++_helper_count;
+	}
+
+	free_slot->running = true;
+	free_slot->busy = true;
+	free_slot->uid = uid;
+	free_slot->gid = gid;
+	free_slot->pid = 0;
+	free_slot->socket_handle = -1;
+	free_slot->last_used = _use_counter;
+
+	return free_slot;
+}
+
+// gives a helper back after use. a failed helper is removed from the table and
+// copied to failed, the caller has to stop it
+static void open_helper_release(OpenHelper *helper, bool success, OpenHelper *failed) {
+	mutex_lock(&_mutex);
+
+	if (success) {
+		helper->busy = false;
+		helper->last_used = ++_use_counter;
+	} else {
+		memcpy(failed, helper, sizeof(OpenHelper));
+
+		helper->running = false;
+		helper->busy = false;
+
+		--_helper_count;
+	}
+
+	mutex_unlock(&_mutex);
+}
+
+// returns -1 if the helper failed. otherwise the outcome of the open call is
+// returned as error code, with errno set accordingly
+static int open_helper_request(OpenHelper *helper, const char *name, uint32_t flags,
+                               int oflags, mode_t mode, IOHandle *fd, APIE *error_code) {
+	OpenHelperRequest request;
+	OpenHelperReply reply;
+	int name_length = strlen(name) + 1;
+	int length = offsetof(OpenHelperRequest, name) + name_length;
+	int rc;
+
+	request.flags = flags;
+	request.oflags = oflags;
+	request.mode = mode;
+
+	memcpy(request.name, name, name_length);
+
+	do {
+		rc = send(helper->socket_handle, &request, length, MSG_NOSIGNAL);
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc != length) {
+		return -1;
+	}
+
+	do {
+		rc = recvfd(helper->socket_handle, fd, &reply, sizeof(reply));
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc < 0) {
+		return -1;
+	}
+
+	*error_code = reply.error_code;
+	errno = reply.error_number;
+
+	if (*error_code == API_E_SUCCESS && *fd < 0) {
+		*error_code = API_E_INTERNAL_ERROR;
+		errno = EBADF;
+	} else if (*error_code != API_E_SUCCESS && *fd >= 0) {
+		close(*fd);
+	}
+
+	return 0;
+}
+
+int open_helper_init(void) {
+	log_debug("Initializing open helper subsystem");
+
+	_max_helper_count = config_get_option_value("file.open_helpers")->integer;
+
+	if (_max_helper_count > OPEN_HELPER_MAX_COUNT) {
+		_max_helper_count = OPEN_HELPER_MAX_COUNT;
+	}
+
+	mutex_create(&_mutex);
+
+	return 0;
+}
+
+void open_helper_exit(void) {
+	log_debug("Shutting down open helper subsystem");
+
+	open_helper_log_statistics();
+
+	int i;
+
+	for (i = 0; i < OPEN_HELPER_MAX_COUNT; ++i) {
+		if (_helpers[i].running) {
+			open_helper_destroy(&_helpers[i]);
+
+			_helpers[i].running = false;
+		}
+	}
+
+	_helper_count = 0;
+
+	mutex_destroy(&_mutex);
+}
+
+void open_helper_log_statistics(void) {
+	mutex_lock(&_mutex);
+
+	log_info("Open helpers: %d of %d running, %u open(s) through helpers, %u forked open(s), %u spawn(s), %u eviction(s)",
+	         _helper_count, _max_helper_count, _helper_opens, _forked_opens,
+	         _helper_spawns, _helper_evictions);
+
+	mutex_unlock(&_mutex);
+}
+
+// opens the file as the given user and group, using a persistent helper
+// process if possible.
+// NOTE: assumes that name is absolute (starts with '/')
+APIE open_helper_open(const char *name, uint32_t flags, int oflags,
+                      mode_t mode, uint32_t uid, uint32_t gid, IOHandle *fd) {
+	APIE error_code;
+	OpenHelper *helper;
+	OpenHelper evicted;
+	OpenHelper failed;
+	int rc;
+
+	if (_max_helper_count > 0 && strlen(name) < PATH_MAX) {
+		mutex_lock(&_mutex);
+
+		helper = open_helper_acquire(uid, gid, &evicted);
+
+		mutex_unlock(&_mutex);
+
+		if (evicted.running) {
+			open_helper_destroy(&evicted);
+		}
+
+		if (helper != NULL && helper->socket_handle < 0) {
+			if (open_helper_spawn(helper) < 0) {
+				open_helper_release(helper, false, &failed);
+
+				helper = NULL;
+			} else {
+				mutex_lock(&_mutex);
+
+				++_helper_spawns;
+
+				mutex_unlock(&_mutex);
+			}
+		}
+
+		if (helper != NULL) {
+			rc = open_helper_request(helper, name, flags, oflags, mode, fd, &error_code);
+
+			if (rc >= 0) {
+				open_helper_release(helper, true, NULL);
+
+				mutex_lock(&_mutex);
+
+				++_helper_opens;
+
+				mutex_unlock(&_mutex);
+
+				if (error_code == API_E_SUCCESS) {
+					return API_E_SUCCESS;
+				}
+
+				if (errno == ENOENT) {
+					log_debug("Could not open non-existing file '%s'", name);
+				} else if ((flags & (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE)) ==
+				           (FILE_FLAG_CREATE | FILE_FLAG_EXCLUSIVE) && errno == EEXIST) {
+					log_debug("Could not exclusively create already existing file '%s'", name);
+				} else {
+					log_error("Could not open file '%s' with flags 0x%04X as %u:%u: %s (%d)",
+					          name, flags, uid, gid, get_errno_name(errno), errno);
+				}
+
+				return error_code;
+			}
+
+			log_warn("Open helper for %u:%u (pid: %u) failed, falling back to forking: %s (%d)",
+			         uid, gid, helper->pid, get_errno_name(errno), errno);
+
+			open_helper_release(helper, false, &failed);
+			open_helper_destroy(&failed);
+		}
+	}
+
+	mutex_lock(&_mutex);
+
+	++_forked_opens;
+
+	mutex_unlock(&_mutex);
+
+	return open_helper_open_forked(name, flags, oflags, mode, uid, gid, fd);
+}
@@ -0,0 +1,255 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pool.c: Slab pool allocator for fixed-size items
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * objects and other small fixed-size structs are allocated and freed at a high
+ * rate, for example while listing a directory or uploading a file in chunks.
+ * instead of calling calloc and free for each of them, a pool allocates slabs
+ * of multiple items at once and keeps freed items in a free list for reuse.
+ * slabs are never returned to the system before pool_exit is called. this
+ * bounds the memory use of a pool by its high-water mark and avoids heap
+ * fragmentation in a daemon that runs for months.
+ *
+ * global pools are statically initialized with POOL_INITIALIZER and register
+ * themselves on their first allocation, so pool_log_statistics and pool_exit
+ * can find them. pools created with pool_create are not registered, they are
+ * owned by another struct that releases them with pool_clear. this allows to
+ * use a pool as an arena whose items are all freed at once. the usage of all
+ * these arenas is summed up for pool_log_statistics. pools are not
+ * thread-safe and must only be used from the event loop thread.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "pool.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+// items and the slab header are aligned to 8 bytes, this is enough for all
+// structs allocated from pools, including their uint64_t members
+#define POOL_ALIGNMENT 8
+#define POOL_ALIGN(size) (((size) + POOL_ALIGNMENT - 1) & ~(POOL_ALIGNMENT - 1))
+#define POOL_SLAB_HEADER_SIZE POOL_ALIGN((int)sizeof(void *))
+
+static Pool *_registered_pools = NULL;
+
+// summed up usage of all pools created with pool_create
+static struct {
+	uint32_t allocations;
+	uint32_t frees;
+	int slab_count;
+	int slab_bytes;
+	int in_use;
+	int high_water_mark;
+} _arena_statistics;
+
+static int pool_get_item_stride(Pool *pool) {
+	// a free item stores the pointer to the next free item in its first bytes
+	if (pool->item_size < (int)sizeof(void *)) {
+		return POOL_ALIGN((int)sizeof(void *));
+	}
+
+	return POOL_ALIGN(pool->item_size);
+}
+
+static int pool_get_slab_size(Pool *pool) {
+	return POOL_SLAB_HEADER_SIZE + pool_get_item_stride(pool) * pool->slab_length;
+}
+
+static int pool_add_slab(Pool *pool) {
+	int stride = pool_get_item_stride(pool);
+	uint8_t *slab;
+	uint8_t *item;
+	int i;
+
+	slab = malloc(pool_get_slab_size(pool));
+
+	if (slab == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	*(void **)slab = pool->slabs;
+	pool->slabs = slab;
+
+	// push items in reverse order, so they are handed out in address order
+	for (i = pool->slab_length - 1; i >= 0; --i) {
+		item = slab + POOL_SLAB_HEADER_SIZE + stride * i;
+
+		*(void **)item = pool->free_items;
+		pool->free_items = item;
+	}
+
+	++pool->slab_count;
+
+	if (!pool->global) {
+		++_arena_statistics.slab_count;
+		_arena_statistics.slab_bytes += pool_get_slab_size(pool);
+	}
+
+	return 0;
+}
+
+static void pool_release_slabs(Pool *pool) {
+	void *slab;
+
+	if (!pool->global) {
+		_arena_statistics.slab_count -= pool->slab_count;
+		_arena_statistics.slab_bytes -= pool->slab_count * pool_get_slab_size(pool);
+		_arena_statistics.in_use -= pool->in_use;
+	}
+
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = *(void **)slab;
+
+		free(slab);
+	}
+
+	pool->free_items = NULL;
+	pool->slab_count = 0;
+	pool->in_use = 0;
+}
+
+void pool_exit(void) {
+	Pool *pool;
+
+	log_debug("Shutting down pool subsystem");
+
+	pool_log_statistics();
+
+	while (_registered_pools != NULL) {
+		pool = _registered_pools;
+		_registered_pools = pool->next_registered;
+
+		if (pool->in_use > 0) {
+			log_warn("Releasing %s pool while %d item(s) are still in use",
+			         pool->name, pool->in_use);
+		}
+
+		pool_release_slabs(pool);
+
+		pool->registered = false;
+		pool->next_registered = NULL;
+	}
+}
+
+void pool_create(Pool *pool, const char *name, int item_size, int slab_length) {
+	memset(pool, 0, sizeof(Pool));
+
+	pool->name = name;
+	pool->item_size = item_size;
+	pool->slab_length = slab_length;
+	pool->global = false;
+}
+
+// releases all slabs of the pool at once. all items allocated from the pool
+// become invalid, even if they were not freed before. the pool can be used
+// again afterwards
+void pool_clear(Pool *pool) {
+	pool->frees += pool->in_use;
+
+	if (!pool->global) {
+		_arena_statistics.frees += pool->in_use;
+	}
+
+	pool_release_slabs(pool);
+}
+
+// returns a zeroed item, or NULL and sets errno to ENOMEM
+void *pool_allocate(Pool *pool) {
+	void *item;
+
+	if (pool->global && !pool->registered) {
+		pool->next_registered = _registered_pools;
+		_registered_pools = pool;
+		pool->registered = true;
+	}
+
+	if (pool->free_items == NULL && pool_add_slab(pool) < 0) {
+		log_error("Could not allocate slab for %s pool: %s (%d)",
+		          pool->name, get_errno_name(errno), errno);
+
+		return NULL;
+	}
+
+	item = pool->free_items;
+	pool->free_items = *(void **)item;
+
+	memset(item, 0, pool->item_size);
+
+	++pool->allocations;
+	++pool->in_use;
+
+	if (pool->in_use > pool->high_water_mark) {
+		pool->high_water_mark = pool->in_use;
+	}
+
+	if (!pool->global) {
+		++_arena_statistics.allocations;
+		++_arena_statistics.in_use;
+
+		if (_arena_statistics.in_use > _arena_statistics.high_water_mark) {
+			_arena_statistics.high_water_mark = _arena_statistics.in_use;
+		}
+	}
+
+	return item;
+}
+
+void pool_free(Pool *pool, void *item) {
+	if (item == NULL) {
+		return;
+	}
+
+	*(void **)item = pool->free_items;
+	pool->free_items = item;
+
+	++pool->frees;
+	--pool->in_use;
+
+	if (!pool->global) {
+		++_arena_statistics.frees;
+		--_arena_statistics.in_use;
+	}
+}
+
+void pool_log_statistics(void) {
+	Pool *pool;
+
+	for (pool = _registered_pools; pool != NULL; pool = pool->next_registered) {
+		log_info("Pool %s: %u allocation(s), %u free(s), %d item(s) in use, high-water mark %d, %d slab(s) of %d item(s) with %d byte(s) each",
+		         pool->name, pool->allocations, pool->frees, pool->in_use,
+		         pool->high_water_mark, pool->slab_count, pool->slab_length,
+		         pool_get_item_stride(pool));
+	}
+
+	log_info("Arena pools: %u allocation(s), %u free(s), %d item(s) in use, high-water mark %d, %d slab(s) with %d byte(s) in total",
+	         _arena_statistics.allocations, _arena_statistics.frees,
+	         _arena_statistics.in_use, _arena_statistics.high_water_mark,
+	         _arena_statistics.slab_count, _arena_statistics.slab_bytes);
+}
@@ -0,0 +1,59 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pool.h: Slab pool allocator for fixed-size items
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef REDAPID_POOL_H
+#define REDAPID_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct _Pool Pool;
+
+struct _Pool {
+	const char *name;
+	int item_size;
+	int slab_length; // number of items per slab
+	void *slabs; // singly linked list of all slabs
+	void *free_items; // singly linked list of free items
+	bool global; // registered on first use and released by pool_exit
+	bool registered;
+	Pool *next_registered;
+	uint32_t allocations;
+	uint32_t frees;
+	int slab_count;
+	int in_use;
+	int high_water_mark;
+};
+
+#define POOL_INITIALIZER(name, type, slab_length) \
+	{ name, sizeof(type), slab_length, NULL, NULL, true, false, NULL, 0, 0, 0, 0, 0 }
+
+void pool_exit(void);
+
+void pool_create(Pool *pool, const char *name, int item_size, int slab_length);
+void pool_clear(Pool *pool);
+
+void *pool_allocate(Pool *pool);
+void pool_free(Pool *pool, void *item);
+
+void pool_log_statistics(void);
+
+#endif // REDAPID_POOL_H
@@ -222,11 +222,12 @@ static void process_handle_state_change(void *opaque) {
 	}
 
 	// only send a process-state-changed callback if there is at least one
-	// external reference to the process object. otherwise there is no one that
-	// could be interested in this callback anyway. also this logic avoids
-	// sending process-state-changed callbacks for scheduled program executions
-	if (process->base.external_reference_count > 0) {
-		api_send_process_state_changed_callback(process->base.id, change.state,
+	// external reference to the process object from a session that subscribed
+	// to it. otherwise there is no one that could be interested in this
+	// callback anyway. also this logic avoids sending process-state-changed
+	// callbacks for scheduled program executions
+	if (object_has_callback_subscriber(&process->base, OBJECT_CALLBACK_PROCESS_STATE_CHANGED)) {
+		api_send_process_state_changed_callback(&process->base, change.state,
 		                                        change.timestamp, change.exit_code);
 	}
 
@@ -599,6 +600,11 @@ APIE process_spawn(ObjectID executable_id, ObjectID arguments_id,
 
 	phase = 10;
 
+	// the child reads and writes at the current positions of the file objects
+	file_synchronize(stdin);
+	file_synchronize(stdout);
+	file_synchronize(stderr);
+
 	// fork
 	log_debug("Forking to spawn child process (executable: %s)", executable->buffer);
 
@@ -34,9 +34,17 @@
 #include "api.h"
 #include "directory.h"
 #include "inventory.h"
+#include "worker.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+typedef struct {
+	Program *program; // pinned by an internal reference
+	ProgramPurgedFunction purged;
+	void *opaque;
+	APIE error_code;
+} ProgramPurgeJob;
+
 static const char *_identifier_alphabet =
 	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-";
 
@@ -113,8 +121,8 @@ static void program_report_process_process_spawn(void *opaque) {
 	// only send a program-process-spawned callback if there is at least one
 	// external reference to the program object. otherwise there is no one that
 	// could be interested in this callback anyway
-	if (program->base.external_reference_count > 0) {
-		api_send_program_process_spawned_callback(program->base.id);
+	if (object_has_callback_subscriber(&program->base, OBJECT_CALLBACK_PROGRAM_PROCESS_SPAWNED)) {
+		api_send_program_process_spawned_callback(&program->base);
 	}
 }
 
@@ -124,8 +132,8 @@ static void program_report_scheduler_state_change(void *opaque) {
 	// only send a program-scheduler-error-occurred callback if there is at
 	// least one external reference to the program object. otherwise there is
 	// no one that could be interested in this callback anyway
-	if (program->base.external_reference_count > 0) {
-		api_send_program_scheduler_state_changed_callback(program->base.id);
+	if (object_has_callback_subscriber(&program->base, OBJECT_CALLBACK_PROGRAM_SCHEDULER_STATE_CHANGED)) {
+		api_send_program_scheduler_state_changed_callback(&program->base);
 	}
 }
 
@@ -467,14 +475,9 @@ cleanup:
 	return phase == 8 ? API_E_SUCCESS : error_code;
 }
 
-// public API
-APIE program_purge(Program *program, uint32_t cookie) {
+static APIE program_prepare_purge(Program *program, uint32_t cookie) {
 	uint32_t expected_cookie = 0;
 	char *p;
-	struct timeval timestamp;
-	char tmp[1024];
-	APIE error_code;
-	uint32_t counter = 0;
 
 	if (program->purged) {
 		log_warn("Program object (id: %u, identifier: %s) is purged",
@@ -499,6 +502,18 @@ APIE program_purge(Program *program, uint32_t cookie) {
 	// shutdown scheduler, this will also kill any remaining process
 	program_scheduler_shutdown(&program->scheduler);
 
+	return API_E_SUCCESS;
+}
+
+// moves the program root directory to /tmp. this blocks on the SD card, but
+// only uses the locked identifier and root directory string objects read-only.
+// it is safe to call it on a worker thread while the program object is pinned
+static APIE program_move_root_directory(Program *program) {
+	struct timeval timestamp;
+	char tmp[1024];
+	APIE error_code;
+	uint32_t counter = 0;
+
 	// move program root directory to /tmp/purged-program-<identifier>-<timestamp>
 	if (gettimeofday(&timestamp, NULL) < 0) {
 		timestamp.tv_sec = time(NULL);
@@ -545,13 +560,6 @@ APIE program_purge(Program *program, uint32_t cookie) {
 			return error_code;
 		}
 
-		program->purged = true;
-
-		log_debug("Purged program object (id: %u, identifier: %s)",
-		          program->base.id, program->identifier->buffer);
-
-		object_remove_internal_reference(&program->base);
-
 		return API_E_SUCCESS;
 	}
 
@@ -561,6 +569,108 @@ APIE program_purge(Program *program, uint32_t cookie) {
 	return API_E_INTERNAL_ERROR;
 }
 
+static void program_finish_purge(Program *program) {
+	program->purged = true;
+
+	log_debug("Purged program object (id: %u, identifier: %s)",
+	          program->base.id, program->identifier->buffer);
+
+	object_remove_internal_reference(&program->base);
+}
+
+// public API
+APIE program_purge(Program *program, uint32_t cookie) {
+	APIE error_code;
+
+	error_code = program_prepare_purge(program, cookie);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	error_code = program_move_root_directory(program);
+
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
+	}
+
+	program_finish_purge(program);
+
+	return API_E_SUCCESS;
+}
+
+static void program_work_purge_job(void *opaque) {
+	ProgramPurgeJob *job = opaque;
+
+	job->error_code = program_move_root_directory(job->program);
+}
+
+static void program_complete_purge_job(void *opaque) {
+	ProgramPurgeJob *job = opaque;
+
+	// the program was marked as purged while its root directory was moved
+	job->program->purged = false;
+
+	if (job->error_code == API_E_SUCCESS) {
+		program_finish_purge(job->program);
+	}
+
+	job->purged(job->error_code, job->opaque);
+
+	object_remove_internal_reference(&job->program->base);
+
+	free(job);
+}
+
+// like program_purge, but the program root directory is moved on a worker
+// thread. the program object is pinned and already marked as purged until
+// then, so no other request can change it in the meantime. if this function
+// returns API_E_SUCCESS then the purged function is called exactly once, after
+// the worker thread is done
+APIE program_purge_deferred(Program *program, uint32_t cookie,
+                            ProgramPurgedFunction purged, void *opaque) {
+	APIE error_code;
+	ProgramPurgeJob *job;
+
+	job = calloc(1, sizeof(ProgramPurgeJob));
+
+	if (job == NULL) {
+		log_error("Could not allocate program purge job: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return API_E_NO_FREE_MEMORY;
+	}
+
+	error_code = program_prepare_purge(program, cookie);
+
+	if (error_code != API_E_SUCCESS) {
+		free(job);
+
+		return error_code;
+	}
+
+	job->program = program;
+	job->purged = purged;
+	job->opaque = opaque;
+
+	object_add_internal_reference(&program->base);
+
+	program->purged = true;
+
+	error_code = worker_submit(program_work_purge_job, program_complete_purge_job, job);
+
+	if (error_code != API_E_SUCCESS) {
+		program->purged = false;
+
+		object_remove_internal_reference(&program->base);
+		free(job);
+
+		return error_code;
+	}
+
+	return API_E_SUCCESS;
+}
+
 // public API
 APIE program_get_identifier(Program *program, Session *session,
                             ObjectID *identifier_id) {
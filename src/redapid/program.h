@@ -42,11 +42,15 @@ typedef struct {
 	String *none_message;
 } Program;
 
+typedef void (*ProgramPurgedFunction)(APIE error_code, void *opaque);
+
 APIE program_load(const char *identifier, const char *root_directory,
                   const char *config_filename);
 
 APIE program_define(ObjectID identifier_id, Session *session, ObjectID *id);
 APIE program_purge(Program *program, uint32_t cookie);
+APIE program_purge_deferred(Program *program, uint32_t cookie,
+                            ProgramPurgedFunction purged, void *opaque);
 
 APIE program_get_identifier(Program *program, Session *session,
                             ObjectID *identifier_id);
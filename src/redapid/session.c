@@ -21,8 +21,11 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <daemonlib/log.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
 #include "session.h"
@@ -30,11 +33,96 @@
 #include "inventory.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+static Pool _session_pool = POOL_INITIALIZER("session", Session, 16);
 
+#define SESSION_INITIAL_EXTERNAL_REFERENCE_INDEX_LENGTH 16 // has to be a power of two
+
+// session expiry is driven by a single timer that ticks once per second while
+// there are sessions waiting to expire. sessions are kept in a timing wheel
+// with one slot per second. the wheel is longer than the maximum lifetime of
+// a session, so a single level wheel suffices and every session in a slot is
+// due when the slot is processed
+#define SESSION_EXPIRY_WHEEL_LENGTH 4096 // has to be a power of two
+
+#if SESSION_EXPIRY_WHEEL_LENGTH <= SESSION_MAX_LIFETIME + 1
+	#error SESSION_EXPIRY_WHEEL_LENGTH is too short for SESSION_MAX_LIFETIME
+#endif
+
+static Timer _expiry_timer;
+static Node _expiry_wheel[SESSION_EXPIRY_WHEEL_LENGTH];
+static uint32_t _expiry_processed_tick; // last processed tick
+static int _expiry_scheduled_count; // number of sessions in the wheel
+
+// each session indexes its external references by object in a hash table with
+// chained buckets. this makes finding the external reference for an object and
+// session pair independent of the number of sessions sharing the object
+static int session_get_external_reference_bucket(Session *session, void *object) {
+	uint32_t hash = (uint32_t)((uintptr_t)object >> 3) * 2654435761u;
+
+	return (hash ^ (hash >> 16)) & (session->external_reference_index_length - 1);
+}
+
+static int session_grow_external_reference_index(Session *session) {
+	ExternalReference **old_index = session->external_reference_index;
+	int old_length = session->external_reference_index_length;
+	int length;
+	ExternalReference **index;
+	ExternalReference *external_reference;
+	int bucket;
+	int i;
+
+	if (old_length == 0) {
+		length = SESSION_INITIAL_EXTERNAL_REFERENCE_INDEX_LENGTH;
+	} else {
+		length = old_length * 2;
+	}
+
+	index = calloc(length, sizeof(ExternalReference *));
+
+	if (index == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	session->external_reference_index = index;
+	session->external_reference_index_length = length;
+
+	for (i = 0; i < old_length; ++i) {
+		while (old_index[i] != NULL) {
+			external_reference = old_index[i];
+			old_index[i] = external_reference->index_next;
+
+			bucket = session_get_external_reference_bucket(session, external_reference->object);
+
+			external_reference->index_next = index[bucket];
+			index[bucket] = external_reference;
+		}
+	}
+
+	free(old_index);
+
+	return 0;
+}
+
+// the external references of a session are allocated from an arena owned by
+// the session. they are not freed one by one here, instead the whole arena is
+// released at once after all external references got unlinked. the objects
+// themselves are not part of the arena, they can also be used internally and
+// follow the normal reference counting rules
 static void session_remove_external_references(Session *session) {
 	ExternalReference *external_reference;
 	Object *object;
 
+	// clear the index first, so it doesn't refer to external references that
+	// are already unlinked while objects get destroyed
+	if (session->external_reference_index != NULL) {
+		memset(session->external_reference_index, 0,
+		       session->external_reference_index_length * sizeof(ExternalReference *));
+	}
+
+	session->external_reference_index_count = 0;
+
 	while (session->external_reference_sentinel.next != &session->external_reference_sentinel) {
 		external_reference = containerof(session->external_reference_sentinel.next, ExternalReference, session_node);
 		object = external_reference->object;
@@ -49,9 +137,9 @@ static void session_remove_external_references(Session *session) {
 		if (object->internal_reference_count == 0 && object->external_reference_count == 0) {
 			inventory_remove_object(object); // calls object_destroy
 		}
-
-		free(external_reference);
 	}
+
+	pool_clear(&session->external_reference_arena);
 }
 
 static void session_expire_helper(Session *session) {
@@ -67,13 +155,202 @@ static void session_expire_helper(Session *session) {
 	inventory_remove_session(session); // calls session_destroy
 }
 
-static void session_handle_expire(void *opaque) {
-	Session *session = opaque;
+// the wheel advances by the monotonic clock in whole seconds instead of by
+// counting timer events. if the event loop was blocked for a while then the
+// skipped slots are caught up on the next timer event
+static uint32_t session_get_current_tick(void) {
+	struct timespec ts;
 
-	log_debug("Lifetime of session (id: %u) ended, expiring it",
-	          session->id);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	session_expire_helper(session);
+	return (uint32_t)ts.tv_sec;
+}
+
+static bool session_is_expiry_scheduled(Session *session) {
+	return session->expiry_node.next != &session->expiry_node;
+}
+
+static void session_unschedule_expiry(Session *session) {
+	if (!session_is_expiry_scheduled(session)) {
+		return;
+	}
+
+	node_remove(&session->expiry_node);
+	node_reset(&session->expiry_node);
+
+	--_expiry_scheduled_count;
+}
+
+// a lifetime of zero means that the session never expires on its own
+static int session_schedule_expiry(Session *session, uint32_t lifetime) {
+	uint32_t current_tick = session_get_current_tick();
+
+	session_unschedule_expiry(session);
+
+	if (lifetime == 0) {
+		return 0;
+	}
+
+	if (_expiry_scheduled_count == 0) {
+		// the wheel is empty, there is nothing to catch up from the time the
+		// timer was stopped
+		_expiry_processed_tick = current_tick;
+
+		if (timer_configure(&_expiry_timer, 1000000, 1000000) < 0) {
+			return -1;
+		}
+	}
+
+	// the current second has already partly elapsed. schedule the expiry for
+	// the end of the last second of the lifetime, so a session expires between
+	// lifetime and lifetime plus one seconds from now, but never early
+	session->expiry_tick = current_tick + lifetime + 1;
+
+	node_insert_before(&_expiry_wheel[session->expiry_tick & (SESSION_EXPIRY_WHEEL_LENGTH - 1)],
+	                   &session->expiry_node);
+
+	++_expiry_scheduled_count;
+
+	return 0;
+}
+
+static void session_handle_expiry_timer(void *opaque) {
+	uint32_t current_tick = session_get_current_tick();
+	int i;
+	Node *slot;
+	Session *session;
+
+	(void)opaque;
+
+	// processing one round of the wheel is enough, all scheduled sessions
+	// are due within one round
+	for (i = 0; i < SESSION_EXPIRY_WHEEL_LENGTH &&
+	     _expiry_processed_tick != current_tick; ++i) {
+		++_expiry_processed_tick;
+
+		slot = &_expiry_wheel[_expiry_processed_tick & (SESSION_EXPIRY_WHEEL_LENGTH - 1)];
+
+		while (slot->next != slot) {
+			session = containerof(slot->next, Session, expiry_node);
+
+			session_unschedule_expiry(session);
+
+			log_debug("Lifetime of session (id: %u) ended, expiring it",
+			          session->id);
+
+			session_expire_helper(session);
+		}
+	}
+
+	_expiry_processed_tick = current_tick;
+
+	if (_expiry_scheduled_count == 0 && timer_configure(&_expiry_timer, 0, 0) < 0) {
+		log_error("Could not stop session expiry timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+int session_init(void) {
+	int i;
+
+	log_debug("Initializing session subsystem");
+
+	for (i = 0; i < SESSION_EXPIRY_WHEEL_LENGTH; ++i) {
+		node_reset(&_expiry_wheel[i]);
+	}
+
+	_expiry_processed_tick = session_get_current_tick();
+	_expiry_scheduled_count = 0;
+
+	if (timer_create_(&_expiry_timer, session_handle_expiry_timer, NULL) < 0) {
+		log_error("Could not create session expiry timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void session_exit(void) {
+	log_debug("Shutting down session subsystem");
+
+	timer_destroy(&_expiry_timer);
+}
+
+// allocates a new external reference with a count of zero, adds it to the
+// session list and index. the caller has to add it to the object list
+ExternalReference *session_allocate_external_reference(Session *session, void *object) {
+	ExternalReference *external_reference;
+	int bucket;
+
+	// keep the average bucket length at or below one. if growing the index
+	// fails then the buckets just get longer, so this is not an error
+	if (session->external_reference_index_count >= session->external_reference_index_length &&
+	    session_grow_external_reference_index(session) < 0 &&
+	    session->external_reference_index_length == 0) {
+		return NULL;
+	}
+
+	external_reference = pool_allocate(&session->external_reference_arena);
+
+	if (external_reference == NULL) {
+		return NULL;
+	}
+
+	node_reset(&external_reference->object_node);
+
+	node_reset(&external_reference->session_node);
+	node_insert_before(&session->external_reference_sentinel, &external_reference->session_node);
+
+	bucket = session_get_external_reference_bucket(session, object);
+
+	external_reference->index_next = session->external_reference_index[bucket];
+	session->external_reference_index[bucket] = external_reference;
+	++session->external_reference_index_count;
+
+	external_reference->object = object;
+	external_reference->session = session;
+	external_reference->count = 0;
+
+	return external_reference;
+}
+
+// removes the external reference from the session list and index and frees
+// it. the caller has to remove it from the object list
+void session_free_external_reference(Session *session, ExternalReference *external_reference) {
+	ExternalReference **link;
+
+	link = &session->external_reference_index[session_get_external_reference_bucket(session, external_reference->object)];
+
+	while (*link != NULL && *link != external_reference) {
+		link = &(*link)->index_next;
+	}
+
+	if (*link != NULL) {
+		*link = external_reference->index_next;
+		--session->external_reference_index_count;
+	}
+
+	node_remove(&external_reference->session_node);
+
+	pool_free(&session->external_reference_arena, external_reference);
+}
+
+ExternalReference *session_get_external_reference(Session *session, void *object) {
+	ExternalReference *external_reference;
+
+	if (session->external_reference_index_length == 0) {
+		return NULL;
+	}
+
+	external_reference = session->external_reference_index[session_get_external_reference_bucket(session, object)];
+
+	while (external_reference != NULL && external_reference->object != object) {
+		external_reference = external_reference->index_next;
+	}
+
+	return external_reference;
 }
 
 // public API
@@ -90,7 +367,7 @@ APIE session_create(uint32_t lifetime, SessionID *id) {
 	}
 
 	// allocate session
-	session = calloc(1, sizeof(Session));
+	session = pool_allocate(&_session_pool);
 
 	if (session == NULL) {
 		error_code = API_E_NO_FREE_MEMORY;
@@ -105,15 +382,25 @@ APIE session_create(uint32_t lifetime, SessionID *id) {
 
 	// initialize session
 	session->id = SESSION_ID_ZERO;
+	session->connection_id = 0;
 	session->external_reference_count = 0;
+	session->external_reference_index = NULL;
+	session->external_reference_index_length = 0;
+	session->external_reference_index_count = 0;
+
+	// the arena allocates its first slab with the first external reference.
+	// most sessions only hold a few references, keep the slabs small
+	pool_create(&session->external_reference_arena, "external-reference",
+	            sizeof(ExternalReference), 8);
 
 	node_reset(&session->external_reference_sentinel);
+	node_reset(&session->expiry_node);
 
-	// create expire timer
-	if (timer_create_(&session->timer, session_handle_expire, session) < 0) {
+	// schedule expiry
+	if (session_schedule_expiry(session, lifetime) < 0) {
 		error_code = api_get_error_code_from_errno();
 
-		log_error("Could not create session timer: %s (%d)",
+		log_error("Could not start session expiry timer: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		goto cleanup;
@@ -121,15 +408,6 @@ APIE session_create(uint32_t lifetime, SessionID *id) {
 
 	phase = 2;
 
-	if (timer_configure(&session->timer, (uint64_t)lifetime * 1000000, 0) < 0) {
-		error_code = api_get_error_code_from_errno();
-
-		log_error("Could not start session timer: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		goto cleanup;
-	}
-
 	// add to inventory
 	error_code = inventory_add_session(session);
 
@@ -146,10 +424,10 @@ APIE session_create(uint32_t lifetime, SessionID *id) {
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 2:
-		timer_destroy(&session->timer);
+		session_unschedule_expiry(session);
 
 	case 1:
-		free(session);
+		pool_free(&_session_pool, session);
 
 	default:
 		break;
@@ -177,10 +455,12 @@ void session_destroy(Session *session) {
 		}
 	}
 
-	timer_destroy(&session->timer);
+	session_unschedule_expiry(session);
 	session_remove_external_references(session);
 
-	free(session);
+	free(session->external_reference_index);
+
+	pool_free(&_session_pool, session);
 }
 
 // public API
@@ -209,10 +489,10 @@ APIE session_keep_alive(Session *session, uint32_t lifetime) {
 		return API_E_OUT_OF_RANGE;
 	}
 
-	if (timer_configure(&session->timer, (uint64_t)lifetime * 1000000, 0) < 0) {
+	if (session_schedule_expiry(session, lifetime) < 0) {
 		error_code = api_get_error_code_from_errno();
 
-		log_error("Could not configure session timer: %s (%d)",
+		log_error("Could not start session expiry timer: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		return error_code;
@@ -223,3 +503,13 @@ APIE session_keep_alive(Session *session, uint32_t lifetime) {
 
 	return API_E_SUCCESS;
 }
+
+// public API
+APIE session_release_objects(Session *session) {
+	log_debug("Releasing %d external reference(s) of session (id: %u)",
+	          session->external_reference_count, session->id);
+
+	session_remove_external_references(session);
+
+	return API_E_SUCCESS;
+}
@@ -27,10 +27,10 @@
 
 #include <daemonlib/node.h>
 #include <daemonlib/packet.h>
-#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
 #include "api_error.h"
+#include "pool.h"
 
 typedef uint16_t SessionID;
 
@@ -40,27 +40,44 @@ typedef uint16_t SessionID;
 #define SESSION_MAX_LIFETIME 3600 // limit maximum session lifetime to 1 hour
 
 typedef struct _Session Session;
+typedef struct _ExternalReference ExternalReference;
 
-typedef struct {
+struct _ExternalReference {
 	Node object_node;
 	Node session_node;
+	ExternalReference *index_next; // next external reference in the same index bucket
 	void *object;
 	Session *session;
 	int count;
-} ExternalReference;
+	uint16_t callback_mask; // ObjectCallback bitmask of subscribed callbacks
+};
 
 struct _Session {
 	SessionID id;
-	Timer timer;
+	uint32_t connection_id; // brickd connection or local client that last used the session, 0 if none
+	Node expiry_node; // links the session into its expiry wheel slot
+	uint32_t expiry_tick;
 	Node external_reference_sentinel;
 	int external_reference_count;
+	Pool external_reference_arena;
+	ExternalReference **external_reference_index; // hash buckets keyed by object
+	int external_reference_index_length; // number of buckets, power of two
+	int external_reference_index_count; // number of indexed external references
 };
 
+int session_init(void);
+void session_exit(void);
+
 APIE session_create(uint32_t lifetime, SessionID *id);
 void session_destroy(Session *session);
 
+ExternalReference *session_allocate_external_reference(Session *session, void *object);
+void session_free_external_reference(Session *session, ExternalReference *external_reference);
+ExternalReference *session_get_external_reference(Session *session, void *object);
+
 APIE session_expire(Session *session);
 PacketE session_expire_unchecked(Session *session);
 APIE session_keep_alive(Session *session, uint32_t lifetime);
+APIE session_release_objects(Session *session);
 
 #endif // REDAPID_SESSION_H
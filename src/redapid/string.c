@@ -19,7 +19,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#define _GNU_SOURCE // for asprintf from stdio.h
+#define _GNU_SOURCE // for strnlen from string.h
 
 #include <errno.h>
 #include <stdarg.h>
@@ -34,15 +34,27 @@
 #include "string.h"
 
 #include "inventory.h"
+#include "pool.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+static Pool _string_pool = POOL_INITIALIZER("string", String, 64);
+
+// most strings are short, for example directory entry names. such strings
+// are stored in the inline buffer of the String object to avoid a separate
+// heap allocation. the buffer is moved to the heap if the string outgrows the
+// inline buffer
+static bool string_has_inline_buffer(String *string) {
+	return string->buffer == string->inline_buffer;
+}
 
 static void string_destroy(Object *object) {
 	String *string = (String *)object;
 
-	free(string->buffer);
+	if (!string_has_inline_buffer(string)) {
+		free(string->buffer);
+	}
 
-	free(string);
+	pool_free(&_string_pool, string);
 }
 
 static void string_signature(Object *object, char *signature) {
@@ -69,7 +81,16 @@ static APIE string_reserve(String *string, uint32_t reserve) {
 	}
 
 	allocated = GROW_ALLOCATION(reserve);
-	buffer = realloc(string->buffer, allocated);
+
+	if (string_has_inline_buffer(string)) {
+		buffer = malloc(allocated);
+
+		if (buffer != NULL) {
+			memcpy(buffer, string->inline_buffer, string->length + 1);
+		}
+	} else {
+		buffer = realloc(string->buffer, allocated);
+	}
 
 	if (buffer == NULL) {
 		log_error("Could not reallocate string object (id: %u) buffer to %u bytes: %s (%d)",
@@ -101,18 +122,12 @@ static APIE string_create(uint32_t reserve, char *buffer, Session *session,
 
 		++reserve; // one extra byte for the NULL-terminator
 
-		// allocate buffer
 		length = 0;
-		allocated = GROW_ALLOCATION(reserve);
-		buffer = malloc(allocated);
-
-		if (buffer == NULL) {
-			error_code = API_E_NO_FREE_MEMORY;
-
-			log_error("Could not allocate buffer for %u bytes: %s (%d)",
-			          allocated, get_errno_name(ENOMEM), ENOMEM);
 
-			goto cleanup;
+		if (reserve <= STRING_INLINE_BUFFER_LENGTH) {
+			allocated = STRING_INLINE_BUFFER_LENGTH;
+		} else {
+			allocated = GROW_ALLOCATION(reserve);
 		}
 	} else {
 		length = strlen(buffer);
@@ -128,10 +143,8 @@ static APIE string_create(uint32_t reserve, char *buffer, Session *session,
 		allocated = length + 1;
 	}
 
-	phase = 1;
-
 	// allocate string object
-	*string = calloc(1, sizeof(String));
+	*string = pool_allocate(&_string_pool);
 
 	if (*string == NULL) {
 		error_code = API_E_NO_FREE_MEMORY;
@@ -142,6 +155,26 @@ static APIE string_create(uint32_t reserve, char *buffer, Session *session,
 		goto cleanup;
 	}
 
+	phase = 1;
+
+	// allocate buffer, if it doesn't fit into the inline buffer
+	if (!external) {
+		if (allocated <= STRING_INLINE_BUFFER_LENGTH) {
+			buffer = (*string)->inline_buffer;
+		} else {
+			buffer = malloc(allocated);
+
+			if (buffer == NULL) {
+				error_code = API_E_NO_FREE_MEMORY;
+
+				log_error("Could not allocate buffer for %u bytes: %s (%d)",
+				          allocated, get_errno_name(ENOMEM), ENOMEM);
+
+				goto cleanup;
+			}
+		}
+	}
+
 	phase = 2;
 
 	// create string object
@@ -162,13 +195,13 @@ static APIE string_create(uint32_t reserve, char *buffer, Session *session,
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 2:
-		free(*string);
-
-	case 1:
-		if (!external) {
+		if (!external && !string_has_inline_buffer(*string)) {
 			free(buffer);
 		}
 
+	case 1:
+		pool_free(&_string_pool, *string);
+
 	default:
 		break;
 	}
@@ -213,24 +246,47 @@ APIE string_wrap(const char *buffer, Session *session,
 APIE string_asprintf(Session *session, uint32_t object_create_flags,
                      ObjectID *id, String **object, const char *format, ...) {
 	va_list arguments;
+	char inline_buffer[STRING_INLINE_BUFFER_LENGTH];
 	char *buffer;
 	int rc;
 	APIE error_code;
 	String *string;
 
+	// try to format into a stack buffer first. if the result fits then it
+	// will be stored in the inline buffer of the string object
 	va_start(arguments, format);
 
-	rc = vasprintf(&buffer, format, arguments);
+	rc = vsnprintf(inline_buffer, sizeof(inline_buffer), format, arguments);
 
 	va_end(arguments);
 
 	if (rc < 0) {
+		log_error("Could not format string object: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return API_E_INTERNAL_ERROR;
+	}
+
+	if (rc < (int)sizeof(inline_buffer)) {
+		return string_wrap(inline_buffer, session, object_create_flags, id, object);
+	}
+
+	// too long for the inline buffer, format again into a heap buffer
+	buffer = malloc(rc + 1);
+
+	if (buffer == NULL) {
 		log_error("Could not allocate string object: %s (%d)",
 		          get_errno_name(ENOMEM), ENOMEM);
 
 		return API_E_NO_FREE_MEMORY;
 	}
 
+	va_start(arguments, format);
+
+	vsnprintf(buffer, rc + 1, format, arguments);
+
+	va_end(arguments);
+
 	error_code = string_create(0, buffer, session, object_create_flags, &string);
 
 	if (error_code != API_E_SUCCESS) {
@@ -332,13 +388,11 @@ APIE string_set_chunk(String *string, uint32_t offset, char *buffer) {
 		return API_E_SUCCESS;
 	}
 
-	// reallocate if necessary
-	if (offset + length > string->allocated) {
-		error_code = string_reserve(string, offset + length);
+	// reallocate if necessary, string_reserve accounts for the NULL-terminator
+	error_code = string_reserve(string, offset + length);
 
-		if (error_code != API_E_SUCCESS) {
-			return error_code;
-		}
+	if (error_code != API_E_SUCCESS) {
+		return error_code;
 	}
 
 	// fill gap between old buffer end and offset with whitespace
@@ -28,12 +28,15 @@
 #define STRING_MAX_SET_CHUNK_BUFFER_LENGTH 58
 #define STRING_MAX_GET_CHUNK_BUFFER_LENGTH 63
 
+#define STRING_INLINE_BUFFER_LENGTH 40 // includes NULL-terminator
+
 typedef struct {
 	Object base;
 
-	char *buffer; // is always NULL-terminated
+	char *buffer; // is always NULL-terminated, points to inline_buffer for short strings
 	uint32_t length; // <= INT32_MAX, excludes NULL-terminator
 	uint32_t allocated; // <= INT32_MAX + 1, includes NULL-terminator
+	char inline_buffer[STRING_INLINE_BUFFER_LENGTH];
 } String;
 
 APIE string_wrap(const char *buffer, Session *session,
@@ -0,0 +1,357 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * uring.c: io_uring based I/O engine for file objects
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the API transfers file content in chunks of 60 to 62 bytes. reading each
+ * chunk with its own read syscall makes the syscall overhead dominate large
+ * transfers. if redapid is build with WITH_IO_URING=yes then file objects can
+ * submit larger reads to an io_uring instead. the completions are reaped on
+ * the event loop thread, signaled by an eventfd that is registered with the
+ * ring. the buffer is then handed out chunk by chunk from memory.
+ *
+ * if redapid is build without io_uring support or the kernel doesn't support
+ * io_uring then uring_is_available returns false and file objects use plain
+ * read syscalls as before.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef REDAPID_WITH_IO_URING
+	#include <liburing.h>
+#endif
+
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "uring.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#ifdef REDAPID_WITH_IO_URING
+
+#define URING_QUEUE_DEPTH 64
+
+struct _URingRequest {
+	URingFunction complete; // NULL if abandoned
+	void *opaque;
+	void *buffer; // freed on completion if abandoned
+	struct iovec iov;
+};
+
+static bool _available = false;
+static struct io_uring _ring;
+static IOHandle _completion_eventfd = IO_HANDLE_INVALID;
+static int _requests_in_flight = 0;
+static uint32_t _submitted_reads = 0;
+static uint32_t _completed_reads = 0;
+static uint32_t _abandoned_reads = 0;
+static uint64_t _bytes_read = 0;
+
+static void uring_complete_request(URingRequest *request, int result) {
+	// a request whose submission failed was replaced by a nop without data
+	if (request == NULL) {
+		return;
+	}
+
+	--_requests_in_flight;
+	++_completed_reads;
+
+	if (result > 0) {
+		_bytes_read += result;
+	}
+
+	if (request->complete != NULL) {
+		request->complete(result, request->opaque);
+	} else {
+		free(request->buffer);
+	}
+
+	free(request);
+}
+
+static void uring_handle_completion(void *opaque) {
+	uint64_t value;
+	struct io_uring_cqe *cqe;
+	URingRequest *request;
+	int result;
+
+	(void)opaque;
+
+	if (read(_completion_eventfd, &value, sizeof(value)) < 0) {
+		if (errno_interrupted() || errno_would_block()) {
+			return;
+		}
+
+		log_error("Could not read from io_uring completion eventfd: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	while (io_uring_peek_cqe(&_ring, &cqe) == 0) {
+		request = io_uring_cqe_get_data(cqe);
+		result = cqe->res;
+
+		io_uring_cqe_seen(&_ring, cqe);
+
+		uring_complete_request(request, result);
+	}
+}
+
+int uring_init(void) {
+	int rc;
+
+	log_debug("Initializing io_uring subsystem");
+
+	rc = io_uring_queue_init(URING_QUEUE_DEPTH, &_ring, 0);
+
+	if (rc < 0) {
+		log_warn("Could not create io_uring, falling back to read syscalls: %s (%d)",
+		         get_errno_name(-rc), -rc);
+
+		return 0;
+	}
+
+	_completion_eventfd = eventfd(0, EFD_NONBLOCK);
+
+	if (_completion_eventfd < 0) {
+		log_warn("Could not create io_uring completion eventfd, falling back to read syscalls: %s (%d)",
+		         get_errno_name(errno), errno);
+
+		io_uring_queue_exit(&_ring);
+
+		return 0;
+	}
+
+	rc = io_uring_register_eventfd(&_ring, _completion_eventfd);
+
+	if (rc < 0) {
+		log_warn("Could not register io_uring completion eventfd, falling back to read syscalls: %s (%d)",
+		         get_errno_name(-rc), -rc);
+
+		close(_completion_eventfd);
+		io_uring_queue_exit(&_ring);
+
+		return 0;
+	}
+
+	if (event_add_source(_completion_eventfd, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, uring_handle_completion, NULL) < 0) {
+		log_warn("Could not add io_uring completion eventfd as event source, falling back to read syscalls");
+
+		close(_completion_eventfd);
+		io_uring_queue_exit(&_ring);
+
+		return 0;
+	}
+
+	_available = true;
+
+	return 0;
+}
+
+void uring_exit(void) {
+	struct io_uring_cqe *cqe;
+	URingRequest *request;
+	int result;
+	int rc;
+
+	if (!_available) {
+		return;
+	}
+
+	log_debug("Shutting down io_uring subsystem");
+
+	// the kernel might still write to the buffers of reads in flight. wait
+	// for them to complete before releasing their buffers and the ring
+	while (_requests_in_flight > 0) {
+		rc = io_uring_wait_cqe(&_ring, &cqe);
+
+		if (rc < 0) {
+			if (rc == -EINTR) {
+				continue;
+			}
+
+			log_error("Could not wait for %d io_uring read(s) to complete: %s (%d)",
+			          _requests_in_flight, get_errno_name(-rc), -rc);
+
+			break;
+		}
+
+		request = io_uring_cqe_get_data(cqe);
+		result = cqe->res;
+
+		io_uring_cqe_seen(&_ring, cqe);
+
+		uring_complete_request(request, result);
+	}
+
+	uring_log_statistics();
+
+	event_remove_source(_completion_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+	close(_completion_eventfd);
+
+	io_uring_queue_exit(&_ring);
+
+	_available = false;
+}
+
+void uring_log_statistics(void) {
+	if (!_available) {
+		log_info("io_uring: not available");
+
+		return;
+	}
+
+	log_info("io_uring: %u read(s) submitted, %u read(s) completed, %u read(s) abandoned, %d read(s) in flight, %"PRIu64" byte(s) read",
+	         _submitted_reads, _completed_reads, _abandoned_reads,
+	         _requests_in_flight, _bytes_read);
+}
+
+bool uring_is_available(void) {
+	return _available;
+}
+
+// submits a read of up to length bytes at the given offset into buffer. the
+// complete function is called on the event loop thread with the number of
+// bytes read or with a negative errno value. returns NULL and sets errno if
+// the read could not be submitted
+URingRequest *uring_read(IOHandle fd, void *buffer, int length, uint64_t offset,
+                         URingFunction complete, void *opaque) {
+	URingRequest *request;
+	struct io_uring_sqe *sqe;
+	int rc;
+
+	if (!_available) {
+		errno = ENOSYS;
+
+		return NULL;
+	}
+
+	if (_requests_in_flight >= URING_QUEUE_DEPTH) {
+		errno = EBUSY;
+
+		return NULL;
+	}
+
+	request = calloc(1, sizeof(URingRequest));
+
+	if (request == NULL) {
+		errno = ENOMEM;
+
+		return NULL;
+	}
+
+	sqe = io_uring_get_sqe(&_ring);
+
+	if (sqe == NULL) {
+		free(request);
+
+		errno = EBUSY;
+
+		return NULL;
+	}
+
+	request->complete = complete;
+	request->opaque = opaque;
+	request->buffer = buffer;
+	request->iov.iov_base = buffer;
+	request->iov.iov_len = length;
+
+	// use readv instead of read, it is supported since the first io_uring
+	// capable kernel version
+	io_uring_prep_readv(sqe, fd, &request->iov, 1, offset);
+	io_uring_sqe_set_data(sqe, request);
+
+	rc = io_uring_submit(&_ring);
+
+	if (rc < 0) {
+		// the entry is still queued and might be submitted later on. turn it
+		// into a nop, so it doesn't refer to the buffer anymore
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, NULL);
+
+		free(request);
+
+		errno = -rc;
+
+		return NULL;
+	}
+
+	++_requests_in_flight;
+	++_submitted_reads;
+
+	return request;
+}
+
+// the request will not call its complete function anymore. the ownership of
+// the buffer passes to the engine, it is freed once the read completed
+void uring_abandon(URingRequest *request) {
+	request->complete = NULL;
+	request->opaque = NULL;
+
+	++_abandoned_reads;
+}
+
+#else
+
+int uring_init(void) {
+	log_debug("Not initializing io_uring subsystem, io_uring support is disabled");
+
+	return 0;
+}
+
+void uring_exit(void) {
+}
+
+void uring_log_statistics(void) {
+	log_info("io_uring: disabled");
+}
+
+bool uring_is_available(void) {
+	return false;
+}
+
+URingRequest *uring_read(IOHandle fd, void *buffer, int length, uint64_t offset,
+                         URingFunction complete, void *opaque) {
+	(void)fd;
+	(void)buffer;
+	(void)length;
+	(void)offset;
+	(void)complete;
+	(void)opaque;
+
+	errno = ENOSYS;
+
+	return NULL;
+}
+
+void uring_abandon(URingRequest *request) {
+	(void)request;
+}
+
+#endif
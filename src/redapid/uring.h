@@ -0,0 +1,45 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * uring.h: io_uring based I/O engine for file objects
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef REDAPID_URING_H
+#define REDAPID_URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/io.h>
+
+typedef struct _URingRequest URingRequest;
+
+typedef void (*URingFunction)(int result, void *opaque);
+
+int uring_init(void);
+void uring_exit(void);
+
+void uring_log_statistics(void);
+
+bool uring_is_available(void);
+
+URingRequest *uring_read(IOHandle fd, void *buffer, int length, uint64_t offset,
+                         URingFunction complete, void *opaque);
+void uring_abandon(URingRequest *request);
+
+#endif // REDAPID_URING_H
@@ -0,0 +1,317 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * worker.c: Worker threads for blocking operations
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * some requests require blocking operations, for example opening a file as a
+ * different user or creating a directory on a slow SD card. instead of
+ * stalling the event loop, and with it all other clients, such operations are
+ * submitted to a small pool of worker threads. the work function of a job
+ * runs on one of the worker threads, its complete function runs on the event
+ * loop thread afterwards.
+ *
+ * pending jobs are kept in a mutex protected FIFO. finished jobs are pushed to
+ * a lock-free stack and the completion eventfd is signaled. the event loop
+ * thread takes the whole stack at once and completes the jobs in the order in
+ * which they finished. jobs are allocated and freed on the event loop thread
+ * only.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "worker.h"
+
+#include "pool.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define WORKER_MAX_THREAD_COUNT 16
+
+typedef struct _WorkerJob WorkerJob;
+
+struct _WorkerJob {
+	WorkerFunction work;
+	WorkerFunction complete;
+	void *opaque;
+	WorkerJob *next;
+};
+
+static Pool _job_pool = POOL_INITIALIZER("worker-job", WorkerJob, 16);
+static Thread _threads[WORKER_MAX_THREAD_COUNT];
+static int _thread_count = 0;
+static Mutex _mutex; // protects _pending_head, _pending_tail and _quit
+static Semaphore _semaphore; // released once per submitted job and once per thread for quit
+static WorkerJob *_pending_head = NULL;
+static WorkerJob *_pending_tail = NULL;
+static bool _quit = false;
+static WorkerJob *_finished_jobs = NULL; // lock-free stack, pushed by the worker threads
+static IOHandle _completion_eventfd = IO_HANDLE_INVALID;
+static uint32_t _submitted_jobs = 0;
+static uint32_t _completed_jobs = 0;
+static int _max_jobs_in_progress = 0;
+static int _max_jobs_per_completion = 0;
+
+static void worker_push_finished_job(WorkerJob *job) {
+	WorkerJob *head = __atomic_load_n(&_finished_jobs, __ATOMIC_RELAXED);
+	uint64_t value = 1;
+
+	do {
+		job->next = head;
+	} while (!__atomic_compare_exchange_n(&_finished_jobs, &head, job, true,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	// the eventfd counter only saturates after 2^64 - 2 writes, the write
+	// cannot block here
+	while (write(_completion_eventfd, &value, sizeof(value)) < 0) {
+		if (!errno_interrupted()) {
+			log_error("Could not write to worker completion eventfd: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			break;
+		}
+	}
+}
+
+static void worker_run(void *opaque) {
+	WorkerJob *job;
+	bool quit;
+
+	(void)opaque;
+
+	for (;;) {
+		semaphore_acquire(&_semaphore);
+
+		mutex_lock(&_mutex);
+
+		job = _pending_head;
+
+		if (job != NULL) {
+			_pending_head = job->next;
+
+			if (_pending_head == NULL) {
+				_pending_tail = NULL;
+			}
+		}
+
+		quit = _quit;
+
+		mutex_unlock(&_mutex);
+
+		// all pending jobs are done before the worker threads quit
+		if (job == NULL) {
+			if (quit) {
+				break;
+			}
+
+			continue;
+		}
+
+		job->work(job->opaque);
+
+		worker_push_finished_job(job);
+	}
+}
+
+static void worker_complete_finished_jobs(void) {
+	WorkerJob *stack = __atomic_exchange_n(&_finished_jobs, NULL, __ATOMIC_ACQUIRE);
+	WorkerJob *list = NULL;
+	WorkerJob *job;
+	int count = 0;
+
+	// the stack is in reverse order of finishing, reverse it
+	while (stack != NULL) {
+		job = stack;
+		stack = job->next;
+		job->next = list;
+		list = job;
+	}
+
+	while (list != NULL) {
+		job = list;
+		list = job->next;
+
+		job->complete(job->opaque);
+
+		pool_free(&_job_pool, job);
+
+		++_completed_jobs;
+		++count;
+	}
+
+	if (count > _max_jobs_per_completion) {
+		_max_jobs_per_completion = count;
+	}
+}
+
+static void worker_handle_completion(void *opaque) {
+	uint64_t value;
+
+	(void)opaque;
+
+	if (read(_completion_eventfd, &value, sizeof(value)) < 0) {
+		if (errno_interrupted() || errno_would_block()) {
+			return;
+		}
+
+		log_error("Could not read from worker completion eventfd: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	worker_complete_finished_jobs();
+}
+
+int worker_init(void) {
+	int i;
+
+	log_debug("Initializing worker subsystem");
+
+	_thread_count = config_get_option_value("worker.threads")->integer;
+
+	if (_thread_count > WORKER_MAX_THREAD_COUNT) {
+		_thread_count = WORKER_MAX_THREAD_COUNT;
+	}
+
+	_completion_eventfd = eventfd(0, EFD_NONBLOCK);
+
+	if (_completion_eventfd < 0) {
+		log_error("Could not create worker completion eventfd: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (event_add_source(_completion_eventfd, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, worker_handle_completion, NULL) < 0) {
+		close(_completion_eventfd);
+
+		return -1;
+	}
+
+	if (semaphore_create(&_semaphore) < 0) {
+		log_error("Could not create worker semaphore: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		event_remove_source(_completion_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+		close(_completion_eventfd);
+
+		return -1;
+	}
+
+	mutex_create(&_mutex);
+
+	_quit = false;
+
+	for (i = 0; i < _thread_count; ++i) {
+		thread_create(&_threads[i], worker_run, NULL);
+	}
+
+	log_debug("Started %d worker thread(s)", _thread_count);
+
+	return 0;
+}
+
+void worker_exit(void) {
+	int i;
+
+	log_debug("Shutting down worker subsystem");
+
+	mutex_lock(&_mutex);
+
+	_quit = true;
+
+	mutex_unlock(&_mutex);
+
+	for (i = 0; i < _thread_count; ++i) {
+		semaphore_release(&_semaphore);
+	}
+
+	for (i = 0; i < _thread_count; ++i) {
+		thread_join(&_threads[i]);
+		thread_destroy(&_threads[i]);
+	}
+
+	// complete the jobs that finished after the last event loop iteration,
+	// so that their resources are released
+	worker_complete_finished_jobs();
+
+	worker_log_statistics();
+
+	mutex_destroy(&_mutex);
+	semaphore_destroy(&_semaphore);
+
+	event_remove_source(_completion_eventfd, EVENT_SOURCE_TYPE_GENERIC);
+	close(_completion_eventfd);
+}
+
+void worker_log_statistics(void) {
+	log_info("Worker: %d thread(s), %u job(s) submitted, %u job(s) completed, at most %d job(s) in progress, at most %d job(s) completed at once",
+	         _thread_count, _submitted_jobs, _completed_jobs, _max_jobs_in_progress,
+	         _max_jobs_per_completion);
+}
+
+// the work function is called on a worker thread and must not use any
+// object, pool or other state owned by the event loop thread. the complete
+// function is called on the event loop thread once the work function returned
+APIE worker_submit(WorkerFunction work, WorkerFunction complete, void *opaque) {
+	WorkerJob *job = pool_allocate(&_job_pool);
+
+	if (job == NULL) {
+		return API_E_NO_FREE_MEMORY;
+	}
+
+	job->work = work;
+	job->complete = complete;
+	job->opaque = opaque;
+	job->next = NULL;
+
+	mutex_lock(&_mutex);
+
+	if (_pending_tail != NULL) {
+		_pending_tail->next = job;
+	} else {
+		_pending_head = job;
+	}
+
+	_pending_tail = job;
+
+	mutex_unlock(&_mutex);
+
+	semaphore_release(&_semaphore);
+
+	++_submitted_jobs;
+
+	if ((int)(_submitted_jobs - _completed_jobs) > _max_jobs_in_progress) {
+		_max_jobs_in_progress = _submitted_jobs - _completed_jobs;
+	}
+
+	return API_E_SUCCESS;
+}
@@ -0,0 +1,36 @@
+/*
+ * redapid
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * worker.h: Worker threads for blocking operations
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef REDAPID_WORKER_H
+#define REDAPID_WORKER_H
+
+#include "api_error.h"
+
+typedef void (*WorkerFunction)(void *opaque);
+
+int worker_init(void);
+void worker_exit(void);
+
+void worker_log_statistics(void);
+
+APIE worker_submit(WorkerFunction work, WorkerFunction complete, void *opaque);
+
+#endif // REDAPID_WORKER_H
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "ip_connection.h"
+#include "brick_red.h"
+
+#define HOST "localhost"
+#define PORT 4223
+#define UID "3hG6BK" // Change to your UID
+
+#include "utils.c"
+
+// opens a file as a different user than redapid runs as. run this test once
+// with file.open_helpers = 0 and once with the default value in
+// /etc/redapid.conf to compare forking per open with the open helpers
+#define FILENAME "/tmp/foobar_open_as"
+#define OPEN_UID 1000
+#define OPEN_GID 1000
+#define ITERATIONS 200
+
+int main() {
+	uint8_t ec;
+	int rc;
+	uint16_t session_id;
+	uint16_t sid;
+	uint16_t fid;
+	int i;
+	uint64_t st;
+	uint64_t et;
+	uint64_t min = (uint64_t)-1;
+	uint64_t max = 0;
+	uint64_t total = 0;
+	uint64_t ost;
+	uint64_t oet;
+	float dur;
+
+	// Create IP connection
+	IPConnection ipcon;
+	ipcon_create(&ipcon);
+
+	// Create device object
+	RED red;
+	red_create(&red, UID, &ipcon);
+
+	// Connect to brickd
+	rc = ipcon_connect(&ipcon, HOST, PORT);
+	if (rc < 0) {
+		printf("ipcon_connect -> rc %d\n", rc);
+		return -1;
+	}
+
+	if (create_session(&red, 60, &session_id) < 0) {
+		return -1;
+	}
+
+	if (allocate_string(&red, FILENAME, session_id, &sid) < 0) {
+		goto cleanup;
+	}
+
+	st = microseconds();
+
+	for (i = 0; i < ITERATIONS; ++i) {
+		ost = microseconds();
+
+		rc = red_open_file(&red, sid, RED_FILE_FLAG_WRITE_ONLY | RED_FILE_FLAG_CREATE,
+		                   0644, OPEN_UID, OPEN_GID, session_id, &ec, &fid);
+		if (rc < 0) {
+			printf("red_open_file -> rc %d\n", rc);
+			goto cleanup;
+		}
+		if (ec != 0) {
+			printf("red_open_file -> ec %u\n", ec);
+			goto cleanup;
+		}
+
+		oet = microseconds() - ost;
+		total += oet;
+
+		if (oet < min) {
+			min = oet;
+		}
+
+		if (oet > max) {
+			max = oet;
+		}
+
+		release_object(&red, fid, session_id, "file");
+	}
+
+	et = microseconds();
+
+	dur = (et - st) / 1000000.0;
+
+	printf("opened %d file(s) as %d:%d in %f sec, open-file took %f msec on average (min %f, max %f)\n",
+	       ITERATIONS, OPEN_UID, OPEN_GID, dur, total / 1000.0 / ITERATIONS,
+	       min / 1000.0, max / 1000.0);
+
+cleanup:
+	expire_session(&red, session_id);
+
+	red_destroy(&red);
+	ipcon_destroy(&ipcon);
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "ip_connection.h"
+#include "brick_red.h"
+
+#define HOST "localhost"
+#define PORT 4223
+#define UID "3hG6BK" // Change to your UID
+
+#include "utils.c"
+
+// create the file on the RED Brick first:
+//
+//   dd if=/dev/urandom of=/tmp/foobar_10mb bs=1M count=10
+//
+// then run this test once with file.async_read_chunks_per_event = 1 and once
+// with the default value in /etc/redapid.conf to compare the throughput
+#define FILENAME "/tmp/foobar_10mb"
+#define LENGTH_TO_READ (10 * 1024 * 1024)
+
+uint64_t st;
+volatile uint64_t et = 0;
+uint64_t total_length_read = 0;
+int callbacks = 0;
+
+void async_file_read(uint16_t file_id, uint8_t error_code, uint8_t *buffer, uint8_t length_read, void *user_data) {
+	(void)file_id;
+	(void)buffer;
+	(void)user_data;
+
+	if (error_code != 0) {
+		printf("async_file_read %d -> ec %u\n", callbacks, error_code);
+		et = microseconds();
+		return;
+	}
+
+	++callbacks;
+	total_length_read += length_read;
+
+	if (length_read == 0 || total_length_read >= LENGTH_TO_READ) {
+		et = microseconds();
+	}
+}
+
+int main() {
+	uint8_t ec;
+	int rc;
+	uint16_t session_id;
+	uint16_t sid;
+	uint16_t fid;
+	float dur;
+
+	// Create IP connection
+	IPConnection ipcon;
+	ipcon_create(&ipcon);
+
+	// Create device object
+	RED red;
+	red_create(&red, UID, &ipcon);
+
+	// Connect to brickd
+	rc = ipcon_connect(&ipcon, HOST, PORT);
+	if (rc < 0) {
+		printf("ipcon_connect -> rc %d\n", rc);
+		return -1;
+	}
+
+	if (create_session(&red, 60, &session_id) < 0) {
+		return -1;
+	}
+
+	if (allocate_string(&red, FILENAME, session_id, &sid) < 0) {
+		goto cleanup;
+	}
+
+	rc = red_open_file(&red, sid, RED_FILE_FLAG_READ_ONLY | RED_FILE_FLAG_NON_BLOCKING, 0, 0, 0, session_id, &ec, &fid);
+	if (rc < 0) {
+		printf("red_open_file -> rc %d\n", rc);
+		goto cleanup;
+	}
+	if (ec != 0) {
+		printf("red_open_file -> ec %u\n", ec);
+		goto cleanup;
+	}
+	printf("red_open_file -> fid %u\n", fid);
+
+	red_register_callback(&red, RED_CALLBACK_ASYNC_FILE_READ, async_file_read, NULL);
+
+	st = microseconds();
+
+	rc = red_read_file_async(&red, fid, LENGTH_TO_READ);
+	if (rc < 0) {
+		printf("red_read_file_async -> rc %d\n", rc);
+		goto cleanup;
+	}
+
+	while (et == 0) {
+		usleep(10000);
+	}
+
+	dur = (et - st) / 1000000.0;
+
+	printf("read %"PRIu64" byte(s) in %d callback(s) in %f sec, %f kB/s\n",
+	       total_length_read, callbacks, dur, total_length_read / dur / 1024);
+
+	release_object(&red, fid, session_id, "file");
+
+cleanup:
+	expire_session(&red, session_id);
+
+	red_destroy(&red);
+	ipcon_destroy(&ipcon);
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "ip_connection.h"
+#include "brick_red.h"
+
+#define HOST "localhost"
+#define PORT 4223
+#define UID "3hG6BK" // Change to your UID
+
+#include "utils.c"
+
+#define SESSION_LIFETIME 600
+#define SESSION_MAX_COUNT 60000
+#define CALL_COUNT 1000
+
+uint16_t session_ids[SESSION_MAX_COUNT];
+int session_count = 0;
+
+int create_sessions(RED *red, int count) {
+	int rc;
+	uint8_t ec;
+
+	while (session_count < count) {
+		rc = red_create_session(red, SESSION_LIFETIME, &ec, &session_ids[session_count]);
+		if (rc < 0) {
+			printf("red_create_session -> rc %d\n", rc);
+			return -1;
+		}
+		if (ec != 0) {
+			printf("red_create_session -> ec %u\n", ec);
+			return -1;
+		}
+
+		++session_count;
+	}
+
+	return 0;
+}
+
+int measure_keep_alive(RED *red) {
+	int rc;
+	uint8_t ec;
+	int i;
+	uint16_t session_id;
+	uint64_t st, et;
+
+	st = microseconds();
+
+	for (i = 0; i < CALL_COUNT; ++i) {
+		// spread the calls over all sessions, the newest session has the
+		// highest session ID and was the worst case for the linear lookup
+		session_id = session_ids[session_count - 1 - (i % session_count)];
+
+		rc = red_keep_session_alive(red, session_id, SESSION_LIFETIME, &ec);
+		if (rc < 0) {
+			printf("red_keep_session_alive -> rc %d\n", rc);
+			return -1;
+		}
+		if (ec != 0) {
+			printf("red_keep_session_alive -> ec %u\n", ec);
+			return -1;
+		}
+	}
+
+	et = microseconds();
+
+	printf("%5d session(s): %d keep_session_alive calls in %f sec, %f usec per call\n",
+	       session_count, CALL_COUNT, (et - st) / 1000000.0, (et - st) / (float)CALL_COUNT);
+
+	return 0;
+}
+
+int main() {
+	int rc;
+	int counts[] = {1, 10, 100, 1000, 10000, 30000, SESSION_MAX_COUNT};
+	int i;
+
+	// Create IP connection
+	IPConnection ipcon;
+	ipcon_create(&ipcon);
+
+	// Create device object
+	RED red;
+	red_create(&red, UID, &ipcon);
+
+	// Connect to brickd
+	rc = ipcon_connect(&ipcon, HOST, PORT);
+	if (rc < 0) {
+		printf("ipcon_connect -> rc %d\n", rc);
+		return -1;
+	}
+
+	for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); ++i) {
+		if (create_sessions(&red, counts[i]) < 0) {
+			break;
+		}
+
+		if (measure_keep_alive(&red) < 0) {
+			break;
+		}
+	}
+
+	for (i = 0; i < session_count; ++i) {
+		red_expire_session_unchecked(&red, session_ids[i]);
+	}
+
+	red_destroy(&red);
+	ipcon_destroy(&ipcon);
+
+	return 0;
+}